@@ -14,12 +14,24 @@
 //******************************************************************************
 
 #include "resources/sub.hpp"
+#include "resources/collision.hpp"
+#include "resources/water.hpp"
+#include "resources/terrain.hpp"
+#include "resources/replay.hpp"
 #include <stdio.h>
+#include <chrono>
 
 
 Sub * submodel;
 float scale = 1;
-int t = 0;
+bool capsule_hull = false;    //--capsule-hull on the command line
+
+//the simulation runs at a fixed rate on its own thread, inside Sub - see Sub::simulation_loop()
+
+//frames are only drawn when something changed - plus one of these every so often, if nonzero
+const double heartbeat_interval = 1.0; //seconds
+std::chrono::steady_clock::time_point last_redraw;
+
 
 
 
@@ -35,7 +47,39 @@ glm::vec3 player_forward = JonDefault::player_forward;   //+z
 glm::vec3 player_left = JonDefault::player_left;     //+x
 glm::vec3 player_up = JonDefault::player_up;      //+y
 
+collision_world collision;   //distance field over the walkable space on each floor
+float player_step_size = 0.005f;
+
+water * watermodel;
+bool show_water = false;   //the ocean steps on the cpu every frame it's shown, so it starts off
+
+terrain * seafloor;
+bool show_terrain = true;
+int terrain_map = 0;
+const char* terrain_maps[] = {TERRAIN_PUGET_SOUND, TERRAIN_UNITED_KINGDOM, TERRAIN_POLAND, TERRAIN_RIVER_VALLEY};
+
+bool scene_changed = false;   //for changes outside the sub, which don't mark it dirty
+
+//recording a session, and playing one back - see replay.hpp
+const char* session_file = "session.rec";
+session_recorder recorder;
+
+bool replaying = false;
+std::vector<session_event> replay_events;
+size_t replay_next;
+std::vector<double> replay_frame_ms;
+std::chrono::steady_clock::time_point replay_start, replay_last_frame;
+
+void handle_key(unsigned char key);
+bool is_session_key(unsigned char key);
+void reset_session();
+void start_recording();
+void start_replay();
+bool advance_replay();
+void finish_replay();
+
 bool is_ok(glm::vec3 point);
+void move_player(glm::vec3 delta);
 
 
 
@@ -61,8 +105,11 @@ MessageCallback( GLenum source,
 
 void init()
 {
+  PROFILE_ZONE("init");
+  profiler::instance().name_thread("main");
+
   cout << "initializing models ...";
-  submodel = new Sub();
+  submodel = new Sub(capsule_hull);
   cout << " done." << endl;
 
   submodel->set_view(JonDefault::view);
@@ -71,40 +118,131 @@ void init()
 
   submodel->set_scale(scale);
 
-  glEnable(GL_DEPTH_TEST);
+  cout << "initializing water ...";
+  watermodel = new water();
+  watermodel->set_proj(JonDefault::proj);
+  cout << " done." << endl;
+
+  cout << "initializing terrain ...";
+  seafloor = new terrain(terrain_maps[terrain_map]);
+  cout << " done." << endl;
+
+  cout << "building collision world ...";
+  collision.build(submodel->get_walkable());
+  cout << " done." << endl;
 
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  player_position = glm::vec3(0.0f, JonDefault::floor1yoffset, JonDefault::room1start+0.1);
 
-  glEnable(GL_LINE_SMOOTH);
+  glstate.set_capability(GL_DEPTH_TEST, true);
+
+  glstate.set_capability(GL_BLEND, true);
+  glstate.blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+  glstate.set_capability(GL_LINE_SMOOTH, true);
 
   glClearColor(0.068f, 0.168f, 0.268f, 1.0f);
 
+  last_redraw = std::chrono::steady_clock::now();
 }
 
 //---------------------------------------------------------------------------
 
 void display()
 {
+  PROFILE_ZONE("frame");
 
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+  textures.upload_finished();   //anything that finished loading since last frame
+
+  if(replaying && !advance_replay())
+  {//ran out of session
+    finish_replay();
+    return;
+  }
+  recorder.frame(submodel->get_tick());
+
   // display functions go here
+  if(show_terrain)
+    seafloor->display(submodel->get_proj(), submodel->get_view());
+
   submodel->display();
 
+  if(show_water)
+  {
+    watermodel->update(submodel->get_sim_time());   //simulation time, so replays get the same waves
+    watermodel->display();
+  }
+
   // glFlush();
-  glutSwapBuffers();
-  glutPostRedisplay();
+  {
+    PROFILE_ZONE("swap");
+    glutSwapBuffers();
+  }
+
+  if(replaying)
+  {//frames go back to back during a replay, as fast as they'll draw
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    replay_frame_ms.push_back(std::chrono::duration<double>(now - replay_last_frame).count() * 1000.0);
+    replay_last_frame = now;
+    glutPostRedisplay();
+  }
+  //next frame gets posted by the timer, so frames are paced instead of spinning
 
 }
 
 //----------------------------------------------------------------------------
 
 void keyboard(unsigned char key, int x, int y)
+{
+  if(replaying)
+  {//live input would make the replay something else - escape still gets out
+    if(key == 033)
+      handle_key(key);
+    return;
+  }
+
+  switch(key)
+  {
+    case 'u':   //start/stop recording a session
+      if(recorder.is_recording())
+        recorder.stop();
+      else
+        start_recording();
+      return;
+
+    case 'U':   //play back the last recorded session, and time it
+      start_replay();
+      return;
+
+    default:
+      if(is_session_key(key))
+        recorder.key(submodel->get_tick(), key);
+      break;
+  }
+
+  handle_key(key);
+}
+
+//----------------------------------------------------------------------------
+
+//the keys that change what's simulated or what's seen - only these are recorded and replayed, so the
+//benchmarks, file writes, reports and the fullscreen toggle don't end up in a replay's frame timings
+bool is_session_key(unsigned char key)
+{
+  static const std::string keys = "yhnoljvqwasdzxerp";
+  return key != 0 && keys.find(key) != std::string::npos;
+}
+
+//----------------------------------------------------------------------------
+
+void handle_key(unsigned char key)
 {
   switch (key) {
 
     case 033:
+      recorder.stop();
+      submodel->write_timings("gpu_timings.csv");
       exit(EXIT_SUCCESS);
       break;
 
@@ -114,6 +252,77 @@ void keyboard(unsigned char key, int x, int y)
       submodel->toggle_hull();
       break;
 
+    case 'h':   //hull from the vertex buffer, built in the vertex shader, or ray marched
+      submodel->cycle_hull_mode();
+      break;
+
+    case 'm':
+      submodel->benchmark_hull(200);
+      break;
+
+    case 'b':
+      submodel->get_bvh().benchmark(1000000);
+      break;
+
+    case 'n':
+      submodel->toggle_animation();
+      break;
+
+    case 'g':
+      submodel->write_timings("gpu_timings.csv");
+      break;
+
+    case 't':   //cpu side, everything since startup or the last wrap of the ring buffers
+      profiler::instance().write_trace("trace.json");
+      break;
+
+    case 'c':
+      glstate.report();
+      break;
+
+    case 'o':
+      show_water = !show_water;
+      cout << "water " << (show_water ? "on" : "off") << endl;
+      break;
+
+    case 'O':   //cost of the cpu side of the ocean, by resolution
+      ocean::benchmark(100);
+      break;
+
+    case 'l':
+      show_terrain = !show_terrain;
+      scene_changed = true;
+      break;
+
+    case 'L':   //next height map
+      terrain_map = (terrain_map + 1) % 4;
+      seafloor->load(terrain_maps[terrain_map]);
+      cout << "terrain from " << terrain_maps[terrain_map] << endl;
+      scene_changed = true;
+      break;
+
+    case 'i':   //tint the terrain by lod morph, and count what it drew
+      seafloor->toggle_lod_view();
+      seafloor->report();
+      seafloor->report_tiles();
+      scene_changed = true;
+      break;
+
+    case 'j':   //engine gas - off, light, heavy
+      submodel->cycle_gas();
+      cout << "gas particles: " << submodel->get_gas_count() << " live" << endl;
+      break;
+
+    case 'v':   //bubbles - off, some, lots
+      submodel->cycle_bubbles();
+      cout << "bubbles: " << submodel->get_bubble_count() << " live" << endl;
+      break;
+
+    case 'k':
+      profiler::instance().set_enabled(!profiler::instance().is_enabled());
+      cout << "cpu profiler " << (profiler::instance().is_enabled() ? "on" : "off") << endl;
+      break;
+
 
 
 
@@ -137,7 +346,7 @@ void keyboard(unsigned char key, int x, int y)
         submodel->adjust_yaw_rate(-0.1);
       else
       {//you're inside, so this is forward
-
+        move_player(player_step_size * player_forward);
       }
 
       break;
@@ -148,7 +357,7 @@ void keyboard(unsigned char key, int x, int y)
         submodel->adjust_pitch_rate(0.1);
       else
       {//you're inside, this is left
-
+        move_player(player_step_size * player_left);
       }
       break;
 
@@ -158,7 +367,7 @@ void keyboard(unsigned char key, int x, int y)
         submodel->adjust_pitch_rate(-0.1);
       else
       {//you're inside, this is 'back'
-
+        move_player(-player_step_size * player_forward);
       }
       break;
 
@@ -168,8 +377,8 @@ void keyboard(unsigned char key, int x, int y)
 
     case 'd':
       if(!outside)
-      {//no collision here, it's just right
-
+      {//you're inside, this is right
+        move_player(-player_step_size * player_left);
       }
       break;
 
@@ -220,7 +429,7 @@ void keyboard(unsigned char key, int x, int y)
       submodel->set_view(JonDefault::view);
       submodel->set_proj(JonDefault::proj);
       }
-
+      break;
 
 
 
@@ -230,7 +439,7 @@ void keyboard(unsigned char key, int x, int y)
       break;
 
   }
-  glutPostRedisplay();
+  //no glutPostRedisplay() here - anything that changes the picture marks the sub dirty, and the timer picks it up
 }
 
 //----------------------------------------------------------------------------
@@ -263,12 +472,16 @@ void mouse( int button, int state, int x, int y )
 
       cout << "color at click is r:" << (int)pixel[0] << " g:" << (int)pixel[1] << " b:" << (int)pixel[2] << endl;
 
+      bvh_hit hit;
+      if(submodel->pick(x, y, hit))
+        cout << "picked triangle " << hit.triangle << " in " << submodel->get_bvh().get_range(hit.range).name << endl;
+      else
+        cout << "nothing picked" << endl;
+
 
       //clear the screen
       // glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-      glutPostRedisplay();
-
     }
   }
 }
@@ -277,12 +490,24 @@ void mouse( int button, int state, int x, int y )
 
 void timer(int)
 {
-  t++;
-  submodel->set_time(t);
-  submodel->update_rotation();
+  if(replaying)
+  {//display() keeps itself going
+    glutTimerFunc(1000.0/60.0, timer, 0);
+    return;
+  }
+
+  //this just paces the frames - the simulation keeps its own time
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
 
+  bool heartbeat = heartbeat_interval > 0.0 && std::chrono::duration<double>(now - last_redraw).count() > heartbeat_interval;
+
+  if(submodel->needs_redraw() || heartbeat || show_water || scene_changed || textures.busy())
+  {
+    last_redraw = now;
+    scene_changed = false;
+    glutPostRedisplay();
+  }
 
-	glutPostRedisplay();
 	glutTimerFunc(1000.0/60.0, timer, 0);
 }
 
@@ -295,88 +520,124 @@ void idle( void )
 	// glutPostRedisplay();
 }
 
-
 //----------------------------------------------------------------------------
-//is this an ok move?
-bool is_ok(glm::vec3 point)
-{
-  switch(player_current_state)
-  {
-    case JonDefault::floor1:  //check bounds of first floor
 
-    if(point.y != JonDefault::floor1yoffset)
-      return false;
-
-    if(point.z < JonDefault::room1start)
-      return false;
-
-    if(point.z > JonDefault::room3end)
-      return false;
-
-    if(point.x > JonDefault::radius)
-      return false;
-
-    if(point.x < -1.0f*JonDefault::radius)
-      return false;
-
-    if(point.z > JonDefault::room1end && point.z < JonDefault::room2start)
-    {
-      if(point.x < -0.2f*JonDefault::radius || point.x > 0.2f*JonDefault::radius)
-      {
-        return false;
-      }
-    }
+void window_close()
+{//window closed with the button rather than escape
+  submodel->write_timings("gpu_timings.csv");
+}
 
-    if(point.z > JonDefault::room2end && point.z < JonDefault::room3start)
-    {
-      if(point.x < -0.2f*JonDefault::radius || point.x > 0.2f*JonDefault::radius)
-      {
-        return false;
-      }
-    }
 
-    break;
+//----------------------------------------------------------------------------
+//everything a session can change, back to how it is at startup, so recording
+//and replaying both start from the same place
+void reset_session()
+{
+  submodel->reset();
 
+  scale = 1;
+  submodel->set_scale(scale);
 
+  outside = true;
+  player_current_state = JonDefault::floor1;
+  player_position = glm::vec3(0.0f, JonDefault::floor1yoffset, JonDefault::room1start+0.1);
+  submodel->set_view(JonDefault::view);
+  submodel->set_proj(JonDefault::proj);
 
+  show_water = false;
+  show_terrain = true;
+  seafloor->set_lod_view(false);
+  if(terrain_map != 0)
+  {
+    terrain_map = 0;
+    seafloor->load(terrain_maps[terrain_map]);
+  }
+}
 
+void start_recording()
+{
+  submodel->stop_simulation();
+  reset_session();
+  submodel->start_simulation();
 
+  recorder.start(session_file, submodel->get_step());
+  cout << "recording to " << session_file << ", u again to stop" << endl;
+}
 
+void start_replay()
+{
+  recorder.stop();
 
+  if(!load_session(session_file, submodel->get_step(), replay_events))
+    return;
 
-    case JonDefault::floor2:  //check bounds of second floor
+  submodel->stop_simulation();
+  reset_session();
 
-    if(point.y != JonDefault::floor2yoffset)
-      return false;
+  cout << "replaying " << session_file << ", " << replay_events.size() << " events" << endl;
 
-    if(abs(point.x) < 0.6f*JonDefault::radius && (point.z < JonDefault::room3end && point.z > JonDefault::tallroom2end+0.07f))
-      return true;
+  replaying = true;
+  replay_next = 0;
+  replay_frame_ms.clear();
+  replay_start = replay_last_frame = std::chrono::steady_clock::now();
+  glutPostRedisplay();
+}
 
-    if(abs(point.x) < 0.3f*JonDefault::radius && (point.z < JonDefault::tallroom2end+0.07f && point.z > JonDefault::tallroom1end))
-      return true;
+//steps and presses keys up to the next recorded frame - false when there isn't one
+bool advance_replay()
+{
+  while(replay_next < replay_events.size())
+  {
+    const session_event& e = replay_events[replay_next++];
+    submodel->step_to(e.tick);
 
-    if(abs(point.x) < 0.75f*JonDefault::radius && (point.z < JonDefault::tallroom2end+0.07f && point.z > JonDefault::tallroom1end))
+    if(e.type == event_frame)
       return true;
 
-    return false;
-
-    break;
-
+    //a session file can have any key in it - only the ones that would have been recorded are played
+    if(is_session_key(e.key))
+      handle_key(e.key);
+  }
+  return false;
+}
 
+void finish_replay()
+{
+  replaying = false;
+  double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - replay_start).count();
 
+  std::vector<double> sorted(replay_frame_ms);
+  std::sort(sorted.begin(), sorted.end());
 
+  if(!sorted.empty())
+  {
+    double sum = 0.0;
+    for(double ms : sorted)
+      sum += ms;
 
-    case JonDefault::floor3:  //check bounds of third floor
+    cout << "replay done: " << sorted.size() << " frames in " << total << " s - frame ms avg " << sum / sorted.size()
+         << ", median " << sorted[sorted.size() / 2] << ", p99 " << sorted[(size_t)(0.99 * (sorted.size() - 1))]
+         << ", max " << sorted.back() << endl;
+  }
+  submodel->write_timings("replay_gpu_timings.csv");
 
-    if(point.y != JonDefault::floor3yoffset)
-      return false;
+  //back to live, carrying on from where the session left off
+  submodel->start_simulation();
+  scene_changed = true;
+}
 
+//----------------------------------------------------------------------------
+//is this an ok move?
+bool is_ok(glm::vec3 point)
+{
+  switch(player_current_state)
+  {
+    case JonDefault::floor1:  //check against the distance field for the floor you're on
+    case JonDefault::floor2:
+    case JonDefault::floor3:
+      return collision.is_free(point, player_current_state);
     break;
 
-
-
-
-
     case JonDefault::onetotwo:
     case JonDefault::twotothree:
     case JonDefault::threetotwo:
@@ -384,11 +645,27 @@ bool is_ok(glm::vec3 point)
       //no movement allowed while changing states
       return false;
     break;
-
   }
 
   return true;
+}
+
+//----------------------------------------------------------------------------
+//move as far as you can in the direction of delta, sliding along walls
+void move_player(glm::vec3 delta)
+{
+  if(!is_ok(player_position))
+    return;
+
+  player_position = collision.move(player_position, delta, player_current_state);
 
+  //the geometry goes through the model transform in the shader, so the eye does too
+  glm::mat4 model = submodel->get_model();
+  glm::vec3 eye = glm::vec3(model * glm::vec4(player_position + glm::vec3(0.0f, 0.04f, 0.0f), 1.0f));
+  glm::vec3 forward = glm::vec3(model * glm::vec4(player_forward, 0.0f));
+  glm::vec3 up = glm::vec3(model * glm::vec4(player_up, 0.0f));
+
+  submodel->set_view(glm::lookAt(eye, eye + forward, glm::normalize(up)));
 }
 
 
@@ -397,7 +674,13 @@ bool is_ok(glm::vec3 point)
 
 int main(int argc, char **argv)
 {
-  glutInit(&argc, argv);
+  glutInit(&argc, argv);   //takes out the arguments it knows, the rest are ours
+
+  for(int i = 1; i < argc; i++)
+    if(std::string(argv[i]) == "--capsule-hull")
+      capsule_hull = true;
+    else
+      cout << "unknown argument " << argv[i] << endl;
   // glutInitDisplayMode( GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);  //doesn't look as good
   glutInitDisplayMode(GLUT_MULTISAMPLE | GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
 
@@ -425,6 +708,7 @@ int main(int argc, char **argv)
   glutMouseFunc( mouse );
   glutIdleFunc( idle );
   glutTimerFunc(1000.0/60.0, timer, 0);
+  glutCloseFunc(window_close);
 
 
 
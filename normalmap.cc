@@ -0,0 +1,62 @@
+//******************************************************************************
+//  Program: normalmap
+//
+//  Description: Makes a normal map png from a height map png - the kernels
+//       and options are in resources/normal_map.hpp.
+//
+//         normalmap height.png normal.png [options]
+//
+//           --sobel          Sobel kernel instead of Scharr
+//           --strength s     slope multiplier, 4 by default
+//           --two-channel    x and y only, as grey and alpha
+//           --clamp          clamp at the edges instead of wrapping around
+//
+//       make normalmap builds it.
+//******************************************************************************
+
+#include "resources/normal_map.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+
+int main(int argc, char **argv)
+{
+  if(argc < 3)
+  {
+    cout << "usage: " << argv[0] << " height.png normal.png [--sobel] [--strength s] [--two-channel] [--clamp]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  normal_map_options options;
+  for(int i = 3; i < argc; i++)
+  {
+    if(!strcmp(argv[i], "--sobel"))                       options.kernel = kernel_sobel;
+    else if(!strcmp(argv[i], "--two-channel"))            options.channels = 2;
+    else if(!strcmp(argv[i], "--clamp"))                  options.wrap = false;
+    else if(!strcmp(argv[i], "--strength") && i + 1 < argc) options.strength = atof(argv[++i]);
+    else
+    {
+      cout << "don't know what " << argv[i] << " is" << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::vector<unsigned char> normals;
+  unsigned width, height;
+
+  auto start = std::chrono::steady_clock::now();
+  if(!normal_map_from_png(argv[1], normals, width, height, options))
+    return EXIT_FAILURE;
+  double ms = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000.0;
+
+  unsigned error = lodepng::encode(argv[2], normals, width, height, options.channels == 2 ? LCT_GREY_ALPHA : LCT_RGBA, 8);
+  if(error)
+  {
+    cout << "couldn't write " << argv[2] << ": " << lodepng_error_text(error) << endl;
+    return EXIT_FAILURE;
+  }
+
+  cout << width << "x" << height << " normal map written to " << argv[2] << " (" << ms << " ms, decode included)" << endl;
+  return EXIT_SUCCESS;
+}
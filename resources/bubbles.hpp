@@ -0,0 +1,425 @@
+#ifndef BUBBLES_H
+#define BUBBLES_H
+
+#include "common.hpp"
+#include "gl_state.hpp"
+#include "profiler.hpp"
+#include "texture_loader.hpp"
+
+#include <cstdint>
+
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+
+//******************************************************************************
+//  Class: spatial_hash
+//
+//  Purpose:  A set of grid cells, for asking "is anything near here" in
+//        constant time. Cells are packed into 64 bit keys and kept in a fixed
+//        size open addressing table, linear probing, so a lookup is a
+//        multiply, a shift and usually one cache line.
+//
+//  Functions:
+//    insert(p):
+//        Marks the cell p is in - false if the table is full.
+//
+//    insert_triangle(a, b, c):
+//        Marks every cell the triangle passes through, by sampling it at
+//        under half a cell apart.
+//
+//    contains(p):
+//        True if the cell p is in was marked.
+//******************************************************************************
+
+class spatial_hash
+{
+public:
+  spatial_hash(float cell_size, int log2_slots = 16) : cell(cell_size), inv_cell(1.0f / cell_size),
+                                                         shift(64 - log2_slots), used(0)
+  {
+    slots.assign(size_t(1) << log2_slots, 0);
+  }
+
+  bool insert(glm::vec3 p)
+  {
+    uint64_t k = key(p);
+    size_t mask = slots.size() - 1;
+    for(size_t i = index(k); ; i = (i + 1) & mask)
+    {
+      if(slots[i] == k)
+        return true;
+      if(slots[i] == 0)
+      {
+        if(used + 1 >= slots.size() / 2)   //past half full, probes get long
+          return false;
+        slots[i] = k;
+        used++;
+        return true;
+      }
+    }
+  }
+
+  void insert_triangle(glm::vec3 a, glm::vec3 b, glm::vec3 c)
+  {
+    float longest = std::max(glm::distance(a, b), std::max(glm::distance(b, c), glm::distance(c, a)));
+    int n = std::max(1, int(std::ceil(2.0f * longest * inv_cell)));
+
+    for(int i = 0; i <= n; i++)
+      for(int j = 0; i + j <= n; j++)
+        insert(a + (b - a) * (float(i) / n) + (c - a) * (float(j) / n));
+  }
+
+  bool contains(glm::vec3 p) const
+  {
+    uint64_t k = key(p);
+    size_t mask = slots.size() - 1;
+    for(size_t i = index(k); slots[i] != 0; i = (i + 1) & mask)
+      if(slots[i] == k)
+        return true;
+    return false;
+  }
+
+  size_t size() const     {return used;}
+  float cell_size() const {return cell;}
+
+private:
+  //21 bits per axis, offset so negative cells fit, with the top bit set so no key is 0 - 0 is an empty slot
+  uint64_t key(glm::vec3 p) const
+  {
+    uint64_t x = uint64_t(int64_t(std::floor(p.x * inv_cell)) + (1 << 20)) & 0x1fffff;
+    uint64_t y = uint64_t(int64_t(std::floor(p.y * inv_cell)) + (1 << 20)) & 0x1fffff;
+    uint64_t z = uint64_t(int64_t(std::floor(p.z * inv_cell)) + (1 << 20)) & 0x1fffff;
+    return (uint64_t(1) << 63) | (x << 42) | (y << 21) | z;
+  }
+
+  size_t index(uint64_t k) const    {return size_t((k * 0x9e3779b97f4a7c15ull) >> shift);}
+
+  float cell, inv_cell;
+  int shift;
+  size_t used;
+  std::vector<uint64_t> slots;
+};
+
+
+//******************************************************************************
+//  Class: bubble_field
+//
+//  Purpose:  Bubbles coming off the propeller and the hull, rising and
+//        drifting until they touch the hull, leave the area around the sub,
+//        or run out of life. Drawn as point sprites, with the sphere texture.
+//
+//        Same storage as gas_particles - a struct of arrays, sized once, live
+//        bubbles packed at the front. Each bubble eases toward its rise speed,
+//        which goes with its radius, 4 at a time through SSE2. Touching the
+//        hull is a spatial_hash lookup of the cells the hull mesh goes
+//        through.
+//
+//        The vertex buffer is persistently mapped - three regions of
+//        capacity bubbles each, written in turn, with a fence after each
+//        frame's draw so a region isn't written while the GPU could still be
+//        reading it. There's no map or unmap per frame, and no orphaning.
+//
+//  Functions:
+//    set_hull(points, start, num):
+//        Fills the hash from those triangles, and keeps a set of points
+//        on them to spawn bubbles from.
+//
+//    emit_propeller(hub, radius, n) / emit_hull(n):
+//        n new bubbles on the propeller's disk, or on the hull.
+//
+//    step(dt, up):
+//        Up is the way bubbles rise, in model space.
+//
+//    display(proj, view, model):
+//        Writes the next region, and one glDrawArrays of points.
+//******************************************************************************
+
+class bubble_field
+{
+public:
+  bubble_field(int capacity = 65536) : capacity(capacity), count(0), rng(0x2545f491u), hull_cells(0.02f)
+  {
+    px.resize(capacity); py.resize(capacity); pz.resize(capacity);
+    vx.resize(capacity); vy.resize(capacity); vz.resize(capacity);
+    radius.resize(capacity); age.resize(capacity); life.resize(capacity);
+  }
+
+  void init();
+  void set_hull(const std::vector<glm::vec3>& points, int start, int num);
+
+  void clear()                  {count = 0; rng = 0x2545f491u;}
+  int get_count() const         {return count;}
+  int get_capacity() const      {return capacity;}
+
+  void emit_propeller(glm::vec3 hub, float prop_radius, int n);
+  void emit_hull(int n);
+  void step(float dt, glm::vec3 up);
+  void display(glm::mat4 proj, glm::mat4 view, glm::mat4 model);
+
+  float rise = 25.0f;         //rise speed per unit of radius
+  float ease = 3.0f;          //how fast a bubble gets to that speed, per second
+  float extent = 2.0f;        //gone past this far from the middle of the sub
+
+private:
+  static const int num_regions = 3;
+
+  int capacity, count;
+  uint32_t rng;
+
+  std::vector<float> px, py, pz;
+  std::vector<float> vx, vy, vz;
+  std::vector<float> radius, age, life;
+
+  spatial_hash hull_cells;
+  std::vector<glm::vec3> spawn_points, spawn_normals;
+
+  //xorshift, -1 to 1
+  float jitter()
+  {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return (rng >> 8) * (2.0f / 16777216.0f) - 1.0f;
+  }
+
+  void add(glm::vec3 p, glm::vec3 v, float r, float lifetime);
+  void kill(int i);
+
+  GLuint shader, vao, buffer, sprite;
+  GLint proj_loc, view_loc, model_loc, viewport_height_loc;
+  glm::vec4* mapped;
+  GLsync fences[num_regions];
+  int region;
+};
+
+
+void bubble_field::init()
+{
+  cout << " compiling bubble shaders" << endl;
+  {
+    PROFILE_ZONE("Shader compile");
+    Shader s("resources/shaders/bubble_vert.glsl", "resources/shaders/bubble_frag.glsl");
+    shader = s.Program;
+  }
+  glstate.use_program(shader);
+
+  proj_loc = glGetUniformLocation(shader, "proj");
+  view_loc = glGetUniformLocation(shader, "view");
+  model_loc = glGetUniformLocation(shader, "model");
+  viewport_height_loc = glGetUniformLocation(shader, "viewport_height");
+  glUniform1i(glGetUniformLocation(shader, "sprite"), 3);
+
+  //the sphere, in the background - the 1x1 placeholder is fine until it's there
+  sprite = textures.load(POINT_SPRITE_PATH, mip_color, 4, false);
+
+  glGenVertexArrays(1, &vao);
+  glstate.bind_vertex_array(vao);
+
+  //immutable storage, mapped once, for good
+  GLsizeiptr bytes = sizeof(glm::vec4) * capacity * num_regions;
+  GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+  glGenBuffers(1, &buffer);
+  glstate.bind_buffer(GL_ARRAY_BUFFER, buffer);
+  glBufferStorage(GL_ARRAY_BUFFER, bytes, NULL, flags);
+  mapped = (glm::vec4*)glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags);
+  if(!mapped)
+    cout << "couldn't map the bubble buffer, there won't be bubbles" << endl;
+
+  //one attribute over all three regions - which region gets drawn is the first vertex
+  GLint position_radius_attrib = glGetAttribLocation(shader, "vPositionRadius");
+  glEnableVertexAttribArray(position_radius_attrib);
+  glVertexAttribPointer(position_radius_attrib, 4, GL_FLOAT, false, 0, (static_cast<const char*>(0) + (0)));
+
+  for(int i = 0; i < num_regions; i++)
+    fences[i] = 0;
+  region = 0;
+}
+
+void bubble_field::set_hull(const std::vector<glm::vec3>& points, int start, int num)
+{
+  PROFILE_ZONE("bubble_field::set_hull");
+
+  for(int i = start; i + 2 < start + num; i += 3)
+    hull_cells.insert_triangle(points[i], points[i + 1], points[i + 2]);
+
+  //spawn points a couple of cells out, so they don't start off touching
+  glm::vec3 middle(0.0f);
+  for(int i = start; i < start + num; i++)
+    middle += points[i];
+  middle /= float(std::max(num, 1));
+
+  int stride = std::max(3, (num / 3 / 4096) * 3);
+  for(int i = start; i + 2 < start + num; i += stride)
+  {
+    glm::vec3 c = (points[i] + points[i + 1] + points[i + 2]) / 3.0f;
+    glm::vec3 n = glm::cross(points[i + 1] - points[i], points[i + 2] - points[i]);
+    if(glm::length(n) == 0.0f)
+      continue;
+    n = glm::normalize(n);
+    if(glm::dot(n, c - middle) < 0.0f)   //outward, whichever way the triangle was wound
+      n = -n;
+
+    spawn_points.push_back(c + 2.0f * hull_cells.cell_size() * n);
+    spawn_normals.push_back(n);
+  }
+
+  cout << "bubble hash has " << hull_cells.size() << " hull cells, " << spawn_points.size() << " spawn points" << endl;
+}
+
+void bubble_field::add(glm::vec3 p, glm::vec3 v, float r, float lifetime)
+{
+  if(count == capacity)
+    return;
+
+  px[count] = p.x;  py[count] = p.y;  pz[count] = p.z;
+  vx[count] = v.x;  vy[count] = v.y;  vz[count] = v.z;
+  radius[count] = r;
+  age[count] = 0.0f;
+  life[count] = lifetime;
+  count++;
+}
+
+void bubble_field::kill(int i)
+{
+  count--;
+  px[i] = px[count];  py[i] = py[count];  pz[i] = pz[count];
+  vx[i] = vx[count];  vy[i] = vy[count];  vz[i] = vz[count];
+  radius[i] = radius[count];  age[i] = age[count];  life[i] = life[count];
+}
+
+void bubble_field::emit_propeller(glm::vec3 hub, float prop_radius, int n)
+{
+  for(int i = 0; i < n; i++)
+  {
+    //somewhere on the disk the blades sweep, thrown back and around
+    float a = 0.5f * JonDefault::twopi * jitter();
+    float d = prop_radius * std::sqrt(0.5f + 0.5f * jitter());
+    glm::vec3 out = glm::vec3(std::cos(a), std::sin(a), 0.0f);
+    glm::vec3 around = glm::vec3(-out.y, out.x, 0.0f);
+
+    glm::vec3 v = glm::vec3(0.0f, 0.0f, -0.3f) + 0.15f * around + 0.02f * glm::vec3(jitter(), jitter(), jitter());
+    add(hub + d * out, v, 0.002f + 0.0015f * jitter(), 4.0f + jitter());
+  }
+}
+
+void bubble_field::emit_hull(int n)
+{
+  if(spawn_points.empty())
+    return;
+
+  for(int i = 0; i < n; i++)
+  {
+    int s = std::min(int((0.5f + 0.5f * jitter()) * spawn_points.size()), int(spawn_points.size()) - 1);
+    glm::vec3 v = 0.01f * spawn_normals[s] + 0.005f * glm::vec3(jitter(), jitter(), jitter());
+    add(spawn_points[s], v, 0.0015f + 0.001f * jitter(), 8.0f + 2.0f * jitter());
+  }
+}
+
+void bubble_field::step(float dt, glm::vec3 up)
+{
+  PROFILE_ZONE("bubble_field::step");
+
+  //v += (rise * radius * up - v) * k, then p += v dt - the same order in both paths
+  float k = std::min(1.0f, ease * dt);
+  glm::vec3 target = rise * up;
+
+  int i = 0;
+
+#ifdef __SSE2__
+  const __m128 v_k = _mm_set1_ps(k), v_dt = _mm_set1_ps(dt);
+  const __m128 tx = _mm_set1_ps(target.x), ty = _mm_set1_ps(target.y), tz = _mm_set1_ps(target.z);
+
+  for(; i + 4 <= count; i += 4)
+  {
+    __m128 r = _mm_loadu_ps(&radius[i]);
+
+    __m128 x = _mm_loadu_ps(&vx[i]), y = _mm_loadu_ps(&vy[i]), z = _mm_loadu_ps(&vz[i]);
+    x = _mm_add_ps(x, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(tx, r), x), v_k));
+    y = _mm_add_ps(y, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(ty, r), y), v_k));
+    z = _mm_add_ps(z, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(tz, r), z), v_k));
+
+    _mm_storeu_ps(&vx[i], x);
+    _mm_storeu_ps(&vy[i], y);
+    _mm_storeu_ps(&vz[i], z);
+
+    _mm_storeu_ps(&px[i], _mm_add_ps(_mm_loadu_ps(&px[i]), _mm_mul_ps(x, v_dt)));
+    _mm_storeu_ps(&py[i], _mm_add_ps(_mm_loadu_ps(&py[i]), _mm_mul_ps(y, v_dt)));
+    _mm_storeu_ps(&pz[i], _mm_add_ps(_mm_loadu_ps(&pz[i]), _mm_mul_ps(z, v_dt)));
+
+    _mm_storeu_ps(&age[i], _mm_add_ps(_mm_loadu_ps(&age[i]), v_dt));
+  }
+#endif
+
+  for(; i < count; i++)
+  {
+    vx[i] = vx[i] + (target.x * radius[i] - vx[i]) * k;
+    vy[i] = vy[i] + (target.y * radius[i] - vy[i]) * k;
+    vz[i] = vz[i] + (target.z * radius[i] - vz[i]) * k;
+
+    px[i] += vx[i] * dt;
+    py[i] += vy[i] * dt;
+    pz[i] += vz[i] * dt;
+
+    age[i] += dt;
+  }
+
+  //popped on the hull, out of range, or just old
+  float e2 = extent * extent;
+  for(i = 0; i < count; )
+  {
+    glm::vec3 p = glm::vec3(px[i], py[i], pz[i]);
+    if(age[i] >= life[i] || glm::dot(p, p) > e2 || hull_cells.contains(p))
+      kill(i);
+    else
+      i++;
+  }
+}
+
+void bubble_field::display(glm::mat4 proj, glm::mat4 view, glm::mat4 model)
+{
+  PROFILE_ZONE("bubble_field::display");
+
+  if(count == 0 || !mapped)
+    return;
+
+  //the region from three frames ago - its fence has almost always passed by now
+  if(fences[region])
+  {
+    PROFILE_ZONE("bubble fence wait");
+    glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+    glDeleteSync(fences[region]);
+    fences[region] = 0;
+  }
+
+  glm::vec4* out = mapped + size_t(region) * capacity;
+  for(int i = 0; i < count; i++)
+    out[i] = glm::vec4(px[i], py[i], pz[i], radius[i]);
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  glstate.use_program(shader);
+  glstate.bind_vertex_array(vao);
+  glstate.bind_texture(3, GL_TEXTURE_2D, sprite);
+
+  glUniformMatrix4fv(proj_loc, 1, GL_FALSE, glm::value_ptr(proj));
+  glUniformMatrix4fv(view_loc, 1, GL_FALSE, glm::value_ptr(view));
+  glUniformMatrix4fv(model_loc, 1, GL_FALSE, glm::value_ptr(model));
+  glUniform1f(viewport_height_loc, float(viewport[3]));
+
+  //sized in the shader, tested against depth but not written to it
+  glstate.set_capability(GL_PROGRAM_POINT_SIZE, true);
+  glDepthMask(GL_FALSE);
+
+  glDrawArrays(GL_POINTS, region * capacity, count);
+
+  glDepthMask(GL_TRUE);
+
+  fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  region = (region + 1) % num_regions;
+}
+
+#endif
@@ -0,0 +1,546 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "common.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <string>
+#include <thread>
+
+
+//******************************************************************************
+//  Class: bvh
+//
+//  Purpose:  Bounding volume hierarchy over the triangles that the Sub class
+//        generates, so that picking, line of sight and collision can be done
+//        on the CPU without reading anything back from the GPU.
+//
+//  Functions:
+//
+//    Build:
+//        Takes the points vector (GL_TRIANGLES order, three verticies per
+//        triangle) and the list of draw ranges that partition it - the same
+//        start/num pairs that get handed to glDrawArrays. Splits are chosen
+//        with a binned surface area heuristic, and the upper levels of the
+//        tree are built on separate threads. Nodes end up in one flat array in
+//        depth-first order, so the left child of an interior node is always
+//        the node right after it. Nothing goes deeper than max_depth - a
+//        node there is a leaf, however many triangles it has - so traversal
+//        can use a fixed size stack.
+//
+//    Queries:
+//        intersect() finds the closest hit along a ray, intersect_segment()
+//        does the same for the segment between two points, and occluded() is
+//        the any-hit version of that, for line of sight. Hits report the
+//        triangle (as the index of its first vertex in the points vector) and
+//        which of the draw ranges it came from.
+//
+//    Benchmark:
+//        Casts random rays at the geometry and reports rays per second, single
+//        threaded and across all hardware threads.
+//******************************************************************************
+
+
+typedef struct bvh_range_t
+{
+  std::string name;
+  int start, num;   //same as the arguments to glDrawArrays
+} bvh_range;
+
+
+typedef struct bvh_hit_t
+{
+  int triangle;       //index of the first vertex of the hit triangle in the points vector
+  int range;          //index of the draw range which contains that triangle
+  float t;            //distance along the ray, in units of the direction vector
+  glm::vec2 uv;       //barycentric coordinates of the hit on the triangle
+  glm::vec3 position;
+  glm::vec3 normal;   //geometric normal, not normalized against the ray
+} bvh_hit;
+
+
+class bvh
+{
+public:
+
+  void build(const std::vector<glm::vec3>& points, const std::vector<bvh_range>& ranges);
+
+  bool intersect(glm::vec3 origin, glm::vec3 dir, float tmax, bvh_hit& hit) const;
+  bool intersect_segment(glm::vec3 a, glm::vec3 b, bvh_hit& hit) const;
+  bool occluded(glm::vec3 a, glm::vec3 b) const;
+
+  const bvh_range& get_range(int i) const {return ranges[i];}
+
+  int get_num_nodes() const     {return nodes.size();}
+  int get_num_triangles() const {return tris.size();}
+
+  void benchmark(int num_rays) const;
+
+  static const int max_depth = 64;   //root is depth 0, and one stack entry per level is all traversal needs
+
+private:
+
+  typedef struct node_t
+  {
+    glm::vec3 bmin;
+    int first;      //interior: index of the right child, leaf: first triangle in tris
+    glm::vec3 bmax;
+    int count;      //number of triangles in a leaf, zero for interior nodes
+  } node;
+
+  typedef struct tri_t
+  {//laid out for the intersection test, in leaf order
+    glm::vec3 v0, e1, e2;
+    int vertex;     //index of the first vertex in the points vector
+    int range;
+  } tri;
+
+  typedef struct build_tri_t
+  {
+    glm::vec3 bmin, bmax, centroid;
+  } build_tri;
+
+  std::vector<node> nodes;
+  std::vector<tri> tris;
+  std::vector<bvh_range> ranges;
+
+  //only used during the build
+  std::vector<build_tri> build_tris;
+  std::vector<int> ids;
+  int parallel_depth;
+
+  int build_node(std::vector<node>& out, int first, int count, int depth);
+  void splice(std::vector<node>& out, const std::vector<node>& subtree);
+
+  template <bool any_hit>
+  bool traverse(glm::vec3 origin, glm::vec3 dir, float tmax, bvh_hit& hit) const;
+};
+
+
+// //******************************************************************************
+
+void bvh::build(const std::vector<glm::vec3>& points, const std::vector<bvh_range>& in_ranges)
+{
+  PROFILE_ZONE("bvh::build");
+  ranges = in_ranges;
+
+  //triangle id -> vertex index and range, flattened over all the ranges
+  std::vector<int> vertex_of, range_of;
+  for(int r = 0; r < (int)ranges.size(); r++)
+    for(int v = ranges[r].start; v + 2 < ranges[r].start + ranges[r].num; v += 3)
+    {
+      vertex_of.push_back(v);
+      range_of.push_back(r);
+    }
+
+  int n = vertex_of.size();
+
+  build_tris.resize(n);
+  ids.resize(n);
+
+
+  //per-triangle bounds, split across threads in contiguous chunks
+  int num_threads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::thread> workers;
+
+  for(int w = 0; w < num_threads; w++)
+  {
+    workers.push_back(std::thread([&, w]()
+    {
+      for(int i = (n * w) / num_threads; i < (n * (w + 1)) / num_threads; i++)
+      {
+        const glm::vec3& a = points[vertex_of[i]];
+        const glm::vec3& b = points[vertex_of[i]+1];
+        const glm::vec3& c = points[vertex_of[i]+2];
+
+        build_tris[i].bmin = glm::min(a, glm::min(b, c));
+        build_tris[i].bmax = glm::max(a, glm::max(b, c));
+        build_tris[i].centroid = (a + b + c) / 3.0f;
+        ids[i] = i;
+      }
+    }));
+  }
+
+  for(auto& w : workers)
+    w.join();
+
+
+  //each split above this depth hands its left subtree to another thread
+  parallel_depth = 0;
+  while((1 << parallel_depth) < num_threads)
+    parallel_depth++;
+
+  nodes.clear();
+  nodes.reserve(n);
+
+  if(n > 0)
+    build_node(nodes, 0, n, 0);
+
+
+  //reorder the triangles into leaf order, so leaves reference contiguous runs
+  tris.resize(n);
+  for(int i = 0; i < n; i++)
+  {
+    const glm::vec3& a = points[vertex_of[ids[i]]];
+
+    tris[i].v0 = a;
+    tris[i].e1 = points[vertex_of[ids[i]]+1] - a;
+    tris[i].e2 = points[vertex_of[ids[i]]+2] - a;
+    tris[i].vertex = vertex_of[ids[i]];
+    tris[i].range = range_of[ids[i]];
+  }
+
+  build_tris.clear();
+  build_tris.shrink_to_fit();
+  ids.clear();
+  ids.shrink_to_fit();
+}
+
+// //******************************************************************************
+
+int bvh::build_node(std::vector<node>& out, int first, int count, int depth)
+{
+  const int num_bins = 12;
+  const int max_leaf = 4;
+
+  int index = out.size();
+  out.push_back(node());
+
+  glm::vec3 bmin(1e30f), bmax(-1e30f);
+  glm::vec3 cmin(1e30f), cmax(-1e30f);
+
+  for(int i = first; i < first + count; i++)
+  {
+    const build_tri& b = build_tris[ids[i]];
+    bmin = glm::min(bmin, b.bmin);
+    bmax = glm::max(bmax, b.bmax);
+    cmin = glm::min(cmin, b.centroid);
+    cmax = glm::max(cmax, b.centroid);
+  }
+
+  out[index].bmin = bmin;
+  out[index].bmax = bmax;
+  out[index].first = first;
+  out[index].count = count;
+
+  if(count <= max_leaf || depth >= max_depth)
+    return index;
+
+
+  //binned SAH - evaluate num_bins-1 candidate planes on each axis
+  int best_axis = -1, best_split = 0;
+  float best_cost = 1e30f;
+
+  for(int axis = 0; axis < 3; axis++)
+  {
+    float extent = cmax[axis] - cmin[axis];
+    if(extent <= 0.0f)
+      continue;
+
+    int bin_count[num_bins] = {0};
+    glm::vec3 bin_min[num_bins], bin_max[num_bins];
+    for(int b = 0; b < num_bins; b++)
+    {
+      bin_min[b] = glm::vec3(1e30f);
+      bin_max[b] = glm::vec3(-1e30f);
+    }
+
+    float k = num_bins / extent;
+    for(int i = first; i < first + count; i++)
+    {
+      const build_tri& t = build_tris[ids[i]];
+      int b = std::min(num_bins - 1, (int)((t.centroid[axis] - cmin[axis]) * k));
+      bin_count[b]++;
+      bin_min[b] = glm::min(bin_min[b], t.bmin);
+      bin_max[b] = glm::max(bin_max[b], t.bmax);
+    }
+
+    //sweep from the right to get the area and count to the right of each plane
+    float right_area[num_bins];
+    int right_count[num_bins];
+    glm::vec3 rmin(1e30f), rmax(-1e30f);
+    int rc = 0;
+    for(int b = num_bins - 1; b > 0; b--)
+    {
+      rc += bin_count[b];
+      rmin = glm::min(rmin, bin_min[b]);
+      rmax = glm::max(rmax, bin_max[b]);
+      glm::vec3 e = rmax - rmin;
+      right_area[b] = rc ? (e.x*e.y + e.y*e.z + e.z*e.x) : 0.0f;
+      right_count[b] = rc;
+    }
+
+    glm::vec3 lmin(1e30f), lmax(-1e30f);
+    int lc = 0;
+    for(int b = 0; b < num_bins - 1; b++)
+    {
+      lc += bin_count[b];
+      lmin = glm::min(lmin, bin_min[b]);
+      lmax = glm::max(lmax, bin_max[b]);
+      glm::vec3 e = lmax - lmin;
+      float left_area = lc ? (e.x*e.y + e.y*e.z + e.z*e.x) : 0.0f;
+
+      float cost = lc * left_area + right_count[b+1] * right_area[b+1];
+      if(lc && right_count[b+1] && cost < best_cost)
+      {
+        best_cost = cost;
+        best_axis = axis;
+        best_split = b + 1;
+      }
+    }
+  }
+
+  glm::vec3 e = bmax - bmin;
+  float leaf_cost = count * (e.x*e.y + e.y*e.z + e.z*e.x);
+
+  int mid;
+  if(best_axis == -1)
+  {//all the centroids are in the same place, just split by count
+    mid = first + count / 2;
+  }
+  else
+  {
+    if(best_cost >= leaf_cost && count <= 4 * max_leaf)
+      return index;
+
+    float k = num_bins / (cmax[best_axis] - cmin[best_axis]);
+    float lo = cmin[best_axis];
+    int axis = best_axis, split = best_split;
+
+    mid = std::partition(ids.begin() + first, ids.begin() + first + count, [&](int id)
+    {
+      return std::min(num_bins - 1, (int)((build_tris[id].centroid[axis] - lo) * k)) < split;
+    }) - ids.begin();
+  }
+
+  out[index].count = 0;
+
+  if(depth < parallel_depth && count > 4096)
+  {//left subtree on another thread, right on this one, then stitch them together
+    std::vector<node> left_nodes, right_nodes;
+
+    std::thread left_thread([&]() {PROFILE_ZONE("bvh subtree"); build_node(left_nodes, first, mid - first, depth + 1);});
+    build_node(right_nodes, mid, first + count - mid, depth + 1);
+    left_thread.join();
+
+    splice(out, left_nodes);
+    out[index].first = out.size();
+    splice(out, right_nodes);
+  }
+  else
+  {
+    build_node(out, first, mid - first, depth + 1);
+    int right = build_node(out, mid, first + count - mid, depth + 1);
+    out[index].first = right;
+  }
+
+  return index;
+}
+
+// //******************************************************************************
+
+void bvh::splice(std::vector<node>& out, const std::vector<node>& subtree)
+{
+  //child indices in the subtree are relative to its own root
+  int offset = out.size();
+  for(auto n : subtree)
+  {
+    if(n.count == 0)
+      n.first += offset;
+    out.push_back(n);
+  }
+}
+
+// //******************************************************************************
+
+template <bool any_hit>
+bool bvh::traverse(glm::vec3 origin, glm::vec3 dir, float tmax, bvh_hit& hit) const
+{
+  if(nodes.empty())
+    return false;
+
+  glm::vec3 inv_dir = 1.0f / dir;
+  int dir_neg[3] = {inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0};
+
+  int stack[max_depth];
+  int sp = 0;
+  int current = 0;
+
+  int best = -1;
+  float best_t = tmax, best_u = 0, best_v = 0;
+
+  while(true)
+  {
+    const node& n = nodes[current];
+
+    //slab test
+    glm::vec3 t0 = (n.bmin - origin) * inv_dir;
+    glm::vec3 t1 = (n.bmax - origin) * inv_dir;
+    glm::vec3 tnear = glm::min(t0, t1);
+    glm::vec3 tfar = glm::max(t0, t1);
+    float enter = std::max(std::max(tnear.x, tnear.y), std::max(tnear.z, 0.0f));
+    float exit = std::min(std::min(tfar.x, tfar.y), std::min(tfar.z, best_t));
+
+    if(enter <= exit)
+    {
+      if(n.count > 0)
+      {
+        for(int i = n.first; i < n.first + n.count; i++)
+        {//moller-trumbore
+          const tri& tr = tris[i];
+
+          glm::vec3 p = glm::cross(dir, tr.e2);
+          float det = glm::dot(tr.e1, p);
+          if(std::abs(det) < 1e-12f)
+            continue;
+
+          float inv_det = 1.0f / det;
+          glm::vec3 s = origin - tr.v0;
+          float u = glm::dot(s, p) * inv_det;
+          if(u < 0.0f || u > 1.0f)
+            continue;
+
+          glm::vec3 q = glm::cross(s, tr.e1);
+          float v = glm::dot(dir, q) * inv_det;
+          if(v < 0.0f || u + v > 1.0f)
+            continue;
+
+          float t = glm::dot(tr.e2, q) * inv_det;
+          if(t < 0.0f || t >= best_t)
+            continue;
+
+          best = i; best_t = t; best_u = u; best_v = v;
+
+          if(any_hit)
+            goto done;
+        }
+      }
+      else
+      {//near child first, push the far one
+        int left = current + 1, right = n.first;
+        int axis = 0;
+        glm::vec3 ext = n.bmax - n.bmin;
+        if(ext.y > ext[axis]) axis = 1;
+        if(ext.z > ext[axis]) axis = 2;
+
+        assert(sp < max_depth);
+        if(dir_neg[axis])
+        {
+          stack[sp++] = left;
+          current = right;
+        }
+        else
+        {
+          stack[sp++] = right;
+          current = left;
+        }
+        continue;
+      }
+    }
+
+    if(sp == 0)
+      break;
+    current = stack[--sp];
+  }
+
+done:
+  if(best == -1)
+    return false;
+
+  const tri& tr = tris[best];
+  hit.triangle = tr.vertex;
+  hit.range = tr.range;
+  hit.t = best_t;
+  hit.uv = glm::vec2(best_u, best_v);
+  hit.position = origin + best_t * dir;
+  hit.normal = glm::cross(tr.e1, tr.e2);
+
+  return true;
+}
+
+// //******************************************************************************
+
+bool bvh::intersect(glm::vec3 origin, glm::vec3 dir, float tmax, bvh_hit& hit) const
+{
+  return traverse<false>(origin, dir, tmax, hit);
+}
+
+bool bvh::intersect_segment(glm::vec3 a, glm::vec3 b, bvh_hit& hit) const
+{
+  //direction is left unnormalized, so t runs from 0 at a to 1 at b
+  return traverse<false>(a, b - a, 1.0f, hit);
+}
+
+bool bvh::occluded(glm::vec3 a, glm::vec3 b) const
+{
+  bvh_hit unused;
+  return traverse<true>(a, b - a, 1.0f, unused);
+}
+
+// //******************************************************************************
+
+void bvh::benchmark(int num_rays) const
+{
+  if(nodes.empty())
+    return;
+
+  //rays from a sphere around the geometry, aimed at points inside its bounds
+  std::mt19937 mt(1234);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+  glm::vec3 center = (nodes[0].bmin + nodes[0].bmax) * 0.5f;
+  glm::vec3 half = (nodes[0].bmax - nodes[0].bmin) * 0.5f;
+  float r = 2.0f * glm::length(half);
+
+  std::vector<glm::vec3> origins(num_rays), dirs(num_rays);
+  for(int i = 0; i < num_rays; i++)
+  {
+    glm::vec3 o;
+    do { o = glm::vec3(dist(mt), dist(mt), dist(mt)); } while(glm::dot(o,o) > 1.0f || glm::dot(o,o) < 1e-4f);
+
+    origins[i] = center + r * glm::normalize(o);
+    dirs[i] = glm::normalize(center + half * glm::vec3(dist(mt), dist(mt), dist(mt)) - origins[i]);
+  }
+
+  int num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  for(int pass = 0; pass < 2; pass++)
+  {
+    int threads = pass == 0 ? 1 : num_threads;
+    if(pass == 1 && num_threads == 1)
+      break;
+
+    std::vector<int> hits(threads, 0);
+    std::vector<std::thread> workers;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for(int w = 0; w < threads; w++)
+    {
+      workers.push_back(std::thread([&, w]()
+      {
+        bvh_hit h;
+        for(int i = (num_rays * w) / threads; i < (num_rays * (w + 1)) / threads; i++)
+          if(intersect(origins[i], dirs[i], 1e30f, h))
+            hits[w]++;
+      }));
+    }
+
+    int total_hits = 0;
+    for(int w = 0; w < threads; w++)
+    {
+      workers[w].join();
+      total_hits += hits[w];
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    cout << "bvh benchmark: " << num_rays << " rays on " << threads << " thread(s) in " << seconds * 1000.0 << " ms, "
+         << (num_rays / seconds) / 1.0e6 << " Mrays/s, " << total_hits << " hits" << endl;
+  }
+}
+
+#endif
@@ -0,0 +1,415 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include "common.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+
+//******************************************************************************
+//  Class: collision_world
+//
+//  Purpose:  To keep the player inside the walkable parts of the sub. The
+//        walkable space on each floor is described as a handful of volumes
+//        (boxes, optionally with the rounded roof the floor 1 rooms have),
+//        read from the room layout along with the rooms themselves, and
+//        these are baked into one distance field voxel grid per floor.
+//        The floors get separate grids because the floor 2 walkways sit
+//        inside the tall floor 3 rooms - as one field, you could walk right
+//        off the edge of them.
+//
+//  Functions:
+//
+//    Build:
+//        Evaluates the volumes at every voxel (capsdf for the rounded roofs),
+//        split across threads by z slices. The stored value is the distance
+//        to the nearest wall - positive in free space, negative in the walls.
+//        Taking the min over the volumes is only exact outside them - inside,
+//        it sees the faces where a walkway overlaps a room as walls - so the
+//        free space gets a Euclidean distance transform over the grid instead.
+//
+//    Queries:
+//        distance() is a trilinear sample of the grid, so it's O(1) no matter
+//        how many rooms there are. clearance() is the same thing for the
+//        player's capsule, and move() does a swept move-and-slide of that
+//        capsule, sphere tracing along the move and sliding along the wall on
+//        contact.
+//******************************************************************************
+
+
+typedef struct collision_volume_t
+{
+  int floor;                //1, 2 or 3, as in JonDefault::state
+  glm::vec3 bmin, bmax;
+  bool rounded_roof;        //half-elliptical roof spanning the full width, like the floor 1 rooms
+} collision_volume;
+
+
+class collision_world
+{
+public:
+
+  void build(const std::vector<collision_volume>& volumes, float voxel_size = 0.004f);
+
+  float distance(glm::vec3 p, int floor) const;   //distance to the nearest wall, negative inside walls
+  glm::vec3 gradient(glm::vec3 p, int floor) const;
+
+  float clearance(glm::vec3 feet, int floor) const; //same, for the player's capsule standing at feet
+  bool is_free(glm::vec3 feet, int floor) const   {return clearance(feet, floor) >= 0.0f;}
+
+  //move the capsule standing at feet by delta, sliding along anything it hits - returns the new feet position
+  glm::vec3 move(glm::vec3 feet, glm::vec3 delta, int floor) const;
+
+  //the player's capsule
+  float player_radius = 0.012f;
+  float player_height = 0.05f;
+  float player_step   = 0.004f;   //capsule bottom sits this far above the feet, so the floor doesn't register as a wall
+
+private:
+
+  typedef struct grid_t
+  {
+    glm::vec3 origin;     //position of voxel (0,0,0)
+    glm::ivec3 dim;
+    std::vector<float> data;  //x fastest, then y, then z
+  } grid;
+
+  grid grids[3];          //one per floor
+  float voxel;
+
+  float volume_sdf(const collision_volume& v, glm::vec3 p) const;
+  const grid* get_grid(int floor) const {return (floor >= 1 && floor <= 3 && !grids[floor-1].data.empty()) ? &grids[floor-1] : NULL;}
+
+  int capsule_samples(glm::vec3 feet, glm::vec3* out) const;
+
+  void distance_transform(grid& g);
+  void distance_transform_1d(float* data, int n, size_t stride, std::vector<float>& f, std::vector<int>& v, std::vector<double>& z);
+};
+
+
+// //******************************************************************************
+
+float collision_world::volume_sdf(const collision_volume& v, glm::vec3 p) const
+{
+  //box
+  glm::vec3 center = (v.bmin + v.bmax) * 0.5f;
+  glm::vec3 half = (v.bmax - v.bmin) * 0.5f;
+  glm::vec3 q = glm::abs(p - center) - half;
+  float d = glm::length(glm::max(q, glm::vec3(0.0f))) + std::min(std::max(q.x, std::max(q.y, q.z)), 0.0f);
+
+  if(v.rounded_roof)
+  {//squash y so the elliptical roof becomes a circle, then it's a capsule running the length of the room
+    float width = half.x;
+    float height = v.bmax.y - v.bmin.y;
+    float s = width / height;
+
+    glm::vec3 ps = glm::vec3(p.x, v.bmin.y + (p.y - v.bmin.y) * s, p.z);
+    glm::vec3 a = glm::vec3(center.x, v.bmin.y, v.bmin.z - width);
+    glm::vec3 b = glm::vec3(center.x, v.bmin.y, v.bmax.z + width);
+
+    //dividing by the stretch keeps this a lower bound on the true distance
+    d = std::max(d, capsdf(ps, a, b, width) / std::max(1.0f, s));
+  }
+
+  return d;
+}
+
+// //******************************************************************************
+
+void collision_world::build(const std::vector<collision_volume>& volumes, float voxel_size)
+{
+  PROFILE_ZONE("collision_world::build");
+  voxel = voxel_size;
+
+  for(int f = 1; f <= 3; f++)
+  {
+    grid& g = grids[f-1];
+
+    std::vector<collision_volume> floor_volumes;
+    glm::vec3 bmin(1e30f), bmax(-1e30f);
+
+    for(auto& v : volumes)
+      if(v.floor == f)
+      {
+        floor_volumes.push_back(v);
+        bmin = glm::min(bmin, v.bmin);
+        bmax = glm::max(bmax, v.bmax);
+      }
+
+    g.data.clear();
+    if(floor_volumes.empty())
+      continue;
+
+    //a few voxels of wall around everything, so samples at the edge still interpolate properly
+    glm::vec3 margin = glm::vec3(4.0f * voxel);
+    g.origin = bmin - margin;
+    g.dim = glm::ivec3(glm::ceil((bmax + margin - g.origin) / voxel)) + 1;
+    g.data.resize((size_t)g.dim.x * g.dim.y * g.dim.z);
+
+    int num_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+
+    for(int w = 0; w < num_threads; w++)
+    {
+      workers.push_back(std::thread([&, w]()
+      {
+        for(int z = w; z < g.dim.z; z += num_threads)
+          for(int y = 0; y < g.dim.y; y++)
+            for(int x = 0; x < g.dim.x; x++)
+            {
+              glm::vec3 p = g.origin + voxel * glm::vec3(x, y, z);
+
+              //union of the volumes - the free space is inside any one of them
+              float d = 1e30f;
+              for(auto& v : floor_volumes)
+                d = std::min(d, volume_sdf(v, p));
+
+              g.data[((size_t)z * g.dim.y + y) * g.dim.x + x] = -d;
+            }
+      }));
+    }
+
+    for(auto& w : workers)
+      w.join();
+
+    distance_transform(g);
+
+    cout << "collision grid for floor " << f << " is " << g.dim.x << "x" << g.dim.y << "x" << g.dim.z << endl;
+  }
+}
+
+// //******************************************************************************
+
+void collision_world::distance_transform(grid& g)
+{
+  //squared distance in voxels to the nearest voxel in the walls - zero for the walls themselves
+  std::vector<float> edt(g.data.size());
+  for(size_t i = 0; i < g.data.size(); i++)
+    edt[i] = g.data[i] > 0.0f ? 1e20f : 0.0f;
+
+  size_t sy = g.dim.x, sz = (size_t)g.dim.x * g.dim.y;
+  int num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  //separable, one pass along each axis, lines split across threads
+  for(int axis = 0; axis < 3; axis++)
+  {
+    std::vector<std::thread> workers;
+
+    for(int w = 0; w < num_threads; w++)
+    {
+      workers.push_back(std::thread([&, w, axis]()
+      {
+        int n = g.dim[axis];
+        std::vector<float> f(n);
+        std::vector<int> v(n);
+        std::vector<double> z(n + 1);
+
+        int a = (axis + 1) % 3, b = (axis + 2) % 3;
+        size_t stride[3] = {1, sy, sz};
+
+        for(int j = w; j < g.dim[b]; j += num_threads)
+          for(int i = 0; i < g.dim[a]; i++)
+            distance_transform_1d(&edt[i * stride[a] + j * stride[b]], n, stride[axis], f, v, z);
+      }));
+    }
+
+    for(auto& w : workers)
+      w.join();
+  }
+
+  //the nearest wall voxel is past the actual wall, so back off by half a voxel - the
+  //analytic value is a lower bound in here, so take whichever is larger
+  for(size_t i = 0; i < g.data.size(); i++)
+    if(g.data[i] > 0.0f)
+      g.data[i] = std::max(g.data[i], (std::sqrt(edt[i]) - 0.5f) * voxel);
+}
+
+// //******************************************************************************
+
+void collision_world::distance_transform_1d(float* data, int n, size_t stride, std::vector<float>& f, std::vector<int>& v, std::vector<double>& z)
+{
+  //lower envelope of parabolas, after Felzenszwalb and Huttenlocher
+  for(int q = 0; q < n; q++)
+    f[q] = data[q * stride];
+
+  int k = 0;
+  v[0] = 0;
+  z[0] = -1e30;
+  z[1] = 1e30;
+
+  for(int q = 1; q < n; q++)
+  {
+    double s;
+    while(true)
+    {
+      int r = v[k];
+      s = ((f[q] + (double)q*q) - (f[r] + (double)r*r)) / (2.0 * (q - r));
+      if(s > z[k] || k == 0)
+        break;
+      k--;
+    }
+
+    if(s <= z[k])
+    {//only possible with k == 0 - the new parabola is lower everywhere
+      v[0] = q;
+      z[1] = 1e30;
+      continue;
+    }
+
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k+1] = 1e30;
+  }
+
+  k = 0;
+  for(int q = 0; q < n; q++)
+  {
+    while(z[k+1] < q)
+      k++;
+    float d = q - v[k];
+    data[q * stride] = d * d + f[v[k]];
+  }
+}
+
+// //******************************************************************************
+
+float collision_world::distance(glm::vec3 p, int floor) const
+{
+  const grid* g = get_grid(floor);
+  if(!g)
+    return -1.0f;
+
+  glm::vec3 f = (p - g->origin) / voxel;
+  glm::ivec3 i = glm::ivec3(glm::floor(f));
+
+  //everything outside the grid is wall
+  if(i.x < 0 || i.y < 0 || i.z < 0 || i.x >= g->dim.x - 1 || i.y >= g->dim.y - 1 || i.z >= g->dim.z - 1)
+    return -voxel;
+
+  glm::vec3 t = f - glm::vec3(i);
+
+  size_t sx = 1, sy = g->dim.x, sz = (size_t)g->dim.x * g->dim.y;
+  const float* c = &g->data[i.z * sz + i.y * sy + i.x];
+
+  float c00 = glm::mix(c[0],       c[sx],           t.x);
+  float c10 = glm::mix(c[sy],      c[sy + sx],      t.x);
+  float c01 = glm::mix(c[sz],      c[sz + sx],      t.x);
+  float c11 = glm::mix(c[sz + sy], c[sz + sy + sx], t.x);
+
+  return glm::mix(glm::mix(c00, c10, t.y), glm::mix(c01, c11, t.y), t.z);
+}
+
+// //******************************************************************************
+
+glm::vec3 collision_world::gradient(glm::vec3 p, int floor) const
+{
+  float e = 0.5f * voxel;
+  glm::vec3 g = glm::vec3(
+    distance(p + glm::vec3(e,0,0), floor) - distance(p - glm::vec3(e,0,0), floor),
+    distance(p + glm::vec3(0,e,0), floor) - distance(p - glm::vec3(0,e,0), floor),
+    distance(p + glm::vec3(0,0,e), floor) - distance(p - glm::vec3(0,0,e), floor));
+
+  float l = glm::length(g);
+  return l > 0.0f ? g / l : glm::vec3(0.0f);
+}
+
+// //******************************************************************************
+
+int collision_world::capsule_samples(glm::vec3 feet, glm::vec3* out) const
+{
+  //points along the capsule's segment, spaced closely enough that the spheres cover it
+  glm::vec3 a = feet + glm::vec3(0, player_step + player_radius, 0);
+  glm::vec3 b = feet + glm::vec3(0, player_height - player_radius, 0);
+
+  int n = std::max(2, (int)std::ceil(glm::length(b - a) / player_radius) + 1);
+  n = std::min(n, 16);
+
+  for(int i = 0; i < n; i++)
+    out[i] = glm::mix(a, b, i / float(n - 1));
+
+  return n;
+}
+
+float collision_world::clearance(glm::vec3 feet, int floor) const
+{
+  glm::vec3 samples[16];
+  int n = capsule_samples(feet, samples);
+
+  float d = 1e30f;
+  for(int i = 0; i < n; i++)
+    d = std::min(d, distance(samples[i], floor));
+
+  return d - player_radius;
+}
+
+// //******************************************************************************
+
+glm::vec3 collision_world::move(glm::vec3 feet, glm::vec3 delta, int floor) const
+{
+  const float skin = 0.0005f;
+
+  if(!get_grid(floor))
+    return feet;
+
+  //walking on a floor shouldn't get you pushed up off of it
+  bool planar = delta.y == 0.0f;
+
+  for(int iteration = 0; iteration < 4; iteration++)
+  {
+    float len = glm::length(delta);
+    if(len < 1e-7f)
+      break;
+
+    glm::vec3 dir = delta / len;
+
+    //sphere trace the capsule along the move - the clearance is how far it can safely go
+    float travelled = 0.0f;
+    bool blocked = false;
+    for(int step = 0; step < 64 && travelled < len; step++)
+    {
+      float c = clearance(feet + dir * travelled, floor);
+      if(c <= skin)
+      {
+        blocked = true;
+        break;
+      }
+      travelled = std::min(len, travelled + c);
+    }
+
+    feet += dir * travelled;
+    if(!blocked)
+      break;
+
+    //slide - drop the part of what's left of the move that goes into the wall
+    glm::vec3 samples[16];
+    int n = capsule_samples(feet, samples);
+    int closest = 0;
+    for(int i = 1; i < n; i++)
+      if(distance(samples[i], floor) < distance(samples[closest], floor))
+        closest = i;
+
+    glm::vec3 normal = gradient(samples[closest], floor);
+    if(planar)
+    {
+      normal.y = 0.0f;
+      if(glm::length(normal) > 0.0f)
+        normal = glm::normalize(normal);
+    }
+
+    //push back out past the skin, so the slide starts out unblocked
+    float c = clearance(feet, floor);
+    if(c < 2.0f * skin)
+      feet += normal * (2.0f * skin - c);
+
+    glm::vec3 remaining = delta - dir * travelled;
+    delta = remaining - normal * std::min(0.0f, glm::dot(remaining, normal));
+  }
+
+  return feet;
+}
+
+#endif
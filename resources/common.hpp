@@ -18,10 +18,17 @@ using std::endl;
 
 #define POINT_SPRITE_PATH "resources/textures/height/sphere_small.png"
 
+#define ROOM_LAYOUT_PATH "resources/rooms.layout"
+
 #define WATER_HEIGHT_TEXTURE "resources/textures/height/water_height.png"
 #define WATER_NORMAL_TEXTURE "resources/textures/normal/water_normal.png"
 #define WATER_COLOR_TEXTURE "resources/textures/water_color.png"
 
+#define TERRAIN_PUGET_SOUND "resources/textures/height/pugetSound.png"
+#define TERRAIN_UNITED_KINGDOM "resources/textures/height/united-kingdom-2048.png"
+#define TERRAIN_POLAND "resources/textures/height/hmpoland2048.png"
+#define TERRAIN_RIVER_VALLEY "resources/textures/height/Grts_RiverValley.png"
+
 //************************************************
 
 // GLEW
@@ -189,4 +196,23 @@ float capsdf(glm::vec3 p, glm::vec3 a, glm::vec3 b, float r)
 }
 
 
+//function: capsule sdf gradient - unit length everywhere except on the segment itself,
+//where there is no single direction (zero vector is returned there)
+glm::vec3 capsdf_gradient(glm::vec3 p, glm::vec3 a, glm::vec3 b)
+{
+  glm::vec3 ab = b-a;
+  glm::vec3 ap = p-a;
+
+  float t = glm::dot(ab,ap)/glm::dot(ab,ab);
+
+  t = glm::clamp(t, 0.0f, 1.0f);
+
+  glm::vec3 c = a + (t * ab);
+
+  float l = glm::length(p-c);
+
+  return (l > 0.0f) ? (p-c)/l : glm::vec3(0.0f);
+}
+
+
 #endif
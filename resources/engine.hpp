@@ -1,4 +1,12 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
 #include "common.hpp"
+#include "profiler.hpp"
+#include "render_queue.hpp"
+#include "kinematics.hpp"
+#include "particles.hpp"
+#include "primitives.hpp"
 //this is based on the project from this summer - here implemented with polygons, and rendered using perspective projection
 // - from what I can gather, we're going to be wildly more efficient with polygons than with the voxel scheme
 
@@ -19,6 +27,13 @@
 float twopi = JonDefault::twopi;
 
 
+//one draw of one of the engine parts - all of them only ever rotate about z
+typedef struct engine_instance_t
+{
+  int start, num;     //arguments to glDrawArrays
+  float angle;        //becomes rot8
+  glm::vec3 offset;   //becomes transl8
+} engine_instance;
 
 
 class engine
@@ -44,12 +59,21 @@ public:
   void init(std::vector<glm::vec3>& points, std::vector<glm::vec3>& normals, std::vector<glm::vec4>& colors);
 
 
-  //calls glDrawArrays(GL_TRIANGLES, ____start, num_pts_____); for each of the things, for each cylinder
-    //so there's a fair few, num_cylinders many for pistons, con rods, and the sets of valves, then one crank, and 4 cams
-  void draw();
+  //works out where every part is for crankshaft angle theta - one instance per draw
+  void update(float theta, std::vector<engine_instance>& out);
+
+  //one packet per instance, so there's a fair few - num_cylinders many for pistons, con rods, and the sets of
+    //valves, then one crank, and 4 cams. base has the program and vao filled in, eye is in model space
+  void submit(render_queue& queue, const std::vector<engine_instance>& instances, draw_packet base, glm::vec3 eye);
 
+  //one step's worth of gas, out of every cylinder that's on its intake or exhaust stroke at crank angle
+    //theta - rate is exhaust particles per cylinder per step, on average. Only reads what add_cylinders()
+    //set up, so it's safe to call while update() is running on the simulation thread
+  void emit_gas(float theta, int rate, gas_particles& gas) const;
 
-  void set_theta(float in) {theta = in;}
+  //middle of the disk the propeller blades sweep, and its radius - see add_propeller
+  glm::vec3 propeller_hub() const   {return throw_center[num_throws-1] - glm::vec3(0.0f, 0.0f, 0.05f + 0.315f);}
+  float propeller_radius() const    {return 0.1f;}
 
 private:
   int crank_start, num_pts_crank;
@@ -62,12 +86,29 @@ private:
   // int exhaust_start, num_pts_exhaust;
 
 
-  float theta;
   glm::vec3 bank1vec = glm::vec3(-1,1,0);
   glm::vec3 bank2vec = glm::vec3(1,1,0);
 
   //translation vectors & rotation amounts are held here, vec3s and floats
 
+  static const int num_throws = 4;
+  glm::vec3 throw_center[num_throws];   //where each section of the crank sits
+  float throw_phase[num_throws];        //and how far it's turned past theta
+
+  float crank_throw = 0.02f;            //crankpin radius, same as in add_crank
+  float rod_length = 0.045f;            //crankpin to piston pin
+  float piston_crown = 0.008f;          //piston pin to the top of the piston
+
+  slider_crank cylinders = slider_crank(crank_throw, rod_length);   //two per throw, one in each bank
+
+  //four strokes take two turns of the crank - cylinders that share a top dead center
+    //get a turn between them, so the firing is even
+  float cycle_offset[2 * num_throws];
+
+  //where cylinder i is in its cycle, 0 to 2 twopi - 0 is top dead center, at the start of intake
+  float cycle_angle(int i, float theta) const;
+
+  void add_cylinders();
 
 
 
@@ -91,10 +132,11 @@ private:
 
 void engine::init(std::vector<glm::vec3>& points, std::vector<glm::vec3>& normals, std::vector<glm::vec4>& colors)
 {
-  theta = 0.0f;
-
+  PROFILE_ZONE("engine::init");
   int temp = points.size();
 
+  add_cylinders();
+
   add_crank(points, normals, colors);
   add_conrod(points, normals, colors);
   add_piston(points, normals, colors);
@@ -110,195 +152,118 @@ void engine::init(std::vector<glm::vec3>& points, std::vector<glm::vec3>& normal
 
 
 
-void engine::draw()
+void engine::add_cylinders()
 {
+  float basex = -0.4f;
+  float basey = -0.1f;
 
-  GLint id;
-  glGetIntegerv(GL_CURRENT_PROGRAM,&id);
-
-  glUniform1i(glGetUniformLocation(id, "type"), 2); //"engine mode", if you will
-  //just kind of in a hurry
-
-  // glm::mat4 r = glm::rotate((float)theta,glm::vec3(0.0f,0.0f,1.0f));
-  // glm::mat4 t = glm::translate(glm::vec3(0.0f,0.2f*(float)sin(theta),0.0f));
-
-
-float basex = -0.4f;
-float basey = -0.1f;
-
-  glm::mat4 r = glm::rotate(theta,glm::vec3(0.0f,0.0f,1.0f));
-  glm::mat4 t = glm::translate(glm::vec3(0.0f,basey+0.0f,basex-1.0*0.0f));
-
-  float twopi = JonDefault::twopi;
-
-  glUniformMatrix4fv(glGetUniformLocation(id, "rot8"), 1, GL_FALSE, glm::value_ptr(r));
-  glUniformMatrix4fv(glGetUniformLocation(id, "transl8"), 1, GL_FALSE, glm::value_ptr(t));
-
-  glDrawArrays(GL_TRIANGLES, crank_start, num_pts_crank);
-
-
-  r = glm::rotate(twopi/8.0f,glm::vec3(0.0f,0.0f,1.0f));
-  t = glm::translate(glm::vec3(0.0f,basey+0.0f,basex-1.0*0.0f)+(((float)cos(theta+1.309-twopi/4.0)*0.01f+0.025f)*bank1vec));
-
-  glUniformMatrix4fv(glGetUniformLocation(id, "rot8"), 1, GL_FALSE, glm::value_ptr(r));
-  glUniformMatrix4fv(glGetUniformLocation(id, "transl8"), 1, GL_FALSE, glm::value_ptr(t));
-
-
-  glDrawArrays(GL_TRIANGLES, piston_start, num_pts_piston);
-
-
-
-
-
-  r = glm::rotate(-twopi/8.0f,glm::vec3(0.0f,0.0f,1.0f));
-  t = glm::translate(glm::vec3(0.0f,basey+0.0f,basex-1.0*0.0f)+(((float)cos(theta+1.309)*0.01f+0.025f)*bank2vec));
-
-  glUniformMatrix4fv(glGetUniformLocation(id, "rot8"), 1, GL_FALSE, glm::value_ptr(r));
-  glUniformMatrix4fv(glGetUniformLocation(id, "transl8"), 1, GL_FALSE, glm::value_ptr(t));
-
-
-  glDrawArrays(GL_TRIANGLES, piston_start, num_pts_piston);
-
-
-
-
-
-
-
-
-
-    r = glm::rotate(theta-(twopi/4.0f),glm::vec3(0.0f,0.0f,1.0f));
-    t = glm::translate(glm::vec3(0.0f,basey+0.0f,basex-1.0*0.05f));
-
-    glUniformMatrix4fv(glGetUniformLocation(id, "rot8"), 1, GL_FALSE, glm::value_ptr(r));
-    glUniformMatrix4fv(glGetUniformLocation(id, "transl8"), 1, GL_FALSE, glm::value_ptr(t));
-
-    glDrawArrays(GL_TRIANGLES, crank_start, num_pts_crank);
-
-
-
-
-    r = glm::rotate(twopi/8.0f,glm::vec3(0.0f,0.0f,1.0f));
-    t = glm::translate(glm::vec3(0.0f,basey+0.0f,basex-1.0*0.05f)+(((float)cos(theta+0.261799-twopi/4.0f)*0.01f+0.025f)*bank1vec));
-
-    glUniformMatrix4fv(glGetUniformLocation(id, "rot8"), 1, GL_FALSE, glm::value_ptr(r));
-    glUniformMatrix4fv(glGetUniformLocation(id, "transl8"), 1, GL_FALSE, glm::value_ptr(t));
-
-
-    glDrawArrays(GL_TRIANGLES, piston_start, num_pts_piston);
-
-
-    r = glm::rotate(-twopi/8.0f,glm::vec3(0.0f,0.0f,1.0f));
-    t = glm::translate(glm::vec3(0.0f,basey+0.0f,basex-1.0*0.05f)+(((float)cos(theta+0.261799)*0.01f+0.025f)*bank2vec));
-
-    glUniformMatrix4fv(glGetUniformLocation(id, "rot8"), 1, GL_FALSE, glm::value_ptr(r));
-    glUniformMatrix4fv(glGetUniformLocation(id, "transl8"), 1, GL_FALSE, glm::value_ptr(t));
-
-
-    glDrawArrays(GL_TRIANGLES, piston_start, num_pts_piston);
-
-
-
-
-
-
-
-
-
-
-    r = glm::rotate(theta+(1.0f*(twopi/4.0f)),glm::vec3(0.0f,0.0f,1.0f));
-    t = glm::translate(glm::vec3(0.0f,basey+0.0f,basex-1.0*0.1f));
-
-    glUniformMatrix4fv(glGetUniformLocation(id, "rot8"), 1, GL_FALSE, glm::value_ptr(r));
-    glUniformMatrix4fv(glGetUniformLocation(id, "transl8"), 1, GL_FALSE, glm::value_ptr(t));
-
-    glDrawArrays(GL_TRIANGLES, crank_start, num_pts_crank);
-
-
-
-
-    r = glm::rotate(twopi/8.0f,glm::vec3(0.0f,0.0f,1.0f));
-    t = glm::translate(glm::vec3(0.0f,basey+0.0f,basex-1.0*0.1f)+(((float)cos(theta+0.261799-(3.0f*twopi)/4.0f - twopi/4.0f)*0.01f+0.025f)*bank1vec));
-
-    glUniformMatrix4fv(glGetUniformLocation(id, "rot8"), 1, GL_FALSE, glm::value_ptr(r));
-    glUniformMatrix4fv(glGetUniformLocation(id, "transl8"), 1, GL_FALSE, glm::value_ptr(t));
-
+  //a V8 - throws a quarter turn apart, 0, 90, 270, 180, with a bank on either
+    //side of vertical, 90 degrees apart
+  float phases[num_throws] = {0.0f, -twopi/4.0f, twopi/4.0f, twopi/2.0f};
 
-    glDrawArrays(GL_TRIANGLES, piston_start, num_pts_piston);
-
-    r = glm::rotate(-twopi/8.0f,glm::vec3(0.0f,0.0f,1.0f));
-    t = glm::translate(glm::vec3(0.0f,basey+0.0f,basex-1.0*0.1f)+(((float)cos(theta+0.261799-(3.0f*twopi)/4.0f+twopi/4.0f)*0.01f+0.025f)*bank2vec));
-
-    glUniformMatrix4fv(glGetUniformLocation(id, "rot8"), 1, GL_FALSE, glm::value_ptr(r));
-    glUniformMatrix4fv(glGetUniformLocation(id, "transl8"), 1, GL_FALSE, glm::value_ptr(t));
-
-
-    glDrawArrays(GL_TRIANGLES, piston_start, num_pts_piston);
-
-
-
-
-
-    r = glm::rotate(theta+(2.0f*(twopi/4.0f)),glm::vec3(0.0f,0.0f,1.0f));
-    t = glm::translate(glm::vec3(0.0f,basey+0.0f,basex-1.0*0.15f));
-
-    glUniformMatrix4fv(glGetUniformLocation(id, "rot8"), 1, GL_FALSE, glm::value_ptr(r));
-    glUniformMatrix4fv(glGetUniformLocation(id, "transl8"), 1, GL_FALSE, glm::value_ptr(t));
-
-    glDrawArrays(GL_TRIANGLES, crank_start, num_pts_crank);
-
-
-
-
-
-    r = glm::rotate(twopi/8.0f,glm::vec3(0.0f,0.0f,1.0f));
-    t = glm::translate(glm::vec3(0.0f,basey+0.0f,basex-1.0*0.15f)+(((float)cos(theta+0.261799-(5.0f*twopi)/4.0f - twopi/4.0f)*0.01f+0.025f)*bank1vec));
-
-    glUniformMatrix4fv(glGetUniformLocation(id, "rot8"), 1, GL_FALSE, glm::value_ptr(r));
-    glUniformMatrix4fv(glGetUniformLocation(id, "transl8"), 1, GL_FALSE, glm::value_ptr(t));
-
-
-    glDrawArrays(GL_TRIANGLES, piston_start, num_pts_piston);
-
-
-
-    r = glm::rotate(-twopi/8.0f,glm::vec3(0.0f,0.0f,1.0f));
-    t = glm::translate(glm::vec3(0.0f,basey+0.0f,basex-1.0*0.15f)+(((float)cos(theta+0.261799-(3.0f*twopi)/4.0f - 3.0f*twopi/4.0f)*0.01f+0.025f)*bank2vec));
-
-    glUniformMatrix4fv(glGetUniformLocation(id, "rot8"), 1, GL_FALSE, glm::value_ptr(r));
-    glUniformMatrix4fv(glGetUniformLocation(id, "transl8"), 1, GL_FALSE, glm::value_ptr(t));
-
-
-    glDrawArrays(GL_TRIANGLES, piston_start, num_pts_piston);
+  for(int i = 0; i < num_throws; i++)
+  {
+    throw_center[i] = glm::vec3(0.0f, basey, basex - 0.05f * i);
+    throw_phase[i] = phases[i];
 
+    //the crankpin runs from z of the center back 0.02 - the two rods sit side by side on it
+    cylinders.add(throw_center[i], phases[i],  twopi/8.0f, throw_center[i].z - 0.015f);
+    cylinders.add(throw_center[i], phases[i], -twopi/8.0f, throw_center[i].z - 0.005f);
+  }
 
+  //two cylinders at the same point in their cycles would fire together - the second one
+    //to come up gets pushed a whole turn back
+  for(int i = 0; i < cylinders.size(); i++)
+  {
+    cycle_offset[i] = 0.0f;
 
+    for(int j = 0; j < i; j++)
+      if(std::abs(std::remainder(cycle_angle(i, 0.0f) - cycle_angle(j, 0.0f), 2.0f * twopi)) < 0.01f)
+        cycle_offset[i] = twopi;
+  }
+}
 
+float engine::cycle_angle(int i, float theta) const
+{
+  float c = std::fmod(theta + throw_phase[i / 2] - cylinders.bore[i] + cycle_offset[i], 2.0f * twopi);
+  return c < 0.0f ? c + 2.0f * twopi : c;
+}
 
+void engine::emit_gas(float theta, int rate, gas_particles& gas) const
+{
+  PROFILE_ZONE("engine::emit_gas");
+  float stroke = twopi / 2.0f;
 
+  for(int i = 0; i < cylinders.size(); i++)
+  {
+    float c = cycle_angle(i, theta);
+    bool intake = c < stroke;
+    bool exhaust = c >= 3.0f * stroke;
+    if(!intake && !exhaust)
+      continue;
+
+    //the head, and outboard of it - each bank breathes out the outside of the V
+    glm::vec3 u = glm::vec3(cylinders.bore_x[i], cylinders.bore_y[i], 0.0f);
+    glm::vec3 out = (u.x < 0.0f) ? glm::vec3(-u.y, u.x, 0.0f) : glm::vec3(u.y, -u.x, 0.0f);
+    glm::vec3 head = glm::vec3(cylinders.center_x[i], cylinders.center_y[i], cylinders.center_z[i])
+                   + (crank_throw + rod_length + piston_crown) * u;
+
+    if(exhaust)
+    {//hardest as the valve opens, tapering off as the piston comes up
+      float through = (c - 3.0f * stroke) / stroke;
+      int n = int(2.0f * rate * (1.0f - through) + 0.5f);
+      gas.emit(head + 0.004f * u + 0.008f * out, 0.12f * out + 0.04f * u, 0.03f, 3.0f, 0.004f, gas_exhaust, n);
+    }
+    else
+    {//drawn in from the inside of the V, toward the head
+      glm::vec3 port = head + 0.01f * u - 0.03f * out;
+      gas.emit(port, 2.0f * (head - port), 0.01f, 0.6f, 0.003f, gas_intake, (rate + 3) / 4);
+    }
+  }
+}
 
+void engine::update(float theta, std::vector<engine_instance>& out)
+{
+  //no GL in here, so this can run on the simulation thread
+  out.clear();
 
-    r = glm::rotate(theta+(2.0f*(twopi/4.0f)),glm::vec3(0.0f,0.0f,1.0f));
-    t = glm::translate(glm::vec3(0.0f,basey+0.0f,basex-1.0*0.2f));
+  for(int i = 0; i < num_throws; i++)
+    out.push_back({crank_start, num_pts_crank, theta + throw_phase[i], throw_center[i]});
 
-    glUniformMatrix4fv(glGetUniformLocation(id, "rot8"), 1, GL_FALSE, glm::value_ptr(r));
-    glUniformMatrix4fv(glGetUniformLocation(id, "transl8"), 1, GL_FALSE, glm::value_ptr(t));
+  cylinders.solve(theta);
 
-    glDrawArrays(GL_TRIANGLES, propeller_start, num_pts_propeller);
+  for(int i = 0; i < cylinders.size(); i++)
+  {
+    out.push_back({piston_start, num_pts_piston, cylinders.bore[i], cylinders.piston_pin(i)});
+    out.push_back({conrod_start, num_pts_conrod, cylinders.rod_angle[i], cylinders.crankpin(i)});
+  }
 
+  out.push_back({propeller_start, num_pts_propeller, theta+(2.0f*(twopi/4.0f)), throw_center[num_throws-1] - glm::vec3(0.0f,0.0f,0.05f)});
 
+  // intake valves, exhaust valves and cams go here once they have geometry
+}
 
 
 
 
 
+void engine::submit(render_queue& queue, const std::vector<engine_instance>& instances, draw_packet base, glm::vec3 eye)
+{
+  base.type = 2;  //"engine mode", if you will
 
+  for(auto& x : instances)
+  {
+    glm::mat4* transforms = queue.allocator().alloc<glm::mat4>(2);
+    transforms[0] = glm::rotate(x.angle,glm::vec3(0.0f,0.0f,1.0f));
+    transforms[1] = glm::translate(x.offset);
 
-  // glDrawArrays(GL_TRIANGLES, conrod_start, num_pts_conrod);
-  // glDrawArrays(GL_TRIANGLES, intake_valves_start, num_pts_intake_valves);
-  // glDrawArrays(GL_TRIANGLES, exhaust_valves_start, num_pts_exhaust_valves);
-  // glDrawArrays(GL_TRIANGLES, cams_start, num_pts_cams);
+    draw_packet p = base;
+    p.first = x.start;
+    p.count = x.num;
+    p.transforms = transforms;
 
+    queue.submit(p, pass_opaque, glm::distance(eye, x.offset));
+  }
 }
 
 
@@ -313,90 +278,12 @@ void engine::add_crank(std::vector<glm::vec3>& points, std::vector<glm::vec3>& n
 {
   crank_start = points.size();
 
-  // glm::vec3 a,b,c;
-  //
-  // a = glm::vec3(1,0.3,1);
-  // b = glm::vec3(0,0.3,0);
-  // c = glm::vec3(0,0.3,1);
-  //
-  // glm::vec3 norm = glm::cross(b - a, b - c);
-  //
-  // points.push_back(a);
-  // points.push_back(b);
-  // points.push_back(c);
-  //
-  // normals.push_back(norm);
-  // normals.push_back(norm);
-  // normals.push_back(norm);
-  //
-  // colors.push_back(glm::vec4(0,0,0,1));
-  // colors.push_back(glm::vec4(0,1,0,1));
-  // colors.push_back(glm::vec4(0,1,1,1));
-
-
-  for(float i = 0.0; i <= JonDefault::twopi+0.1f; i+=0.01) {
-    points.push_back(glm::vec3(0.003*cos(i),0.003*sin(i)+0.02,0.0));
-    points.push_back(glm::vec3(0.003*cos(i),0.003*sin(i)+0.02,-0.02));
-    points.push_back(glm::vec3(0.003*cos(i+0.01),0.003*sin(i+0.01)+0.02,0.0f));
-
-    points.push_back(glm::vec3(0.003*cos(i),0.003*sin(i)+0.02,-0.02));
-    points.push_back(glm::vec3(0.003*cos(i+0.01),0.003*sin(i+0.01)+0.02,0.0f));
-    points.push_back(glm::vec3(0.003*cos(i+0.01),0.003*sin(i+0.01)+0.02,-0.02));
-
-
-
-    points.push_back(glm::vec3(0.005*cos(i),0.005*sin(i),0.0-0.02));
-    points.push_back(glm::vec3(0.005*cos(i),0.005*sin(i),-0.01-0.02));
-    points.push_back(glm::vec3(0.005*cos(i+0.01),0.005*sin(i+0.01),0.0f-0.02));
-
-    points.push_back(glm::vec3(0.005*cos(i),0.005*sin(i),-0.01-0.02));
-    points.push_back(glm::vec3(0.005*cos(i+0.01),0.005*sin(i+0.01),0.0f-0.02));
-    points.push_back(glm::vec3(0.005*cos(i+0.01),0.005*sin(i+0.01),-0.01-0.02));
-
-
-
-    points.push_back(glm::vec3(0.005*cos(i),0.005*sin(i),0.0+0.02));
-    points.push_back(glm::vec3(0.005*cos(i),0.005*sin(i),-0.01+0.02));
-    points.push_back(glm::vec3(0.005*cos(i+0.01),0.005*sin(i+0.01),0.0f+0.02));
-
-    points.push_back(glm::vec3(0.005*cos(i),0.005*sin(i),-0.01+0.02));
-    points.push_back(glm::vec3(0.005*cos(i+0.01),0.005*sin(i+0.01),0.0f+0.02));
-    points.push_back(glm::vec3(0.005*cos(i+0.01),0.005*sin(i+0.01),-0.01+0.02));
-
-
-
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-  }
-
-
-
-  // glm::vec3
-  //
-  //
-  //
-  // points.push
-
-
-  // points.push_back()
+  //the pin the conrods ride on, out at the throw, and a main journal either side
+  primitive_mesh m;
+  add_cylinder(m, glm::vec2(0.0f, crank_throw), 0.003f, 0.0f, -0.02f, 32);
+  add_cylinder(m, glm::vec2(0.0f), 0.005f, -0.02f, -0.03f, 32);
+  add_cylinder(m, glm::vec2(0.0f), 0.005f, 0.02f, 0.01f, 32);
+  append_triangles(m, points, normals);
 
   num_pts_crank = points.size() - crank_start;
 }
@@ -405,6 +292,30 @@ void engine::add_conrod(std::vector<glm::vec3>& points, std::vector<glm::vec3>&
 {
   conrod_start = points.size();
 
+  //a tapered bar, big end at the origin on the crankpin, small end up +y on the
+    //piston pin - rod_angle from the kinematics keeps it pointing between the two
+  float big = 0.0035f, small = 0.0022f, half_thick = 0.002f;
+
+  glm::vec3 c[8] = {
+    glm::vec3(-big, 0.0f, -half_thick),        glm::vec3(big, 0.0f, -half_thick),
+    glm::vec3(small, rod_length, -half_thick), glm::vec3(-small, rod_length, -half_thick),
+    glm::vec3(-big, 0.0f, half_thick),         glm::vec3(big, 0.0f, half_thick),
+    glm::vec3(small, rod_length, half_thick),  glm::vec3(-small, rod_length, half_thick)};
+
+  int faces[6][4] = {{4,5,6,7}, {1,0,3,2}, {5,1,2,6}, {0,4,7,3}, {7,6,2,3}, {0,1,5,4}};  //counterclockwise from outside
+
+  for(auto& f : faces)
+  {
+    glm::vec3 norm = glm::normalize(glm::cross(c[f[1]] - c[f[0]], c[f[2]] - c[f[0]]));
+
+    int order[6] = {0, 1, 2, 0, 2, 3};
+    for(int k : order)
+    {
+      points.push_back(c[f[k]]);
+      normals.push_back(norm);
+    }
+  }
+
   num_pts_conrod = points.size() - conrod_start;
 }
 
@@ -412,18 +323,14 @@ void engine::add_piston(std::vector<glm::vec3>& points, std::vector<glm::vec3>&
 {
   piston_start = points.size();
 
+  //the origin is the piston pin, where the conrod's small end goes - crown above it, skirt down past it
+    //repeated points are the hard edges around the crown and the bottom of the skirt
+  float radius = 0.01f, crown = piston_crown, skirt = -0.004f;
+  std::vector<glm::vec2> profile = {{0.0f, crown}, {radius, crown}, {radius, crown}, {radius, skirt}, {radius, skirt}, {0.0f, skirt}};
 
-  for(float i = 0.0; i <= twopi; i+=0.1)
-  {
-    points.push_back(glm::vec3(0,0,0));
-    points.push_back(glm::vec3(0.01*sin(i),0,0.01*cos(i)));
-    points.push_back(glm::vec3(0.01*sin(i+0.1),0,0.01*cos(i+0.1)));
-
-    normals.push_back(glm::vec3(0,1,0));
-    normals.push_back(glm::vec3(0,1,0));
-    normals.push_back(glm::vec3(0,1,0));
-  }
-
+  primitive_mesh m;
+  add_lathe(m, profile, 32);
+  append_triangles(m, points, normals);
 
   num_pts_piston = points.size() - piston_start;
 }
@@ -452,40 +359,17 @@ void engine::add_propeller(std::vector<glm::vec3>& points, std::vector<glm::vec3
 {
   propeller_start = points.size();
 
-  for(float i = 0.0f; i <= twopi + 0.1f; i += 0.03f)
-  {
-    points.push_back(glm::vec3(0.003*cos(i),0.003*sin(i),0.0));
-    points.push_back(glm::vec3(0.003*cos(i),0.003*sin(i),-0.3));
-    points.push_back(glm::vec3(0.003*cos(i+0.03),0.003*sin(i+0.03),0.0f));
-
-    points.push_back(glm::vec3(0.003*cos(i),0.003*sin(i),-0.3));
-    points.push_back(glm::vec3(0.003*cos(i+0.03),0.003*sin(i+0.03),0.0f));
-    points.push_back(glm::vec3(0.003*cos(i+0.03),0.003*sin(i+0.03),-0.3));
-
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-    normals.push_back(glm::normalize(glm::vec3(cos(i), sin(i), 0)));
-
-  }
-
-
-  for(float i = 0.0f; i <= twopi + 0.1f; i += twopi/6.0f)
-  {
-    points.push_back(glm::vec3(0.1*cos(i),0.1*sin(i),-0.33));
-    points.push_back(glm::vec3(0.1*cos(i-0.01),0.1*sin(i-0.01),-0.3));
-    points.push_back(glm::vec3(0.008*cos(i+0.01),0.008*sin(i+0.01),-0.3));
-
-    glm::vec3 norm = glm::normalize(glm::cross(glm::vec3(0.05*cos(i),0.05*sin(i),-0.31)-glm::vec3(0.05*cos(i-0.01),0.05*sin(i-0.01),-0.3), glm::vec3(0.05*cos(i),0.05*sin(i),-0.31)-glm::vec3(0.008*cos(i+0.01),0.008*sin(i+0.01),-0.3)));
-
-    normals.push_back(norm);
-    normals.push_back(norm);
-    normals.push_back(norm);
-  }
-
+  //shaft out the back, then six blades around the end of it, twisted flatter toward the tips
+  const int num_blades = 6;
 
+  primitive_mesh m;
+  add_cylinder(m, glm::vec2(0.0f), 0.003f, 0.0f, -0.3f, 16);
+  add_cylinder(m, glm::vec2(0.0f), 0.008f, -0.3f, -0.33f, 16);   //hub
+  for(int i = 0; i < num_blades; i++)
+    add_blade(m, i * twopi / num_blades, 0.006f, propeller_radius(), 0.03f, 0.015f, 0.8f, 0.45f, 0.002f, -0.315f);
+  append_triangles(m, points, normals);
 
   num_pts_propeller = points.size() - propeller_start;
 }
+
+#endif
@@ -0,0 +1,216 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <GL/glew.h>
+
+#include <iostream>
+#include <map>
+#include <utility>
+
+
+//******************************************************************************
+//  Class: gl_state
+//
+//  Purpose:  Remembers what was last bound/set through it, and skips the GL
+//        call when asked for the same thing again. Counts what it issued and
+//        what it skipped, so redundant state changes show up.
+//
+//        Everything starts out unknown, so the first call of each kind always
+//        goes through. Anything that changes state behind its back - a direct
+//        glBindVertexArray, glUseProgram, etc - needs an invalidate()
+//        afterwards, or the cache will skip a call it shouldn't.
+//
+//        bind_texture() only promises what's bound to that unit - when it's
+//        a cache hit, it doesn't touch glActiveTexture, and some other unit
+//        can still be active. glTex*Image, glTexSubImage* and glTexParameter
+//        all go to the active unit's binding, so anything about to call them
+//        binds with bind_texture_for_upload() instead, which always leaves
+//        the unit it was given active.
+//
+//        Textures get deleted through delete_texture(), so a name the driver
+//        hands out again isn't mistaken for one that's still bound.
+//
+//        There's one of these, glstate, since there's one context.
+//******************************************************************************
+
+class gl_state
+{
+public:
+  gl_state()    {invalidate(); reset_counts();}
+
+  void use_program(GLuint p)
+  {
+    if(filter(program_known && p == program, programs))
+      return;
+    glUseProgram(p);
+    program = p;
+    program_known = true;
+  }
+
+  void bind_vertex_array(GLuint v)
+  {
+    if(filter(vao_known && v == vao, vertex_arrays))
+      return;
+    glBindVertexArray(v);
+    vao = v;
+    vao_known = true;
+
+    //the element array binding is part of the vao
+    buffer_bindings.erase(GL_ELEMENT_ARRAY_BUFFER);
+  }
+
+  void bind_buffer(GLenum target, GLuint b)
+  {
+    std::map<GLenum, GLuint>::iterator it = buffer_bindings.find(target);
+    if(filter(it != buffer_bindings.end() && it->second == b, buffers))
+      return;
+    glBindBuffer(target, b);
+    buffer_bindings[target] = b;
+  }
+
+  void bind_texture(GLuint unit, GLenum target, GLuint t)
+  {
+    std::pair<GLuint, GLenum> key(unit, target);
+    std::map<std::pair<GLuint, GLenum>, GLuint>::iterator it = texture_bindings.find(key);
+    if(filter(it != texture_bindings.end() && it->second == t, textures))
+      return;
+
+    select_unit(unit);
+    glBindTexture(target, t);
+    texture_bindings[key] = t;
+  }
+
+  //same, and unit is the active one afterwards, so glTex* calls land on t
+  void bind_texture_for_upload(GLuint unit, GLenum target, GLuint t)
+  {
+    select_unit(unit);
+    bind_texture(unit, target, t);
+  }
+
+  //deleting reverts wherever it was bound to 0 - forget those, rather than skip the next bind of a reused name
+  void delete_texture(GLuint& t)
+  {
+    if(!t)
+      return;
+    glDeleteTextures(1, &t);
+
+    for(std::map<std::pair<GLuint, GLenum>, GLuint>::iterator it = texture_bindings.begin(); it != texture_bindings.end();)
+      if(it->second == t)
+        it = texture_bindings.erase(it);
+      else
+        ++it;
+    t = 0;
+  }
+
+  //glEnable/glDisable
+  void set_capability(GLenum cap, bool on)
+  {
+    std::map<GLenum, bool>::iterator it = capabilities.find(cap);
+    if(filter(it != capabilities.end() && it->second == on, switches))
+      return;
+    if(on)
+      glEnable(cap);
+    else
+      glDisable(cap);
+    capabilities[cap] = on;
+  }
+
+  void blend_func(GLenum src, GLenum dst)
+  {
+    if(filter(blend_known && src == blend_src && dst == blend_dst, functions))
+      return;
+    glBlendFunc(src, dst);
+    blend_src = src;
+    blend_dst = dst;
+    blend_known = true;
+  }
+
+  void depth_func(GLenum f)
+  {
+    if(filter(depth_known && f == depth, functions))
+      return;
+    glDepthFunc(f);
+    depth = f;
+    depth_known = true;
+  }
+
+  void cull_face(GLenum f)
+  {
+    if(filter(cull_known && f == cull, functions))
+      return;
+    glCullFace(f);
+    cull = f;
+    cull_known = true;
+  }
+
+  //what's current, without a glGet round trip - 0 if it isn't known
+  GLuint current_program() const   {return program_known ? program : 0;}
+
+  //forget everything, the next call of each kind goes through
+  void invalidate()
+  {
+    program_known = vao_known = active_unit_known = false;
+    blend_known = depth_known = cull_known = false;
+    buffer_bindings.clear();
+    texture_bindings.clear();
+    capabilities.clear();
+  }
+
+  void reset_counts()
+  {
+    programs = vertex_arrays = buffers = textures = switches = functions = counter();
+  }
+
+  void report() const
+  {
+    std::cout << "gl state calls, issued/skipped:" << std::endl;
+    std::cout << "  programs      " << programs.issued << "/" << programs.skipped << std::endl;
+    std::cout << "  vertex arrays " << vertex_arrays.issued << "/" << vertex_arrays.skipped << std::endl;
+    std::cout << "  buffers       " << buffers.issued << "/" << buffers.skipped << std::endl;
+    std::cout << "  textures      " << textures.issued << "/" << textures.skipped << std::endl;
+    std::cout << "  enable/disable " << switches.issued << "/" << switches.skipped << std::endl;
+    std::cout << "  blend/depth/cull functions " << functions.issued << "/" << functions.skipped << std::endl;
+  }
+
+private:
+  typedef struct counter_t
+  {
+    long issued = 0, skipped = 0;
+  } counter;
+
+  void select_unit(GLuint unit)
+  {
+    if(active_unit_known && active_unit == unit)
+      return;
+    glActiveTexture(GL_TEXTURE0 + unit);
+    active_unit = unit;
+    active_unit_known = true;
+  }
+
+  //true if the call can be skipped, and counts it either way
+  bool filter(bool redundant, counter& c)
+  {
+    if(redundant)
+      c.skipped++;
+    else
+      c.issued++;
+    return redundant;
+  }
+
+  GLuint program;             bool program_known;
+  GLuint vao;                 bool vao_known;
+  GLuint active_unit;         bool active_unit_known;
+  GLenum blend_src, blend_dst; bool blend_known;
+  GLenum depth;               bool depth_known;
+  GLenum cull;                bool cull_known;
+
+  std::map<GLenum, GLuint> buffer_bindings;
+  std::map<std::pair<GLuint, GLenum>, GLuint> texture_bindings;   //(unit, target) -> texture
+  std::map<GLenum, bool> capabilities;
+
+  counter programs, vertex_arrays, buffers, textures, switches, functions;
+};
+
+gl_state glstate;
+
+#endif
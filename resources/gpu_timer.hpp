@@ -0,0 +1,162 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include "common.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+
+//******************************************************************************
+//  Class: gpu_timer
+//
+//  Purpose:  Measures how long the GPU spends on each named pass of a frame,
+//        using GL_TIME_ELAPSED queries. Each pass has two queries, and they
+//        alternate frame to frame - a query is collected by new_frame() just
+//        before it's reused, two frames after it was issued, and only if the
+//        GPU says it's ready, so reading them back never stalls the pipeline.
+//        The samples are two frames behind the one being drawn, not one. A
+//        sample that isn't ready by then is dropped and counted.
+//
+//  Functions:
+//
+//    add_pass(name):
+//        Creates the queries for a pass, returns the id to give begin/end.
+//        Needs a current GL context.
+//
+//    new_frame():
+//        Call once at the top of each frame, before any begin().
+//
+//    begin(id), end(id):
+//        Bracket the GL calls for one pass. Time elapsed queries can't nest,
+//        so passes have to be one after another.
+//
+//    write_csv(filename):
+//        Rolling min/avg/p99 in milliseconds, over the last window_size
+//        samples of each pass, one row per pass.
+//******************************************************************************
+
+class gpu_timer
+{
+public:
+  gpu_timer() : current(0) {}
+
+  int add_pass(const std::string& name)
+  {
+    pass p;
+    p.name = name;
+    glGenQueries(2, p.queries);
+    p.issued[0] = p.issued[1] = false;
+    p.next = 0;
+    p.dropped = 0;
+    passes.push_back(p);
+    return passes.size() - 1;
+  }
+
+  void new_frame()
+  {
+    current = 1 - current;
+
+    //whatever was issued into this set two frames back gets collected before it's reused
+    for(auto& p : passes)
+    {
+      if(!p.issued[current])
+        continue;
+
+      GLint available = 0;
+      glGetQueryObjectiv(p.queries[current], GL_QUERY_RESULT_AVAILABLE, &available);
+
+      if(available)
+      {
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(p.queries[current], GL_QUERY_RESULT, &ns);
+        add_sample(p, ns / 1000000.0);
+      }
+      else
+      {
+        p.dropped++;
+      }
+
+      p.issued[current] = false;
+    }
+  }
+
+  void begin(int id)    {glBeginQuery(GL_TIME_ELAPSED, passes[id].queries[current]);}
+  void end(int id)      {glEndQuery(GL_TIME_ELAPSED); passes[id].issued[current] = true;}
+
+  //rolling statistics for one pass, in milliseconds - false if there are no samples yet
+  bool stats(int id, double& min, double& avg, double& p99) const
+  {
+    const std::vector<double>& s = passes[id].samples;
+    if(s.empty())
+      return false;
+
+    std::vector<double> sorted(s);
+    std::sort(sorted.begin(), sorted.end());
+
+    double sum = 0.0;
+    for(double x : sorted)
+      sum += x;
+
+    min = sorted.front();
+    avg = sum / sorted.size();
+    p99 = sorted[(size_t)(0.99 * (sorted.size() - 1))];
+    return true;
+  }
+
+  void write_csv(const std::string& filename) const
+  {
+    std::ofstream out(filename);
+    if(!out)
+    {
+      cout << "couldn't open " << filename << " for the gpu timings" << endl;
+      return;
+    }
+
+    out << "pass,samples,dropped,min_ms,avg_ms,p99_ms" << endl;
+    for(size_t i = 0; i < passes.size(); i++)
+    {
+      double min = 0.0, avg = 0.0, p99 = 0.0;
+      stats(i, min, avg, p99);
+
+      out << passes[i].name << "," << passes[i].samples.size() << "," << passes[i].dropped << ","
+          << min << "," << avg << "," << p99 << endl;
+
+      cout << "  " << passes[i].name << ": min " << min << " ms, avg " << avg << " ms, p99 " << p99 << " ms" << endl;
+    }
+
+    cout << "gpu timings written to " << filename << endl;
+  }
+
+private:
+  static const size_t window_size = 512;
+
+  typedef struct pass_t
+  {
+    std::string name;
+    GLuint queries[2];      //one per frame in flight
+    bool issued[2];         //has a result coming back in that slot
+    std::vector<double> samples;  //ring buffer once it fills up
+    size_t next;            //where the next sample goes, once it's full
+    int dropped;            //results that weren't ready when we came back for them
+  } pass;
+
+  void add_sample(pass& p, double ms)
+  {
+    if(p.samples.size() < window_size)
+    {
+      p.samples.push_back(ms);
+    }
+    else
+    {
+      p.samples[p.next] = ms;
+      p.next = (p.next + 1) % window_size;
+    }
+  }
+
+  std::vector<pass> passes;
+  int current;    //which of the two query sets this frame is using
+};
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef KINEMATICS_H
+#define KINEMATICS_H
+
+#include "common.hpp"
+#include "profiler.hpp"
+
+#include <cmath>
+
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+
+//******************************************************************************
+//  Class: slider_crank
+//
+//  Purpose:  Exact piston and connecting rod positions, for every cylinder at
+//        once. Everything happens in the plane of the crank (x, y), and angles
+//        are about z, with 0 pointing up +y, like the engine's rot8.
+//
+//        For a crank throw d at crank angle phi, and a bore pointing along u:
+//
+//          crankpin          p = r d
+//          piston pin        s = r (d.u) + sqrt(l^2 - (r (d x u))^2), along u
+//          rod angle         bore angle + asin(-r (d x u) / l)
+//
+//        Cylinders are kept as a struct of arrays, so solve() is one straight
+//        loop with nothing but multiplies, adds and a square root in it - 4
+//        cylinders at a time through SSE2, any left over by the same math in
+//        scalar code. The asin goes in a second, short loop of its own.
+//
+//  Functions:
+//    add(crank_center, crank_phase, bore_angle, rod_z):
+//        One more cylinder, driven by a throw at crank_phase past theta,
+//        returns its index.
+//
+//    solve(theta):
+//        Fills in the results below for crankshaft angle theta.
+//******************************************************************************
+
+class slider_crank
+{
+public:
+  slider_crank(float crank_radius, float rod_length) : r(crank_radius), l(rod_length) {}
+
+  int add(glm::vec3 crank_center, float crank_phase, float bore_angle, float rod_z)
+  {
+    center_x.push_back(crank_center.x);
+    center_y.push_back(crank_center.y);
+    center_z.push_back(rod_z);
+
+    sin_phase.push_back(sin(crank_phase));
+    cos_phase.push_back(cos(crank_phase));
+
+    bore.push_back(bore_angle);
+    bore_x.push_back(-sin(bore_angle));
+    bore_y.push_back(cos(bore_angle));
+
+    int n = size();
+    travel.resize(n);
+    pin_x.resize(n);
+    pin_y.resize(n);
+    sin_rod.resize(n);
+    rod_angle.resize(n);
+    return n - 1;
+  }
+
+  int size() const                {return center_x.size();}
+  float crank_radius() const      {return r;}
+  float rod_length() const        {return l;}
+
+  void solve(float theta)
+  {
+    PROFILE_ZONE("slider_crank::solve");
+    int n = size();
+    float st = sin(theta), ct = cos(theta);
+    float r = this->r, ll = l * l, inv_l = 1.0f / l;
+
+    const float* __restrict sp = sin_phase.data();
+    const float* __restrict cp = cos_phase.data();
+    const float* __restrict ux = bore_x.data();
+    const float* __restrict uy = bore_y.data();
+    float* __restrict s = travel.data();
+    float* __restrict px = pin_x.data();
+    float* __restrict py = pin_y.data();
+    float* __restrict sb = sin_rod.data();
+
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128 v_st = _mm_set1_ps(st), v_ct = _mm_set1_ps(ct), v_r = _mm_set1_ps(r);
+    const __m128 v_ll = _mm_set1_ps(ll), v_inv_l = _mm_set1_ps(-inv_l), zero = _mm_setzero_ps();
+
+    for(; i + 4 <= n; i += 4)
+    {
+      __m128 c = _mm_loadu_ps(cp + i), si = _mm_loadu_ps(sp + i);
+      __m128 bx = _mm_loadu_ps(ux + i), by = _mm_loadu_ps(uy + i);
+
+      __m128 dx = _mm_sub_ps(zero, _mm_add_ps(_mm_mul_ps(v_st, c), _mm_mul_ps(v_ct, si)));
+      __m128 dy = _mm_sub_ps(_mm_mul_ps(v_ct, c), _mm_mul_ps(v_st, si));
+
+      __m128 along = _mm_add_ps(_mm_mul_ps(dx, bx), _mm_mul_ps(dy, by));
+      __m128 across = _mm_mul_ps(v_r, _mm_sub_ps(_mm_mul_ps(bx, dy), _mm_mul_ps(by, dx)));
+
+      _mm_storeu_ps(s + i, _mm_add_ps(_mm_mul_ps(v_r, along), _mm_sqrt_ps(_mm_sub_ps(v_ll, _mm_mul_ps(across, across)))));
+      _mm_storeu_ps(px + i, _mm_mul_ps(v_r, dx));
+      _mm_storeu_ps(py + i, _mm_mul_ps(v_r, dy));
+      _mm_storeu_ps(sb + i, _mm_mul_ps(across, v_inv_l));
+    }
+#endif
+
+    for(; i < n; i++)
+    {
+      //throw direction, from theta + phase by the angle sum, so there's no sin or cos in here
+      float sin_phi = st * cp[i] + ct * sp[i];
+      float cos_phi = ct * cp[i] - st * sp[i];
+      float dx = -sin_phi, dy = cos_phi;
+
+      float along = dx * ux[i] + dy * uy[i];      //cos of the angle between throw and bore
+      float across = r * (ux[i] * dy - uy[i] * dx);  //crankpin's distance off the bore axis
+
+      s[i] = r * along + std::sqrt(ll - across * across);
+      px[i] = r * dx;
+      py[i] = r * dy;
+      sb[i] = -across * inv_l;
+    }
+
+    for(i = 0; i < n; i++)
+      rod_angle[i] = bore[i] + std::asin(sin_rod[i]);
+  }
+
+  //where things are, relative to the crank axis - add the center back on for model space
+  glm::vec3 crankpin(int i) const     {return glm::vec3(center_x[i] + pin_x[i], center_y[i] + pin_y[i], center_z[i]);}
+  glm::vec3 piston_pin(int i) const   {return glm::vec3(center_x[i] + travel[i] * bore_x[i], center_y[i] + travel[i] * bore_y[i], center_z[i]);}
+
+  //inputs, one per cylinder
+  std::vector<float> center_x, center_y, center_z;  //crank axis, with z where this cylinder's rod sits on it
+  std::vector<float> sin_phase, cos_phase;          //of this cylinder's throw, relative to theta
+  std::vector<float> bore, bore_x, bore_y;          //bore angle, and the unit vector it points along
+
+  //results
+  std::vector<float> travel;                        //piston pin distance from the crank axis, along the bore
+  std::vector<float> pin_x, pin_y;                  //crankpin, from the crank axis
+  std::vector<float> sin_rod;                       //of the rod's angle off the bore
+  std::vector<float> rod_angle;                     //about z, big end at the crankpin and small end up +y
+
+private:
+  float r, l;
+};
+
+#endif
@@ -0,0 +1,220 @@
+#ifndef NORMAL_MAP_H
+#define NORMAL_MAP_H
+
+#include "common.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <thread>
+
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+
+//******************************************************************************
+//  Normal maps from height maps
+//
+//        Slopes come from a 3x3 Sobel or Scharr kernel, scaled so they're
+//        height units per texel, and the normal is (-dx, -dy, 1) normalized,
+//        with y going up the image, like OpenGL texture coordinates. It's
+//        stored the same way as the shipped normal maps - 0.5 * n + 0.5 in
+//        RGBA8, or as just x and y, for GL_RG8, where the shader rebuilds z
+//        as sqrt(1 - x*x - y*y).
+//
+//        Rows are split into bands, one per hardware thread. Within a row,
+//        4 texels at a time go through SSE2, with the edges and any left
+//        over done one at a time by the same math in scalar code, so the
+//        results don't depend on which path a texel took.
+//
+//    generate_normal_map(heights, width, height, out, options):
+//        Heights are 0 to 1, row major, top row first, like they come out of
+//        a png.
+//
+//    normal_map_from_png(filename, out, width, height, options):
+//        Same, from a grey (8 or 16 bit) height map png.
+//******************************************************************************
+
+enum normal_kernel
+{
+  kernel_sobel,     //1 2 1
+  kernel_scharr     //3 10 3, closer to rotationally symmetric
+};
+
+typedef struct normal_map_options_t
+{
+  normal_kernel kernel = kernel_scharr;
+  float strength = 4.0f;    //slope multiplier - how far a height of 1 is, in texels, over this
+  int channels = 4;         //4 for RGBA8, 2 for just x and y
+  bool wrap = true;         //tiling textures wrap around at the edges, others clamp
+} normal_map_options;
+
+
+namespace normal_map_detail
+{
+  //weights for the side and middle of each 3x3 edge, and what to scale their sum
+  //by so a unit slope comes out as 1
+  inline void kernel_weights(normal_kernel k, float& side, float& middle, float& norm)
+  {
+    if(k == kernel_sobel) {side = 1.0f; middle = 2.0f;}
+    else                  {side = 3.0f; middle = 10.0f;}
+    norm = 1.0f / (2.0f * (2.0f * side + middle));
+  }
+
+  inline void store(unsigned char* out, int channels, float nx, float ny, float nz)
+  {
+    out[0] = (unsigned char)lrintf(127.5f * nx + 127.5f);
+    out[1] = (unsigned char)lrintf(127.5f * ny + 127.5f);
+    if(channels == 4)
+    {
+      out[2] = (unsigned char)lrintf(127.5f * nz + 127.5f);
+      out[3] = 255;
+    }
+  }
+
+  //one texel, any position - a, b, c are the rows above, at, and below
+  inline void texel(const float* a, const float* b, const float* c, int x, int width, bool wrap,
+                    float side, float middle, float scale, int channels, unsigned char* out)
+  {
+    int l = x - 1, r = x + 1;
+    if(wrap) {l = (l + width) % width; r = r % width;}
+    else     {l = std::max(l, 0); r = std::min(r, width - 1);}
+
+    float gx = side * ((a[r] - a[l]) + (c[r] - c[l])) + middle * (b[r] - b[l]);
+    float gy = side * ((a[l] - c[l]) + (a[r] - c[r])) + middle * (a[x] - c[x]);    //rows go down, y goes up
+
+    float nx = -gx * scale, ny = -gy * scale, nz = 1.0f;
+    float inv = 1.0f / std::sqrt(nx * nx + ny * ny + nz * nz);
+    store(out, channels, nx * inv, ny * inv, nz * inv);
+  }
+
+  inline void rows(const float* heights, int width, int height, int first, int last,
+                   const normal_map_options& o, unsigned char* out)
+  {
+    float side, middle, norm;
+    kernel_weights(o.kernel, side, middle, norm);
+    float scale = norm * o.strength;
+    int channels = o.channels;
+
+    for(int y = first; y < last; y++)
+    {
+      int above = y - 1, below = y + 1;
+      if(o.wrap) {above = (above + height) % height; below = below % height;}
+      else       {above = std::max(above, 0); below = std::min(below, height - 1);}
+
+      const float* a = heights + (size_t)above * width;
+      const float* b = heights + (size_t)y * width;
+      const float* c = heights + (size_t)below * width;
+      unsigned char* row_out = out + (size_t)y * width * channels;
+
+      int x = 1;
+
+#ifdef __SSE2__
+      const __m128 v_side = _mm_set1_ps(side), v_middle = _mm_set1_ps(middle);
+      const __m128 v_scale = _mm_set1_ps(-scale), one = _mm_set1_ps(1.0f), half = _mm_set1_ps(127.5f);
+
+      for(; x + 4 <= width - 1; x += 4)
+      {
+        __m128 al = _mm_loadu_ps(a + x - 1), am = _mm_loadu_ps(a + x), ar = _mm_loadu_ps(a + x + 1);
+        __m128 bl = _mm_loadu_ps(b + x - 1),                            br = _mm_loadu_ps(b + x + 1);
+        __m128 cl = _mm_loadu_ps(c + x - 1), cm = _mm_loadu_ps(c + x), cr = _mm_loadu_ps(c + x + 1);
+
+        //same order of operations as texel(), so both give the same bits
+        __m128 gx = _mm_add_ps(_mm_mul_ps(v_side, _mm_add_ps(_mm_sub_ps(ar, al), _mm_sub_ps(cr, cl))), _mm_mul_ps(v_middle, _mm_sub_ps(br, bl)));
+        __m128 gy = _mm_add_ps(_mm_mul_ps(v_side, _mm_add_ps(_mm_sub_ps(al, cl), _mm_sub_ps(ar, cr))), _mm_mul_ps(v_middle, _mm_sub_ps(am, cm)));
+
+        __m128 nx = _mm_mul_ps(gx, v_scale), ny = _mm_mul_ps(gy, v_scale);
+        __m128 inv = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), one)));
+
+        //to 0-255, rounded to nearest even like lrintf
+        __m128i ex = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(half, _mm_mul_ps(nx, inv)), half));
+        __m128i ey = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(half, _mm_mul_ps(ny, inv)), half));
+        __m128i xy = _mm_or_si128(ex, _mm_slli_epi32(ey, 8));
+
+        if(channels == 4)
+        {
+          __m128i ez = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(half, inv), half));    //nz is 1 before normalizing
+          __m128i rgba = _mm_or_si128(_mm_or_si128(xy, _mm_slli_epi32(ez, 16)), _mm_set1_epi32(0xff000000));
+          _mm_storeu_si128((__m128i*)(row_out + 4 * x), rgba);
+        }
+        else
+        {//low 16 bits of each lane, squeezed into the low 64 bits
+          __m128i packed = _mm_shufflelo_epi16(xy, _MM_SHUFFLE(3, 3, 2, 0));
+          packed = _mm_shufflehi_epi16(packed, _MM_SHUFFLE(3, 3, 2, 0));
+          packed = _mm_shuffle_epi32(packed, _MM_SHUFFLE(3, 3, 2, 0));
+          _mm_storel_epi64((__m128i*)(row_out + 2 * x), packed);
+        }
+      }
+#endif
+
+      for(; x < width - 1; x++)
+        texel(a, b, c, x, width, o.wrap, side, middle, scale, channels, row_out + channels * x);
+
+      //the two edges, which reach around or clamp
+      texel(a, b, c, 0, width, o.wrap, side, middle, scale, channels, row_out);
+      if(width > 1)
+        texel(a, b, c, width - 1, width, o.wrap, side, middle, scale, channels, row_out + channels * (width - 1));
+    }
+  }
+}
+
+
+void generate_normal_map(const std::vector<float>& heights, int width, int height, std::vector<unsigned char>& out,
+                         const normal_map_options& options = normal_map_options())
+{
+  PROFILE_ZONE("generate_normal_map");
+
+  out.resize((size_t)width * height * options.channels);
+  if(width == 0 || height == 0)
+    return;
+
+  int num_threads = std::min<int>(std::max(1u, std::thread::hardware_concurrency()), height);
+
+  std::vector<std::thread> workers;
+  for(int w = 1; w < num_threads; w++)
+    workers.push_back(std::thread([&, w]()
+    {
+      PROFILE_ZONE("normal map band");
+      normal_map_detail::rows(&heights[0], width, height, (height * w) / num_threads, (height * (w + 1)) / num_threads, options, &out[0]);
+    }));
+
+  normal_map_detail::rows(&heights[0], width, height, 0, height / num_threads, options, &out[0]);
+
+  for(auto& w : workers)
+    w.join();
+}
+
+bool normal_map_from_png(const std::string& filename, std::vector<unsigned char>& out, unsigned& width, unsigned& height,
+                         const normal_map_options& options = normal_map_options())
+{
+  //16 bit first, for the maps that have it - the 8 bit ones won't convert up
+  std::vector<unsigned char> image;
+  std::vector<float> heights;
+
+  if(lodepng::decode(image, width, height, filename, LCT_GREY, 16) == 0)
+  {
+    heights.resize(width * height);
+    for(size_t i = 0; i < heights.size(); i++)
+      heights[i] = ((image[2*i] << 8) | image[2*i + 1]) / 65535.0f;
+  }
+  else
+  {
+    unsigned error = lodepng::decode(image, width, height, filename, LCT_GREY, 8);
+    if(error)
+    {
+      cout << "couldn't load " << filename << ": " << lodepng_error_text(error) << endl;
+      return false;
+    }
+
+    heights.resize(width * height);
+    for(size_t i = 0; i < heights.size(); i++)
+      heights[i] = image[i] / 255.0f;
+  }
+
+  generate_normal_map(heights, width, height, out, options);
+  return true;
+}
+
+#endif
@@ -0,0 +1,259 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include "common.hpp"
+#include "gl_state.hpp"
+#include "profiler.hpp"
+
+#include <cstdint>
+
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+
+//******************************************************************************
+//  Class: gas_particles
+//
+//  Purpose:  Puffs of intake and exhaust gas, drawn as soft disks colored by
+//        one of iq's cosine palettes (https://iquilezles.org/articles/palettes)
+//        over their lifetime.
+//
+//        Storage is a struct of arrays, sized once for the capacity, with the
+//        live particles packed at the front - emitting writes past the end,
+//        dying swaps the last one in, so there's no allocation after init().
+//        step() moves 4 particles at a time through SSE2, with the leftovers
+//        done by the same math in scalar code.
+//
+//        All of them go to the GPU as one instance buffer, 6 floats apiece,
+//        and one glDrawArraysInstanced draws a quad per particle.
+//
+//        Emission and stepping use their own random number state, and only
+//        the fixed step length, so stepping from a clear() is the same every
+//        time - it's what keeps replays the same.
+//
+//  Functions:
+//    emit(position, velocity, spread, life, size, kind, n):
+//        n new particles, velocity jittered by up to spread in each axis -
+//        any past capacity are dropped.
+//
+//    step(dt):
+//        Buoyancy and drag, then moves and ages everything, and removes
+//        the ones that have run out of life.
+//
+//    display(proj, view, model):
+//        Uploads and draws - model is the sub's, gas lives in engine space.
+//******************************************************************************
+
+enum gas_kind
+{
+  gas_exhaust = 0,
+  gas_intake = 1
+};
+
+class gas_particles
+{
+public:
+  gas_particles(int capacity = 131072) : capacity(capacity), count(0), rng(0x9e3779b9u)
+  {
+    px.resize(capacity); py.resize(capacity); pz.resize(capacity);
+    vx.resize(capacity); vy.resize(capacity); vz.resize(capacity);
+    age.resize(capacity); life.resize(capacity); size.resize(capacity); kind.resize(capacity);
+  }
+
+  void init();
+
+  void clear()                  {count = 0; rng = 0x9e3779b9u;}
+  int get_count() const         {return count;}
+  int get_capacity() const      {return capacity;}
+
+  void emit(glm::vec3 position, glm::vec3 velocity, float spread, float lifetime, float particle_size, gas_kind k, int n);
+  void step(float dt);
+  void display(glm::mat4 proj, glm::mat4 view, glm::mat4 model);
+
+  float buoyancy = 0.3f;    //upward acceleration - it's gas, under water
+  float drag = 2.0f;        //fraction of velocity lost per second, roughly
+
+private:
+  int capacity, count;
+  uint32_t rng;
+
+  std::vector<float> px, py, pz;
+  std::vector<float> vx, vy, vz;
+  std::vector<float> age, life, size, kind;
+
+  //xorshift, -1 to 1
+  float jitter()
+  {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return (rng >> 8) * (2.0f / 16777216.0f) - 1.0f;
+  }
+
+  GLuint shader, vao, instances;
+  GLint proj_loc, view_loc, model_loc;
+};
+
+
+void gas_particles::init()
+{
+  cout << " compiling gas particle shaders" << endl;
+  {
+    PROFILE_ZONE("Shader compile");
+    Shader s("resources/shaders/gas_vert.glsl", "resources/shaders/gas_frag.glsl");
+    shader = s.Program;
+  }
+  glstate.use_program(shader);
+
+  proj_loc = glGetUniformLocation(shader, "proj");
+  view_loc = glGetUniformLocation(shader, "view");
+  model_loc = glGetUniformLocation(shader, "model");
+
+  glGenVertexArrays(1, &vao);
+  glstate.bind_vertex_array(vao);
+
+  glGenBuffers(1, &instances);
+  glstate.bind_buffer(GL_ARRAY_BUFFER, instances);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 6 * capacity, NULL, GL_STREAM_DRAW);
+
+  //the quad's corners come from gl_VertexID, these are all per instance
+  GLint position_size_attrib = glGetAttribLocation(shader, "vPositionSize");
+  glEnableVertexAttribArray(position_size_attrib);
+  glVertexAttribPointer(position_size_attrib, 4, GL_FLOAT, false, sizeof(float) * 6, (static_cast<const char*>(0) + (0)));
+  glVertexAttribDivisor(position_size_attrib, 1);
+
+  GLint age_kind_attrib = glGetAttribLocation(shader, "vAgeKind");
+  glEnableVertexAttribArray(age_kind_attrib);
+  glVertexAttribPointer(age_kind_attrib, 2, GL_FLOAT, false, sizeof(float) * 6, (static_cast<const char*>(0) + (sizeof(float) * 4)));
+  glVertexAttribDivisor(age_kind_attrib, 1);
+}
+
+void gas_particles::emit(glm::vec3 position, glm::vec3 velocity, float spread, float lifetime, float particle_size, gas_kind k, int n)
+{
+  n = std::min(n, capacity - count);
+
+  for(int i = count; i < count + n; i++)
+  {
+    px[i] = position.x;
+    py[i] = position.y;
+    pz[i] = position.z;
+
+    vx[i] = velocity.x + spread * jitter();
+    vy[i] = velocity.y + spread * jitter();
+    vz[i] = velocity.z + spread * jitter();
+
+    age[i] = 0.0f;
+    life[i] = lifetime * (0.75f + 0.25f * jitter());
+    size[i] = particle_size;
+    kind[i] = k;
+  }
+
+  count += n;
+}
+
+void gas_particles::step(float dt)
+{
+  PROFILE_ZONE("gas_particles::step");
+
+  //v = v * damp + up, then p += v dt - the same order in both paths
+  float damp = std::max(0.0f, 1.0f - drag * dt);
+  float up = buoyancy * dt;
+
+  int i = 0;
+
+#ifdef __SSE2__
+  const __m128 v_damp = _mm_set1_ps(damp), v_up = _mm_set1_ps(up), v_dt = _mm_set1_ps(dt);
+
+  for(; i + 4 <= count; i += 4)
+  {
+    __m128 x = _mm_mul_ps(_mm_loadu_ps(&vx[i]), v_damp);
+    __m128 y = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&vy[i]), v_damp), v_up);
+    __m128 z = _mm_mul_ps(_mm_loadu_ps(&vz[i]), v_damp);
+
+    _mm_storeu_ps(&vx[i], x);
+    _mm_storeu_ps(&vy[i], y);
+    _mm_storeu_ps(&vz[i], z);
+
+    _mm_storeu_ps(&px[i], _mm_add_ps(_mm_loadu_ps(&px[i]), _mm_mul_ps(x, v_dt)));
+    _mm_storeu_ps(&py[i], _mm_add_ps(_mm_loadu_ps(&py[i]), _mm_mul_ps(y, v_dt)));
+    _mm_storeu_ps(&pz[i], _mm_add_ps(_mm_loadu_ps(&pz[i]), _mm_mul_ps(z, v_dt)));
+
+    _mm_storeu_ps(&age[i], _mm_add_ps(_mm_loadu_ps(&age[i]), v_dt));
+  }
+#endif
+
+  for(; i < count; i++)
+  {
+    vx[i] = vx[i] * damp;
+    vy[i] = vy[i] * damp + up;
+    vz[i] = vz[i] * damp;
+
+    px[i] += vx[i] * dt;
+    py[i] += vy[i] * dt;
+    pz[i] += vz[i] * dt;
+
+    age[i] += dt;
+  }
+
+  //the dead ones get the last live one moved over them
+  for(i = 0; i < count; )
+  {
+    if(age[i] < life[i])
+    {
+      i++;
+      continue;
+    }
+
+    count--;
+    px[i] = px[count];  py[i] = py[count];  pz[i] = pz[count];
+    vx[i] = vx[count];  vy[i] = vy[count];  vz[i] = vz[count];
+    age[i] = age[count];  life[i] = life[count];  size[i] = size[count];  kind[i] = kind[count];
+  }
+}
+
+void gas_particles::display(glm::mat4 proj, glm::mat4 view, glm::mat4 model)
+{
+  PROFILE_ZONE("gas_particles::display");
+
+  if(count == 0)
+    return;
+
+  //orphan, then interleave straight into the new storage
+  glstate.bind_buffer(GL_ARRAY_BUFFER, instances);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 6 * capacity, NULL, GL_STREAM_DRAW);
+  float* mapped = (float*)glMapBufferRange(GL_ARRAY_BUFFER, 0, sizeof(float) * 6 * count,
+                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  if(!mapped)
+    return;
+
+  for(int i = 0; i < count; i++)
+  {
+    float* p = mapped + 6 * i;
+    p[0] = px[i];
+    p[1] = py[i];
+    p[2] = pz[i];
+    p[3] = size[i];
+    p[4] = age[i] / life[i];
+    p[5] = kind[i];
+  }
+  glUnmapBuffer(GL_ARRAY_BUFFER);
+
+  glstate.use_program(shader);
+  glstate.bind_vertex_array(vao);
+
+  glUniformMatrix4fv(proj_loc, 1, GL_FALSE, glm::value_ptr(proj));
+  glUniformMatrix4fv(view_loc, 1, GL_FALSE, glm::value_ptr(view));
+  glUniformMatrix4fv(model_loc, 1, GL_FALSE, glm::value_ptr(model));
+
+  //added together, so there's no need to sort them, and tested against but not written to depth
+  glstate.blend_func(GL_SRC_ALPHA, GL_ONE);
+  glDepthMask(GL_FALSE);
+
+  glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+
+  glDepthMask(GL_TRUE);
+  glstate.blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+#endif
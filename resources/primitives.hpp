@@ -0,0 +1,318 @@
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+#include "common.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <map>
+
+
+//******************************************************************************
+//  Primitive meshes
+//
+//        Cylinders, disks, annuli, lathed profiles and propeller blades, as
+//        indexed triangle lists, counterclockwise from outside. Everything
+//        round goes by an integer number of segments, and takes its points
+//        from one shared unit circle table per segment count - built by
+//        rotating by the step angle, in double, so the only sin and cos are
+//        for the step itself. The last segment indexes back to the first
+//        point, so there's no seam to crack open, and vertices that are
+//        split for a hard edge (a cylinder's side and its cap) are at bit
+//        for bit the same positions.
+//
+//        Each add_ function reserves exactly what it's about to add.
+//
+//    unit_circle(segments):
+//        (cos, sin) at each of the segments angles, starting from 0.
+//
+//    add_cylinder(m, center, radius, z0, z1, segments, caps):
+//        Around z, through center (x, y), from z0 to z1.
+//
+//    add_disk(m, center, radius, segments, facing) / add_annulus(...):
+//        In the plane z = center.z, facing +z for facing > 0, -z otherwise.
+//
+//    add_lathe(m, profile, segments):
+//        Profile (radius, y) points, top to bottom, swept around y. Normals
+//        are smooth along the profile, except where a point is repeated,
+//        which makes a crease. Start and end on the axis for a closed solid.
+//
+//    add_blade(m, angle, root, tip, root_chord, tip_chord, root_pitch,
+//              tip_pitch, thickness, z):
+//        A twisted slab reaching out from radius root to tip, along angle in
+//        the xy plane, centered on z.
+//
+//    append_triangles(m, points, normals):
+//        Expanded into the flat per-triangle arrays the sub draws from.
+//******************************************************************************
+
+typedef struct primitive_mesh_t
+{
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> normals;
+  std::vector<uint32_t> indices;
+} primitive_mesh;
+
+
+namespace primitive_detail
+{
+  inline void reserve(primitive_mesh& m, size_t vertices, size_t indices)
+  {
+    m.positions.reserve(m.positions.size() + vertices);
+    m.normals.reserve(m.normals.size() + vertices);
+    m.indices.reserve(m.indices.size() + indices);
+  }
+
+  inline uint32_t vertex(primitive_mesh& m, glm::vec3 p, glm::vec3 n)
+  {
+    m.positions.push_back(p);
+    m.normals.push_back(n);
+    return m.positions.size() - 1;
+  }
+
+  inline void triangle(primitive_mesh& m, uint32_t a, uint32_t b, uint32_t c)
+  {
+    m.indices.push_back(a);
+    m.indices.push_back(b);
+    m.indices.push_back(c);
+  }
+
+  //a fan over a ring of segments vertices starting at first, around center
+  inline void fan(primitive_mesh& m, uint32_t center, uint32_t first, int segments, bool flip)
+  {
+    for(int k = 0; k < segments; k++)
+    {
+      uint32_t a = first + k, b = first + (k + 1) % segments;
+      if(flip) triangle(m, center, b, a);
+      else     triangle(m, center, a, b);
+    }
+  }
+
+  //quads between two rings of segments vertices each
+  inline void band(primitive_mesh& m, uint32_t lower, uint32_t upper, int segments, bool flip)
+  {
+    for(int k = 0; k < segments; k++)
+    {
+      int next = (k + 1) % segments;
+      uint32_t a = lower + k, b = lower + next, c = upper + next, d = upper + k;
+      if(flip) {triangle(m, a, c, b); triangle(m, a, d, c);}
+      else     {triangle(m, a, b, c); triangle(m, a, c, d);}
+    }
+  }
+}
+
+
+const std::vector<glm::vec2>& unit_circle(int segments)
+{
+  //one table per segment count, kept for the life of the program - geometry is built on the main thread
+  static std::map<int, std::vector<glm::vec2>> tables;
+
+  std::vector<glm::vec2>& t = tables[segments];
+  if(t.empty())
+  {
+    t.reserve(segments);
+    double step = JonDefault::twopi / segments;
+    double cs = std::cos(step), sn = std::sin(step);
+    double c = 1.0, s = 0.0;
+
+    for(int k = 0; k < segments; k++)
+    {
+      t.push_back(glm::vec2(c, s));
+      double next_c = c * cs - s * sn;
+      s = s * cs + c * sn;
+      c = next_c;
+    }
+  }
+  return t;
+}
+
+void add_cylinder(primitive_mesh& m, glm::vec2 center, float radius, float z0, float z1, int segments, bool caps = true)
+{
+  using namespace primitive_detail;
+  if(z0 > z1)
+    std::swap(z0, z1);
+
+  const std::vector<glm::vec2>& ring = unit_circle(segments);
+  reserve(m, 2 * segments + (caps ? 2 * (segments + 1) : 0), 6 * segments + (caps ? 6 * segments : 0));
+
+  uint32_t lower = m.positions.size();
+  for(int k = 0; k < segments; k++)
+    vertex(m, glm::vec3(center + radius * ring[k], z0), glm::vec3(ring[k], 0.0f));
+
+  uint32_t upper = m.positions.size();
+  for(int k = 0; k < segments; k++)
+    vertex(m, glm::vec3(center + radius * ring[k], z1), glm::vec3(ring[k], 0.0f));
+
+  band(m, lower, upper, segments, false);
+
+  if(caps)
+  {
+    for(int end = 0; end < 2; end++)
+    {
+      float z = end ? z1 : z0;
+      glm::vec3 n = glm::vec3(0.0f, 0.0f, end ? 1.0f : -1.0f);
+
+      uint32_t middle = vertex(m, glm::vec3(center, z), n);
+      uint32_t first = m.positions.size();
+      for(int k = 0; k < segments; k++)
+        vertex(m, glm::vec3(center + radius * ring[k], z), n);
+
+      fan(m, middle, first, segments, !end);
+    }
+  }
+}
+
+void add_disk(primitive_mesh& m, glm::vec3 center, float radius, int segments, float facing = 1.0f)
+{
+  using namespace primitive_detail;
+  const std::vector<glm::vec2>& ring = unit_circle(segments);
+  reserve(m, segments + 1, 3 * segments);
+
+  glm::vec3 n = glm::vec3(0.0f, 0.0f, facing > 0.0f ? 1.0f : -1.0f);
+  uint32_t middle = vertex(m, center, n);
+  uint32_t first = m.positions.size();
+  for(int k = 0; k < segments; k++)
+    vertex(m, center + glm::vec3(radius * ring[k], 0.0f), n);
+
+  fan(m, middle, first, segments, facing <= 0.0f);
+}
+
+void add_annulus(primitive_mesh& m, glm::vec3 center, float inner, float outer, int segments, float facing = 1.0f)
+{
+  using namespace primitive_detail;
+  const std::vector<glm::vec2>& ring = unit_circle(segments);
+  reserve(m, 2 * segments, 6 * segments);
+
+  glm::vec3 n = glm::vec3(0.0f, 0.0f, facing > 0.0f ? 1.0f : -1.0f);
+  uint32_t in = m.positions.size();
+  for(int k = 0; k < segments; k++)
+    vertex(m, center + glm::vec3(inner * ring[k], 0.0f), n);
+
+  uint32_t out = m.positions.size();
+  for(int k = 0; k < segments; k++)
+    vertex(m, center + glm::vec3(outer * ring[k], 0.0f), n);
+
+  band(m, in, out, segments, facing > 0.0f);   //inner to outer turns the other way from lower to upper
+}
+
+void add_lathe(primitive_mesh& m, const std::vector<glm::vec2>& profile, int segments)
+{
+  using namespace primitive_detail;
+  int n = profile.size();
+  if(n < 2)
+    return;
+
+  const std::vector<glm::vec2>& ring = unit_circle(segments);
+
+  //points on the axis are a single vertex, and their segments are fans, not bands - skipped ones add nothing
+  size_t vertices = 0, indices = 0;
+  for(int j = 0; j < n; j++)
+  {
+    vertices += (profile[j].x == 0.0f) ? 1 : segments;
+    if(j + 1 < n && profile[j] != profile[j + 1])
+    {
+      int poles = (profile[j].x == 0.0f) + (profile[j + 1].x == 0.0f);
+      indices += (poles == 0) ? 6 * segments : (poles == 1) ? 3 * segments : 0;
+    }
+  }
+  reserve(m, vertices, indices);
+
+  //outward normal of each profile segment, in (radius, y), for a profile going down - zero where a point repeats
+  std::vector<glm::vec2> edge(n - 1);
+  for(int j = 0; j + 1 < n; j++)
+  {
+    glm::vec2 d = profile[j + 1] - profile[j];
+    edge[j] = (d == glm::vec2(0.0f)) ? d : glm::normalize(glm::vec2(-d.y, d.x));
+  }
+
+  //angle k goes from +x toward -z - points on the axis are one vertex, not a ring of them
+  std::vector<uint32_t> rows(n);
+  for(int j = 0; j < n; j++)
+  {
+    glm::vec2 a = (j > 0) ? edge[j - 1] : glm::vec2(0.0f);
+    glm::vec2 b = (j + 1 < n) ? edge[j] : glm::vec2(0.0f);
+    glm::vec2 pn = a + b;
+    pn = (pn == glm::vec2(0.0f)) ? glm::vec2(1.0f, 0.0f) : glm::normalize(pn);
+
+    rows[j] = m.positions.size();
+    if(profile[j].x == 0.0f)
+    {
+      vertex(m, glm::vec3(0.0f, profile[j].y, 0.0f), glm::vec3(0.0f, pn.y > 0.0f ? 1.0f : -1.0f, 0.0f));
+      continue;
+    }
+
+    for(int k = 0; k < segments; k++)
+    {
+      glm::vec3 around = glm::vec3(ring[k].x, 0.0f, -ring[k].y);
+      vertex(m, glm::vec3(0.0f, profile[j].y, 0.0f) + profile[j].x * around, glm::vec3(0.0f, pn.y, 0.0f) + pn.x * around);
+    }
+  }
+
+  for(int j = 0; j + 1 < n; j++)
+  {
+    if(edge[j] == glm::vec2(0.0f))    //a repeated point is just where the normals split
+      continue;
+
+    bool pole_above = profile[j].x == 0.0f, pole_below = profile[j + 1].x == 0.0f;
+    if(pole_above && pole_below)      //along the axis, no area
+      continue;
+
+    if(pole_above)        fan(m, rows[j], rows[j + 1], segments, false);
+    else if(pole_below)   fan(m, rows[j + 1], rows[j], segments, true);
+    else                  band(m, rows[j], rows[j + 1], segments, true);
+  }
+}
+
+void add_blade(primitive_mesh& m, float angle, float root, float tip, float root_chord, float tip_chord,
+               float root_pitch, float tip_pitch, float thickness, float z)
+{
+  using namespace primitive_detail;
+  reserve(m, 24, 36);
+
+  glm::vec3 out = glm::vec3(std::cos(angle), std::sin(angle), 0.0f);   //once per blade, not per vertex
+  glm::vec3 around = glm::vec3(-out.y, out.x, 0.0f);
+  glm::vec3 axis = glm::vec3(0.0f, 0.0f, 1.0f);
+
+  //corner i: bit 0 tip, bit 1 leading edge, bit 2 the +thickness side
+  glm::vec3 c[8];
+  for(int i = 0; i < 8; i++)
+  {
+    bool at_tip = i & 1;
+    float pitch = at_tip ? tip_pitch : root_pitch;
+    glm::vec3 chord = std::cos(pitch) * around + std::sin(pitch) * axis;
+    glm::vec3 thick = glm::cross(out, chord);
+
+    c[i] = (at_tip ? tip : root) * out + glm::vec3(0.0f, 0.0f, z)
+         + ((i & 2) ? 0.5f : -0.5f) * (at_tip ? tip_chord : root_chord) * chord
+         + ((i & 4) ? 0.5f : -0.5f) * thickness * thick;
+  }
+
+  //(out, chord, thick) is right handed, so these go around counterclockwise from outside, same as a unit cube's
+  int faces[6][4] = {{0,2,3,1}, {4,5,7,6}, {0,4,6,2}, {1,3,7,5}, {0,1,5,4}, {2,6,7,3}};
+  for(auto& f : faces)
+  {
+    //across the diagonals, since twist bends the long faces a little
+    glm::vec3 n = glm::normalize(glm::cross(c[f[2]] - c[f[0]], c[f[3]] - c[f[1]]));
+
+    uint32_t first = m.positions.size();
+    for(int k = 0; k < 4; k++)
+      vertex(m, c[f[k]], n);
+
+    triangle(m, first, first + 1, first + 2);
+    triangle(m, first, first + 2, first + 3);
+  }
+}
+
+void append_triangles(const primitive_mesh& m, std::vector<glm::vec3>& points, std::vector<glm::vec3>& normals)
+{
+  points.reserve(points.size() + m.indices.size());
+  normals.reserve(normals.size() + m.indices.size());
+
+  for(uint32_t i : m.indices)
+  {
+    points.push_back(m.positions[i]);
+    normals.push_back(m.normals[i]);
+  }
+}
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "common.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+
+//******************************************************************************
+//  Class: profiler
+//
+//  Purpose:  Records named, nested spans of CPU time and writes them out as
+//        Chrome trace JSON (load it in chrome://tracing, or ui.perfetto.dev).
+//
+//        Spans come from PROFILE_ZONE("name") at the top of a scope - the
+//        zone object reads the clock when it's made and again when it goes
+//        out of scope. Each thread writes into its own ring buffer, so the
+//        only contention is with write_trace(). When the profiler is turned
+//        off a zone costs one relaxed atomic load, and building with
+//        -DNO_PROFILER takes the zones out entirely.
+//
+//  Functions:
+//
+//    set_enabled(on), is_enabled():
+//        Starts/stops recording. On from the start, so startup gets caught.
+//
+//    name_thread(name):
+//        Label for the calling thread in the trace.
+//
+//    write_trace(filename):
+//        Everything currently in the ring buffers, for all threads.
+//
+//    Names have to be string literals, or otherwise outlive the profiler -
+//    only the pointer is kept.
+//******************************************************************************
+
+class profiler
+{
+public:
+  static profiler& instance()   {static profiler p; return p;}
+
+  void set_enabled(bool on)     {enabled.store(on, std::memory_order_relaxed);}
+  bool is_enabled() const       {return enabled.load(std::memory_order_relaxed);}
+
+  //nanoseconds since the profiler started
+  uint64_t now() const          {return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();}
+
+  void record(const char* name, uint64_t start, uint64_t end)
+  {
+    thread_buffer& b = local();
+    std::lock_guard<std::mutex> hold(b.lock);
+
+    zone z = {name, start, end};
+    if(b.zones.size() < capacity)
+    {
+      b.zones.push_back(z);
+    }
+    else
+    {//full, write over the oldest
+      b.zones[b.next] = z;
+      b.next = (b.next + 1) % capacity;
+    }
+  }
+
+  void name_thread(const std::string& name)
+  {
+    thread_buffer& b = local();
+    std::lock_guard<std::mutex> hold(b.lock);
+    b.name = name;
+  }
+
+  void write_trace(const std::string& filename)
+  {
+    std::ofstream out(filename);
+    if(!out)
+    {
+      cout << "couldn't open " << filename << " for the trace" << endl;
+      return;
+    }
+
+    std::lock_guard<std::mutex> hold_registry(registry_lock);
+
+    size_t count = 0;
+    bool first = true;
+
+    out << "{\"traceEvents\":[" << endl;
+    for(auto& b : buffers)
+    {
+      std::lock_guard<std::mutex> hold(b->lock);
+
+      if(!first) out << "," << endl;
+      first = false;
+      out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << b->id
+          << ",\"args\":{\"name\":\"" << b->name << "\"}}";
+
+      for(const zone& z : b->zones)
+      {//microseconds, the unit the trace format expects
+        out << "," << endl << "{\"name\":\"" << z.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << b->id
+            << ",\"ts\":" << z.start / 1000.0 << ",\"dur\":" << (z.end - z.start) / 1000.0 << "}";
+        count++;
+      }
+    }
+    out << endl << "]}" << endl;
+
+    cout << count << " zones from " << buffers.size() << " threads written to " << filename << endl;
+  }
+
+private:
+  profiler() : enabled(true), epoch(std::chrono::steady_clock::now()) {}
+
+  typedef struct zone_t
+  {
+    const char* name;
+    uint64_t start, end;
+  } zone;
+
+  typedef struct thread_buffer_t
+  {
+    int id;
+    std::string name;
+    std::vector<zone> zones;  //ring buffer once it fills up
+    size_t next;
+    std::mutex lock;          //only ever contended by write_trace()
+  } thread_buffer;
+
+  //buffers belong to the profiler rather than the thread, so the short lived
+  //worker threads from the bvh build and the shrink wrap still show up
+  thread_buffer& local()
+  {
+    static thread_local thread_buffer* mine = nullptr;
+    if(!mine)
+    {
+      std::lock_guard<std::mutex> hold(registry_lock);
+      buffers.push_back(std::unique_ptr<thread_buffer>(new thread_buffer));
+      mine = buffers.back().get();
+      mine->id = buffers.size() - 1;
+      mine->name = "thread " + std::to_string(mine->id);
+      mine->next = 0;
+    }
+    return *mine;
+  }
+
+  static const size_t capacity = 1 << 16;   //zones per thread
+
+  std::atomic<bool> enabled;
+  std::chrono::steady_clock::time_point epoch;
+
+  std::mutex registry_lock;
+  std::vector<std::unique_ptr<thread_buffer>> buffers;
+};
+
+
+//one span, from construction to the end of the enclosing scope
+class profile_zone
+{
+public:
+  profile_zone(const char* n) : name(n), start(0)
+  {
+    if(profiler::instance().is_enabled())
+      start = profiler::instance().now();
+  }
+
+  ~profile_zone()
+  {
+    if(start && profiler::instance().is_enabled())
+      profiler::instance().record(name, start, profiler::instance().now());
+  }
+
+private:
+  const char* name;
+  uint64_t start;   //zero when the profiler was off at the start of the scope
+};
+
+
+#ifndef NO_PROFILER
+  #define PROFILE_CONCAT_INNER(a,b) a##b
+  #define PROFILE_CONCAT(a,b) PROFILE_CONCAT_INNER(a,b)
+  #define PROFILE_ZONE(name) profile_zone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#else
+  #define PROFILE_ZONE(name)
+#endif
+
+#endif
@@ -0,0 +1,286 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include "common.hpp"
+#include "gl_state.hpp"
+#include "gpu_timer.hpp"
+#include "profiler.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+
+
+//******************************************************************************
+//  Class: frame_allocator
+//
+//  Purpose:  Bump allocator for things that only live for one frame. reset()
+//        at the top of the frame gives all of it back at once. If a frame
+//        runs past the end, the overflow comes from the heap, and the next
+//        reset() grows the block to fit, so it settles after a frame or two.
+//******************************************************************************
+
+class frame_allocator
+{
+public:
+  frame_allocator(size_t initial = 1 << 16) : block(initial), used(0), high_water(0) {}
+  ~frame_allocator()  {release_overflow();}
+
+  //uninitialized storage for n T's - only for types that don't need a destructor
+  template <typename T>
+  T* alloc(size_t n = 1)
+  {
+    size_t bytes = n * sizeof(T);
+    size_t start = (used + alignof(T) - 1) & ~(alignof(T) - 1);
+
+    high_water = std::max(high_water, start + bytes);
+
+    if(start + bytes > block.size())
+    {
+      used = start + bytes;   //keep counting, so reset() knows how big to get
+      overflow.push_back(new unsigned char[bytes + alignof(T)]);
+      size_t base = reinterpret_cast<size_t>(overflow.back());
+      return reinterpret_cast<T*>((base + alignof(T) - 1) & ~(alignof(T) - 1));
+    }
+
+    used = start + bytes;
+    return reinterpret_cast<T*>(&block[start]);
+  }
+
+  void reset()
+  {
+    release_overflow();
+    if(high_water > block.size())
+      block.resize(high_water + high_water / 2);
+    used = 0;
+    high_water = 0;
+  }
+
+  size_t capacity() const   {return block.size();}
+
+private:
+  void release_overflow()
+  {
+    for(auto p : overflow)
+      delete[] p;
+    overflow.clear();
+  }
+
+  std::vector<unsigned char> block;
+  std::vector<unsigned char*> overflow;
+  size_t used, high_water;
+};
+
+
+//******************************************************************************
+//  Class: render_queue
+//
+//  Purpose:  Collects everything that's going to be drawn this frame as draw
+//        packets, sorts them, and then issues them so that the state changes
+//        between neighbours are as few as possible.
+//
+//        The sort key is 64 bits, most significant first:
+//
+//           63-60  pass      opaque before translucent, etc
+//           59-48  program
+//           47-40  vao
+//           39-32  type      the "type" uniform, standing in for a material
+//           31-0   depth     float bits of the distance to the eye - front to
+//                            back for opaque, flipped for translucent passes
+//
+//        Keys are sorted with an 8 bit LSD radix sort, skipping any byte that
+//        is the same for every key. Packets, and anything hanging off them,
+//        come out of a frame_allocator that's reset by begin_frame().
+//******************************************************************************
+
+enum render_pass
+{
+  pass_opaque = 0,
+  pass_translucent = 1
+};
+
+typedef struct draw_packet_t
+{
+  uint64_t key;
+
+  GLuint program, vao;
+  int type;
+  GLenum mode;
+  GLint first;
+  GLsizei count;
+
+  const glm::mat4* transforms;  //rot8 and transl8, for the engine parts - null when not needed
+  int timer;                    //gpu_timer pass to attribute this to, -1 for none
+
+  //if indirect is nonzero, first and count are ignored and this is one glMultiDrawArraysIndirect
+  //over draw_count commands in that buffer, instead of one glDrawArrays
+  GLuint indirect;
+  GLsizei draw_count;
+} draw_packet;
+
+
+//layout glMultiDrawArraysIndirect reads from GL_DRAW_INDIRECT_BUFFER
+typedef struct draw_arrays_command_t
+{
+  GLuint count;
+  GLuint instance_count;
+  GLuint first;
+  GLuint base_instance;
+} draw_arrays_command;
+
+
+class render_queue
+{
+public:
+  render_queue() : timers(nullptr) {}
+
+  //timer passes get bracketed around runs of packets with the same timer id
+  void set_timers(gpu_timer* t)   {timers = t;}
+
+  void begin_frame()
+  {
+    arena.reset();
+    entries.clear();
+  }
+
+  frame_allocator& allocator()    {return arena;}
+
+  //fills in the key from the rest of the packet, and queues a copy of it
+  void submit(draw_packet p, render_pass pass, float depth)
+  {
+    uint32_t d;
+    depth = std::max(depth, 0.0f);
+    std::memcpy(&d, &depth, sizeof(d));   //positive floats sort the same as their bits
+    if(pass == pass_translucent)
+      d = ~d;
+
+    p.key = (uint64_t(pass & 0xf) << 60) | (uint64_t(p.program & 0xfff) << 48) | (uint64_t(p.vao & 0xff) << 40)
+          | (uint64_t(p.type & 0xff) << 32) | uint64_t(d);
+
+    draw_packet* stored = arena.alloc<draw_packet>();
+    *stored = p;
+    entries.push_back({p.key, stored});
+  }
+
+  //sorts, then draws everything that was submitted since begin_frame()
+  void flush()
+  {
+    PROFILE_ZONE("render_queue::flush");
+
+    sort();
+
+    int current_timer = -1;
+    int current_type = -1;
+    GLuint typed_program = 0;
+
+    for(const entry& e : entries)
+    {
+      const draw_packet& p = *e.packet;
+
+      if(p.timer != current_timer)
+      {
+        if(timers && current_timer >= 0) timers->end(current_timer);
+        if(timers && p.timer >= 0) timers->begin(p.timer);
+        current_timer = p.timer;
+      }
+
+      glstate.use_program(p.program);
+      glstate.bind_vertex_array(p.vao);
+
+      const locations& l = locate(p.program);
+
+      if(p.program != typed_program || p.type != current_type)
+      {
+        glUniform1i(l.type, p.type);
+        typed_program = p.program;
+        current_type = p.type;
+      }
+
+      if(p.transforms)
+      {
+        glUniformMatrix4fv(l.rot8, 1, GL_FALSE, glm::value_ptr(p.transforms[0]));
+        glUniformMatrix4fv(l.transl8, 1, GL_FALSE, glm::value_ptr(p.transforms[1]));
+      }
+
+      if(p.indirect)
+      {
+        glstate.bind_buffer(GL_DRAW_INDIRECT_BUFFER, p.indirect);
+        glMultiDrawArraysIndirect(p.mode, 0, p.draw_count, 0);
+      }
+      else
+      {
+        glDrawArrays(p.mode, p.first, p.count);
+      }
+    }
+
+    if(timers && current_timer >= 0)
+      timers->end(current_timer);
+  }
+
+  size_t size() const   {return entries.size();}
+
+private:
+  typedef struct entry_t
+  {
+    uint64_t key;
+    draw_packet* packet;
+  } entry;
+
+  typedef struct locations_t
+  {
+    GLint type, rot8, transl8;
+  } locations;
+
+  const locations& locate(GLuint program)
+  {
+    std::map<GLuint, locations>::iterator it = uniform_locations.find(program);
+    if(it != uniform_locations.end())
+      return it->second;
+
+    locations l;
+    l.type = glGetUniformLocation(program, "type");
+    l.rot8 = glGetUniformLocation(program, "rot8");
+    l.transl8 = glGetUniformLocation(program, "transl8");
+    return uniform_locations[program] = l;
+  }
+
+  void sort()
+  {
+    size_t n = entries.size();
+    if(n < 2)
+      return;
+    scratch.resize(n);
+
+    for(int shift = 0; shift < 64; shift += 8)
+    {
+      size_t counts[256] = {0};
+      for(const entry& e : entries)
+        counts[(e.key >> shift) & 0xff]++;
+
+      //every key has the same byte here, this pass wouldn't move anything
+      if(counts[(entries[0].key >> shift) & 0xff] == n)
+        continue;
+
+      size_t offsets[256];
+      size_t sum = 0;
+      for(int i = 0; i < 256; i++)
+      {
+        offsets[i] = sum;
+        sum += counts[i];
+      }
+
+      for(const entry& e : entries)
+        scratch[offsets[(e.key >> shift) & 0xff]++] = e;
+
+      entries.swap(scratch);
+    }
+  }
+
+  frame_allocator arena;
+  std::vector<entry> entries, scratch;    //keep their capacity frame to frame
+
+  std::map<GLuint, locations> uniform_locations;
+  gpu_timer* timers;
+};
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "common.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+
+//******************************************************************************
+//  Recorded sessions
+//
+//        A session is every key pressed, and every frame drawn, each stamped
+//        with the simulation step it happened at. Replaying one runs the
+//        simulation step by step on the main thread, pressing each key right
+//        before the step after the one it was recorded at, and drawing a
+//        frame wherever one was drawn - so every replay of a file does exactly
+//        the same work, whatever the machine, which is what makes timings
+//        from two builds comparable.
+//
+//        File layout:
+//
+//          header    "HREC", version, step length in seconds
+//          events    one byte type, then the step, as an unsigned LEB128
+//                    varint of the difference from the last event's step,
+//                    then the key, for key events
+//
+//        A frame a step is 2 bytes - a few minutes is a few kilobytes.
+//******************************************************************************
+
+enum session_event_type
+{
+  event_frame = 0,
+  event_key = 1
+};
+
+typedef struct session_event_t
+{
+  uint64_t tick;
+  session_event_type type;
+  unsigned char key;
+} session_event;
+
+typedef struct session_header_t
+{
+  char magic[4];      //"HREC"
+  uint32_t version;
+  double step;        //seconds per simulation step, to catch replays into a build with a different rate
+} session_header;
+
+const uint32_t session_version = 1;
+
+
+//******************************************************************************
+//  Class: session_recorder
+//
+//  Purpose:  Writes a session as it happens. Events are buffered, and only
+//        go to the file on stop(), so recording doesn't add file I/O to the
+//        frames being measured.
+//******************************************************************************
+
+class session_recorder
+{
+public:
+  session_recorder() : recording(false), last_tick(0) {}
+
+  void start(const std::string& file, double step)
+  {
+    filename = file;
+
+    session_header h;
+    std::memcpy(h.magic, "HREC", 4);
+    h.version = session_version;
+    h.step = step;
+    bytes.resize(sizeof(h));
+    std::memcpy(&bytes[0], &h, sizeof(h));
+
+    last_tick = 0;
+    recording = true;
+    events = 0;
+  }
+
+  bool is_recording() const   {return recording;}
+
+  void key(uint64_t tick, unsigned char k)    {if(recording) {add(event_key, tick); bytes.push_back(k);}}
+  void frame(uint64_t tick)                   {if(recording) add(event_frame, tick);}
+
+  bool stop()
+  {
+    if(!recording)
+      return false;
+    recording = false;
+
+    FILE* f = fopen(filename.c_str(), "wb");
+    bool ok = f && fwrite(&bytes[0], 1, bytes.size(), f) == bytes.size();
+    if(f)
+      fclose(f);
+
+    if(ok)
+      cout << "session written to " << filename << ", " << events << " events in " << bytes.size() << " bytes" << endl;
+    else
+      cout << "couldn't write " << filename << endl;
+    return ok;
+  }
+
+private:
+  void add(session_event_type type, uint64_t tick)
+  {
+    bytes.push_back(type);
+
+    uint64_t delta = tick - last_tick;    //ticks never go backwards while recording
+    do
+    {
+      unsigned char b = delta & 0x7f;
+      delta >>= 7;
+      bytes.push_back(b | (delta ? 0x80 : 0));
+    } while(delta);
+
+    last_tick = tick;
+    events++;
+  }
+
+  bool recording;
+  std::string filename;
+  std::vector<unsigned char> bytes;
+  uint64_t last_tick;
+  long events;
+};
+
+
+//reads a whole session back in - false if it's missing, or isn't one
+bool load_session(const std::string& filename, double step, std::vector<session_event>& events)
+{
+  events.clear();
+
+  FILE* f = fopen(filename.c_str(), "rb");
+  if(!f)
+  {
+    cout << "couldn't open " << filename << endl;
+    return false;
+  }
+
+  std::vector<unsigned char> bytes;
+  unsigned char buffer[4096];
+  size_t n;
+  while((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    bytes.insert(bytes.end(), buffer, buffer + n);
+  fclose(f);
+
+  session_header h;
+  if(bytes.size() < sizeof(h))
+  {
+    cout << filename << " is too short to be a session" << endl;
+    return false;
+  }
+  std::memcpy(&h, &bytes[0], sizeof(h));
+
+  if(std::memcmp(h.magic, "HREC", 4) != 0 || h.version != session_version)
+  {
+    cout << filename << " isn't a session this can read" << endl;
+    return false;
+  }
+
+  if(h.step != step)
+    cout << "warning: " << filename << " was recorded at " << 1.0 / h.step << " steps a second, this build runs " << 1.0 / step << endl;
+
+  uint64_t tick = 0;
+  size_t i = sizeof(h);
+  while(i < bytes.size())
+  {
+    session_event e;
+    e.type = (session_event_type)bytes[i++];
+
+    uint64_t delta = 0;
+    int shift = 0;
+    bool more = true;
+    while(more && i < bytes.size() && shift < 64)
+    {
+      delta |= uint64_t(bytes[i] & 0x7f) << shift;
+      more = bytes[i++] & 0x80;
+      shift += 7;
+    }
+
+    bool truncated = more || (e.type == event_key && i >= bytes.size());
+    if(truncated || e.type > event_key)
+    {
+      cout << filename << " is damaged after " << events.size() << " events, replaying what's there" << endl;
+      break;
+    }
+
+    tick += delta;
+    e.tick = tick;
+    e.key = (e.type == event_key) ? bytes[i++] : 0;
+    events.push_back(e);
+  }
+
+  return true;
+}
+
+#endif
@@ -0,0 +1,395 @@
+#ifndef ROOM_LAYOUT_H
+#define ROOM_LAYOUT_H
+
+#include "common.hpp"
+#include "collision.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+
+//******************************************************************************
+//  Room layout
+//
+//        The rooms, described in a small text file instead of in code - see
+//        resources/rooms.layout for the format. load_room_layout() reads it
+//        into the structs below, and build_rooms() expands any number of
+//        rooms into the flat per-triangle arrays the sub draws from, so a
+//        bigger interior is an edit to the file, not to generate_points().
+//
+//        A room is made of sweeps and rects. A sweep is a cross section in
+//        x and y - lines and elliptical arcs, with the inside of the room on
+//        the left going along it - pulled out along z from z0 to z1, with
+//        normals smooth around the arcs. A rect is a flat quad: floors,
+//        ceilings, and panels across the sub, which can have doors cut out.
+//
+//        The walkable space goes in the same file, as the volumes for the
+//        collision world.
+//
+//    load_room_layout(filename, layout):
+//        false if the file can't be opened - lines that don't parse are
+//        reported with their line number, and skipped.
+//
+//    build_rooms(layout, points, normals, colors, room_start, room_num):
+//        Appends every room, and where each one starts and how many
+//        vertices it has.
+//******************************************************************************
+
+typedef struct layout_piece_t
+{
+  bool arc;
+  glm::vec2 from, to;         //line ends
+  glm::vec2 center, radii;    //arc
+  float start, end;           //arc angles, radians, counterclockwise when end > start
+  int segments;
+} layout_piece;
+
+typedef struct layout_sweep_t
+{
+  float z0, z1;
+  std::vector<layout_piece> profile;
+} layout_sweep;
+
+typedef struct layout_rect_t
+{
+  glm::vec3 origin, u, v;     //corners origin, +u, +u+v, +v - facing along cross(u, v)
+} layout_rect;
+
+typedef struct layout_room_t
+{
+  std::string name;
+  std::vector<layout_sweep> sweeps;
+  std::vector<layout_rect> rects;
+} layout_room;
+
+typedef struct room_layout_t
+{
+  std::vector<layout_room> rooms;
+  std::vector<collision_volume> walkable;
+} room_layout;
+
+
+namespace room_layout_detail
+{
+  //panel across the sub, x0 < x1 and y0 < y1
+  inline layout_rect panel(float x0, float x1, float y0, float y1, float z, float facing)
+  {
+    glm::vec3 o(x0, y0, z), u(x1 - x0, 0.0f, 0.0f), v(0.0f, y1 - y0, 0.0f);
+    return (facing > 0.0f) ? layout_rect{o, u, v} : layout_rect{o, v, u};
+  }
+
+  //the parts of a panel that aren't in any of the doors, on a grid through all their edges
+  inline void cut_doors(float x0, float x1, float y0, float y1, float z, float facing,
+                        const std::vector<glm::vec4>& doors, std::vector<layout_rect>& out)
+  {
+    std::vector<float> xs = {x0, x1}, ys = {y0, y1};
+    for(const glm::vec4& d : doors)
+    {
+      xs.push_back(glm::clamp(d.x, x0, x1));  xs.push_back(glm::clamp(d.y, x0, x1));
+      ys.push_back(glm::clamp(d.z, y0, y1));  ys.push_back(glm::clamp(d.w, y0, y1));
+    }
+    std::sort(xs.begin(), xs.end());  xs.erase(std::unique(xs.begin(), xs.end()), xs.end());
+    std::sort(ys.begin(), ys.end());  ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+
+    for(size_t j = 0; j + 1 < ys.size(); j++)
+      for(size_t i = 0; i + 1 < xs.size(); i++)
+      {
+        glm::vec2 mid(0.5f * (xs[i] + xs[i+1]), 0.5f * (ys[j] + ys[j+1]));
+        bool open = false;
+        for(const glm::vec4& d : doors)
+          open = open || (mid.x > d.x && mid.x < d.y && mid.y > d.z && mid.y < d.w);
+
+        if(!open)
+          out.push_back(panel(xs[i], xs[i+1], ys[j], ys[j+1], z, facing));
+      }
+  }
+}
+
+
+bool load_room_layout(const std::string& filename, room_layout& layout)
+{
+  using namespace room_layout_detail;
+  layout.rooms.clear();
+  layout.walkable.clear();
+
+  std::ifstream file(filename);
+  if(!file)
+  {
+    cout << "couldn't open " << filename << endl;
+    return false;
+  }
+
+  std::map<std::string, float> names;
+  std::string line;
+  int line_number = 0;
+
+  //a bulkhead takes the door lines after it, so it's only cut once the next thing starts
+  bool bulkhead_open = false;
+  float bulkhead[6];
+  std::vector<glm::vec4> doors;
+  auto close_bulkhead = [&]()
+  {
+    if(bulkhead_open)
+      cut_doors(bulkhead[0], bulkhead[1], bulkhead[2], bulkhead[3], bulkhead[4], bulkhead[5], doors, layout.rooms.back().rects);
+    bulkhead_open = false;
+    doors.clear();
+  };
+
+  while(std::getline(file, line))
+  {
+    line_number++;
+    line = line.substr(0, line.find('#'));
+
+    std::istringstream in(line);
+    std::string keyword;
+    if(!(in >> keyword))
+      continue;
+
+    //numbers, or names from a set line, with an optional minus sign in front
+    bool ok = true;
+    auto number = [&]()
+    {
+      std::string token;
+      if(!(in >> token))
+      {
+        ok = false;
+        return 0.0f;
+      }
+
+      char* end;
+      float value = std::strtof(token.c_str(), &end);
+      if(*end == '\0')
+        return value;
+
+      bool negative = token[0] == '-';
+      auto found = names.find(negative ? token.substr(1) : token);
+      if(found == names.end())
+      {
+        ok = false;
+        return 0.0f;
+      }
+      return negative ? -found->second : found->second;
+    };
+
+    auto complain = [&](const std::string& what)
+    {
+      cout << filename << ":" << line_number << ": " << what << ", skipping \"" << line << "\"" << endl;
+    };
+
+    if(keyword != "door")
+      close_bulkhead();
+
+    bool needs_room = keyword == "sweep" || keyword == "line" || keyword == "arc" || keyword == "floor" ||
+                      keyword == "ceiling" || keyword == "panel" || keyword == "bulkhead" || keyword == "door";
+    if(needs_room && layout.rooms.empty())
+    {
+      complain(keyword + " before the first room");
+      continue;
+    }
+
+    if(keyword == "set")
+    {
+      std::string name;
+      in >> name;
+      float value = number();
+      if(!ok || name.empty())
+        complain("expected set name value");
+      else
+        names[name] = value;
+    }
+    else if(keyword == "room")
+    {
+      layout_room r;
+      in >> r.name;
+      layout.rooms.push_back(r);
+    }
+    else if(keyword == "sweep")
+    {
+      layout_sweep s;
+      s.z0 = number();  s.z1 = number();
+      if(!ok)
+        complain("expected sweep z0 z1");
+      else
+        layout.rooms.back().sweeps.push_back(s);
+    }
+    else if(keyword == "line" || keyword == "arc")
+    {
+      layout_piece p = {};
+      p.arc = keyword == "arc";
+      if(p.arc)
+      {
+        p.center.x = number();  p.center.y = number();
+        p.radii.x = number();   p.radii.y = number();
+        p.start = glm::radians(number());  p.end = glm::radians(number());
+        p.segments = int(number());
+      }
+      else
+      {
+        p.from.x = number();  p.from.y = number();
+        p.to.x = number();    p.to.y = number();
+      }
+
+      if(!ok || (p.arc && (p.segments < 1 || p.radii.x <= 0.0f || p.radii.y <= 0.0f)))
+        complain(p.arc ? "expected arc cx cy rx ry from to segments" : "expected line x0 y0 x1 y1");
+      else if(layout.rooms.back().sweeps.empty())
+        complain(keyword + " outside of a sweep");
+      else
+        layout.rooms.back().sweeps.back().profile.push_back(p);
+    }
+    else if(keyword == "floor" || keyword == "ceiling")
+    {
+      float x0 = number(), x1 = number(), y = number(), z0 = number(), z1 = number();
+      if(!ok)
+      {
+        complain("expected " + keyword + " x0 x1 y z0 z1");
+        continue;
+      }
+      if(x0 > x1) std::swap(x0, x1);
+      if(z0 > z1) std::swap(z0, z1);
+
+      glm::vec3 o(x0, y, z0), along_x(x1 - x0, 0.0f, 0.0f), along_z(0.0f, 0.0f, z1 - z0);
+      layout.rooms.back().rects.push_back((keyword == "floor") ? layout_rect{o, along_z, along_x} : layout_rect{o, along_x, along_z});
+    }
+    else if(keyword == "panel" || keyword == "bulkhead")
+    {
+      for(int i = 0; i < 6; i++)
+        bulkhead[i] = number();
+      if(!ok)
+      {
+        complain("expected " + keyword + " x0 x1 y0 y1 z facing");
+        continue;
+      }
+      if(bulkhead[0] > bulkhead[1]) std::swap(bulkhead[0], bulkhead[1]);
+      if(bulkhead[2] > bulkhead[3]) std::swap(bulkhead[2], bulkhead[3]);
+
+      bulkhead_open = true;
+      if(keyword == "panel")
+        close_bulkhead();
+    }
+    else if(keyword == "door")
+    {
+      glm::vec4 d;
+      d.x = number();  d.y = number();  d.z = number();  d.w = number();
+      if(!ok)
+        complain("expected door x0 x1 y0 y1");
+      else if(!bulkhead_open)
+        complain("door outside of a bulkhead");
+      else
+        doors.push_back(glm::vec4(std::min(d.x, d.y), std::max(d.x, d.y), std::min(d.z, d.w), std::max(d.z, d.w)));
+    }
+    else if(keyword == "walk")
+    {
+      collision_volume v;
+      v.floor = int(number());
+      v.bmin.x = number();  v.bmax.x = number();
+      v.bmin.y = number();  v.bmax.y = number();
+      v.bmin.z = number();  v.bmax.z = number();
+
+      std::string roof;
+      in >> roof;
+      v.rounded_roof = roof == "roof";
+
+      if(!ok)
+        complain("expected walk level x0 x1 y0 y1 z0 z1 [roof]");
+      else
+      {
+        glm::vec3 lo = glm::min(v.bmin, v.bmax), hi = glm::max(v.bmin, v.bmax);
+        v.bmin = lo;
+        v.bmax = hi;
+        layout.walkable.push_back(v);
+      }
+    }
+    else
+      complain("unknown keyword " + keyword);
+  }
+  close_bulkhead();
+
+  return true;
+}
+
+
+void build_rooms(const room_layout& layout, std::vector<glm::vec3>& points, std::vector<glm::vec3>& normals,
+                 std::vector<glm::vec4>& colors, std::vector<int>& room_start, std::vector<int>& room_num)
+{
+  PROFILE_ZONE("build_rooms");
+  room_start.clear();
+  room_num.clear();
+
+  std::vector<glm::vec2> ring, ring_normals;    //one sweep's profile, expanded
+
+  for(const layout_room& room : layout.rooms)
+  {
+    int start = points.size();
+
+    for(const layout_sweep& s : room.sweeps)
+    {
+      float z0 = std::min(s.z0, s.z1), z1 = std::max(s.z0, s.z1);
+
+      for(const layout_piece& p : s.profile)
+      {
+        ring.clear();
+        ring_normals.clear();
+
+        if(p.arc)
+        {
+          //inward normal of the ellipse is -(cos/rx, sin/ry) - outward if it goes clockwise
+          float inward = (p.end >= p.start) ? 1.0f : -1.0f;
+          for(int k = 0; k <= p.segments; k++)
+          {
+            double a = p.start + (p.end - p.start) * double(k) / p.segments;
+            glm::vec2 c = glm::vec2(std::cos(a), std::sin(a));
+            ring.push_back(p.center + p.radii * c);
+            ring_normals.push_back(-inward * glm::normalize(c / p.radii));
+          }
+        }
+        else
+        {
+          glm::vec2 d = p.to - p.from;
+          glm::vec2 n = (d == glm::vec2(0.0f)) ? d : glm::normalize(glm::vec2(-d.y, d.x));
+          ring.push_back(p.from);   ring_normals.push_back(n);
+          ring.push_back(p.to);     ring_normals.push_back(n);
+        }
+
+        //a quad between each pair of points - counterclockwise seen from the left of the profile
+        for(size_t k = 0; k + 1 < ring.size(); k++)
+        {
+          glm::vec3 a(ring[k], z0), b(ring[k], z1), c(ring[k+1], z1), d(ring[k+1], z0);
+          glm::vec3 na(ring_normals[k], 0.0f), nc(ring_normals[k+1], 0.0f);
+
+          points.push_back(a);  normals.push_back(na);
+          points.push_back(b);  normals.push_back(na);
+          points.push_back(c);  normals.push_back(nc);
+
+          points.push_back(d);  normals.push_back(nc);
+          points.push_back(a);  normals.push_back(na);
+          points.push_back(c);  normals.push_back(nc);
+        }
+      }
+    }
+
+    for(const layout_rect& r : room.rects)
+    {
+      glm::vec3 n = glm::normalize(glm::cross(r.u, r.v));
+      glm::vec3 corners[6] = {r.origin, r.origin + r.u, r.origin + r.u + r.v,
+                              r.origin, r.origin + r.u + r.v, r.origin + r.v};
+      for(glm::vec3& c : corners)
+      {
+        points.push_back(c);
+        normals.push_back(n);
+      }
+    }
+
+    colors.insert(colors.end(), points.size() - start, glm::vec4(1,0,0,1));
+
+    room_start.push_back(start);
+    room_num.push_back(points.size() - start);
+  }
+}
+
+#endif
@@ -8,6 +8,8 @@
 
 #include <GL/glew.h>
 
+#include "../gl_state.hpp"
+
 class Shader
 {
 public:
@@ -103,7 +105,7 @@ public:
     // Uses the current shader
     void Use( )
     {
-        glUseProgram( this->Program );
+        glstate.use_program( this->Program );
     }
 };
 
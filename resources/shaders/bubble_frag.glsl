@@ -0,0 +1,11 @@
+#version 330
+
+varying float fade;
+
+uniform sampler2D sprite;   //POINT_SPRITE_PATH
+
+void main()
+{
+  vec4 s = texture(sprite, gl_PointCoord);
+  gl_FragColor = vec4(mix(vec3(0.6, 0.8, 0.9), s.rgb, 0.5), s.a * 0.6 * fade);
+}
@@ -0,0 +1,24 @@
+#version 330
+
+//one point sprite per bubble
+
+in vec4 vPositionRadius;    //model space, before the sub's scale
+
+varying float fade;
+
+uniform mat4 proj;
+uniform mat4 view;
+uniform mat4 model;         //Sub::get_model()
+uniform float viewport_height;
+
+void main()
+{
+  gl_Position = proj * view * model * vec4(vPositionRadius.xyz, 1.0);
+
+  //diameter in pixels - radius in the world over distance, times pixels per unit at distance 1
+  float r = vPositionRadius.w * length(model[0].xyz);
+  gl_PointSize = clamp(r * proj[1][1] * viewport_height / gl_Position.w, 1.0, 64.0);
+
+  //the ones too small to see the sphere in just go faint
+  fade = clamp(gl_PointSize / 4.0, 0.2, 1.0);
+}
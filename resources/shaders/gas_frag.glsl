@@ -0,0 +1,14 @@
+#version 330
+
+varying vec2 corner;
+varying vec4 color;
+
+void main()
+{
+  //round, and soft toward the edge
+  float r2 = dot(corner, corner);
+  if(r2 > 1.0)
+    discard;
+
+  gl_FragColor = vec4(color.rgb, color.a * (1.0 - r2));
+}
@@ -0,0 +1,42 @@
+#version 330
+
+//one quad per particle, facing the camera - corners from gl_VertexID, the rest per instance
+
+in vec4 vPositionSize;    //engine space position, and radius
+in vec2 vAgeKind;         //0 to 1 over its life, and 0 for exhaust, 1 for intake
+
+varying vec2 corner;
+varying vec4 color;
+
+uniform mat4 proj;
+uniform mat4 view;
+uniform mat4 model;       //Sub::get_model(), same as the engine parts get
+
+
+//https://iquilezles.org/articles/palettes
+vec3 palette(float t, vec3 a, vec3 b, vec3 c, vec3 d)
+{
+  return a + b * cos(6.28318 * (c * t + d));
+}
+
+void main()
+{
+  corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+
+  float age = vAgeKind.x;
+  float model_scale = length(model[0].xyz);
+
+  //puffs spread out as they go
+  float radius = vPositionSize.w * model_scale * mix(0.5, 2.0, age);
+
+  vec4 eye_pos = view * model * vec4(vPositionSize.xyz, 1.0);
+  eye_pos.xy += corner * radius;
+  gl_Position = proj * eye_pos;
+
+  if(vAgeKind.y < 0.5)  //exhaust, hot orange going to grey
+    color.rgb = palette(0.15 + 0.5 * age, vec3(0.5), vec3(0.5), vec3(1.0, 0.7, 0.4), vec3(0.0, 0.15, 0.2));
+  else                  //intake, pale blue
+    color.rgb = palette(0.6 + 0.3 * age, vec3(0.5), vec3(0.5), vec3(1.0), vec3(0.0, 0.1, 0.2));
+
+  color.a = 0.3 * (1.0 - age);
+}
@@ -38,7 +38,7 @@ void main()
     float s = (1/(pow(0.25*distance(vpos,light_position),2))) * 1.0 * pow(max(dot(r,v),0),100);
 
 
-    if(type == 0 && gl_FrontFacing)
+    if((type == 0 || type == 3) && gl_FrontFacing)   //3 is the procedural hull
     {
       gl_FragColor.xyz += a*vec3(0.1,0.1,0.2);
       gl_FragColor.xyz += d*vec3(0.2,0.2,0.16);
@@ -58,7 +58,7 @@ void main()
       }
     }
 
-    if(type == 0 && !gl_FrontFacing)
+    if((type == 0 || type == 3) && !gl_FrontFacing)
     {
       gl_FragColor = gl_FragColor.rgra;
 
@@ -0,0 +1,120 @@
+#version 330
+
+varying vec3 model_pos;
+
+uniform mat4 proj;
+uniform mat4 view;
+uniform mat4 model;
+
+uniform vec3 eye_model;     //the camera, in the hull's own space
+uniform vec3 box_extent;
+uniform vec3 hull_offset;
+uniform float hull_radius;
+
+uniform vec3 eye_position;
+uniform vec3 light_position;
+
+
+//exact distance to the rounded box - a box of half size hull_offset, grown by hull_radius
+float hull_sdf(vec3 p)
+{
+  vec3 q = abs(p) - hull_offset;
+  return length(max(q, 0.0)) + min(max(q.x, max(q.y, q.z)), 0.0) - hull_radius;
+}
+
+vec3 hull_normal(vec3 p)
+{
+  vec3 q = abs(p) - hull_offset;
+  vec3 g;
+  if(max(q.x, max(q.y, q.z)) > 0.0)
+    g = max(q, 0.0);
+  else  //inside the inner box, only happens if the trace overshoots - closest face wins
+    g = (q.x > q.y && q.x > q.z) ? vec3(1,0,0) : ((q.y > q.z) ? vec3(0,1,0) : vec3(0,0,1));
+  return normalize(sign(p) * g);
+}
+
+
+void main()
+{
+  //the box is drawn without culling - from outside, the front faces do the work, from inside the back faces do
+  bool inside_box = all(lessThan(abs(eye_model), box_extent));
+  if(gl_FrontFacing == inside_box)
+    discard;
+
+  vec3 dir = normalize(model_pos - eye_model);
+
+  //start where the ray enters the box, or at the eye if it's already in there
+  float t = inside_box ? 0.0 : distance(model_pos, eye_model);
+  float far = t + 2.0 * length(box_extent);
+
+  //from inside the hull, trace out to the inside of the skin instead
+  float side = hull_sdf(eye_model) < 0.0 ? -1.0 : 1.0;
+
+  bool hit = false;
+  vec3 p;
+  for(int i = 0; i < 96; i++)
+  {
+    p = eye_model + t * dir;
+    float d = side * hull_sdf(p);
+    if(d < 0.00005 * t)
+    {
+      hit = true;
+      break;
+    }
+    t += d;
+    if(t > far)
+      break;
+  }
+
+  if(!hit)
+    discard;
+
+
+  //from here it's the hull's shading from hull_frag.glsl, with vpos and the normal in the same space it uses
+  vec3 vpos = (model * vec4(p, 1.0)).xyz;
+  vec3 n = normalize(mat3(model) * hull_normal(p));
+
+  vec4 clip = proj * view * vec4(vpos, 1.0);
+  float depth = 0.5 * (clip.z / clip.w) + 0.5;
+  gl_FragDepth = depth;
+
+  gl_FragColor = (p.y > -0.11) ? vec4(0.1, 0.1, 0.1, 1.0) : vec4(0.386, 0.1, 0.0, 1.0);
+
+  vec3 l = normalize(vpos - light_position);
+  vec3 v = normalize(vpos - eye_position);
+  vec3 r = normalize(reflect(l, n));
+
+  float falloff = 1/(pow(0.25*distance(vpos,light_position),2));
+
+  if(side > 0.0)
+  {//outside
+    float a = 0.08;
+    float d = falloff * 0.3 * max(dot(n, l),-0.4);
+    float s = falloff * 1.0 * pow(max(dot(r,v),0),100);
+
+    gl_FragColor.xyz += a*vec3(0.1,0.1,0.2);
+    gl_FragColor.xyz += d*vec3(0.2,0.2,0.16);
+    if(dot(n,l) > 0)
+      gl_FragColor.xyz += s*vec3(1,1,0);
+  }
+  else
+  {//inside, looking at the back of the skin
+    gl_FragColor = vec4(0.3,0.17,0.05,1);
+    gl_FragColor.xyz += 0.1*vec3(0,0.1,0.16);
+
+    n = -n;
+    float d = falloff * 0.68 * max(dot(n, l),0);
+    gl_FragColor.xyz += d*vec3(0.22,0.22,0);
+
+    r = normalize(reflect(l,-n));
+    float s = falloff * 0.88 * pow(max(dot(r,v),0),3);
+    if(dot(n,l) > 0)
+      gl_FragColor.xyz += s*vec3(vec2(0.35),0);
+
+    if(int(gl_FragCoord.y) % 3 == 0)
+      gl_FragColor = vec4(vec3(0.2),1);
+  }
+
+//depth coloring
+  gl_FragColor.xyz *= 0.2*(1/depth);
+}
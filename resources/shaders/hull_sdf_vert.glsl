@@ -0,0 +1,26 @@
+#version 330
+
+//draws the hull's bounding box, nothing else - the fragment shader finds the actual
+//surface inside it by sphere tracing the rounded box distance function
+
+varying vec3 model_pos;   //on the box, in the hull's own space
+
+uniform mat4 proj;
+uniform mat4 view;
+uniform mat4 model;       //Sub::get_model() - the same yaw/pitch/roll and scale hull_vert.glsl does
+uniform vec3 box_extent;  //half size of the box, hull_offset + hull_radius
+
+
+//corner i has x from bit 0, y from bit 1, z from bit 2 - counterclockwise from outside
+const int box_indices[36] = int[36](0, 6, 2, 0, 4, 6,   1, 3, 7, 1, 7, 5,
+                                    0, 5, 4, 0, 1, 5,   2, 6, 7, 2, 7, 3,
+                                    0, 3, 1, 0, 2, 3,   4, 5, 7, 4, 7, 6);
+
+void main()
+{
+  int corner = box_indices[gl_VertexID];
+  vec3 s = vec3((corner & 1) != 0 ? 1.0 : -1.0, (corner & 2) != 0 ? 1.0 : -1.0, (corner & 4) != 0 ? 1.0 : -1.0);
+
+  model_pos = s * box_extent;
+  gl_Position = proj * view * model * vec4(model_pos, 1.0);
+}
@@ -15,7 +15,12 @@ uniform mat4 proj;
 uniform mat4 view;
 uniform float scale;
 uniform int t;
-uniform int type;
+uniform int type;   //0 hull, 1 rooms, 2 engine, 3 hull from gl_VertexID
+
+//the procedural hull - same rounded box as Sub::add_hull_lod(), with no vertex buffer behind it
+uniform int hull_segments;    //per quarter circle
+uniform vec3 hull_offset;     //centers of the corner spheres are at +/- these
+uniform float hull_radius;
 
 
   uniform mat4 transl8;
@@ -40,8 +45,105 @@ mat4 rotationMatrix(vec3 axis, float angle)
 }
 
 
+//corner k (0-3, going around) of quad q of the procedural hull - the quads are laid out
+//as 8 corners of segments*segments each, then 12 edges of segments each, then 6 panels
+void hull_quad_corner(int q, int k, out vec3 p, out vec3 n)
+{
+  int segs = hull_segments;
+  float arc_step = 1.5707963 / float(segs);
+
+  int corner_quads = 8 * segs * segs;
+  int edge_quads = 12 * segs;
+
+  //which way around the quad, as offsets in the two grid directions
+  int di = (k == 1 || k == 2) ? 1 : 0;
+  int dj = (k == 2 || k == 3) ? 1 : 0;
+
+  if(q < corner_quads)
+  {//one octant of a sphere, polar angle from the y axis
+    int c = q / (segs * segs);
+    int r = q - c * segs * segs;
+    vec3 s = vec3((c & 4) != 0 ? 1.0 : -1.0, (c & 2) != 0 ? 1.0 : -1.0, (c & 1) != 0 ? 1.0 : -1.0);
+
+    float polar = float(r / segs + di) * arc_step;
+    float around = float(r % segs + dj) * arc_step;
+
+    n = s * vec3(sin(polar) * cos(around), cos(polar), sin(polar) * sin(around));
+    p = s * hull_offset + hull_radius * n;
+  }
+  else if(q < corner_quads + edge_quads)
+  {//a quarter cylinder running along one axis
+    int e = q - corner_quads;
+    int edge = e / segs;
+    int i = e - edge * segs;
+
+    int axis = edge / 4;
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+    float su = (edge & 2) != 0 ? 1.0 : -1.0;
+    float sv = (edge & 1) != 0 ? 1.0 : -1.0;
+
+    float angle = float(i + dj) * arc_step;
+    n = vec3(0.0);
+    n[u] = su * cos(angle);
+    n[v] = sv * sin(angle);
+
+    p = vec3(0.0);
+    p[axis] = (di == 1) ? hull_offset[axis] : -hull_offset[axis];
+    p[u] = su * hull_offset[u];
+    p[v] = sv * hull_offset[v];
+    p += hull_radius * n;
+  }
+  else
+  {//flat panel
+    int f = q - corner_quads - edge_quads;
+    int axis = f / 2;
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+    float s = (f % 2 == 1) ? 1.0 : -1.0;
+
+    n = vec3(0.0);
+    n[axis] = s;
+
+    p = vec3(0.0);
+    p[axis] = s * (hull_offset[axis] + hull_radius);
+    p[u] = (di == 1) ? hull_offset[u] : -hull_offset[u];
+    p[v] = (dj == 1) ? hull_offset[v] : -hull_offset[v];
+  }
+}
+
+//vertex k of triangle tri - two triangles per quad, (a,b,c) and (a,c,d), swapped around
+//when needed so they're counterclockwise from outside, same as on the CPU
+void hull_vertex(int tri, int k, out vec3 p, out vec3 n)
+{
+  int q = tri / 2;
+  int second = tri % 2;
+
+  vec3 pa, pb, pc, na, nb, nc;
+  hull_quad_corner(q, 0, pa, na);
+  hull_quad_corner(q, 1 + second, pb, nb);
+  hull_quad_corner(q, 2 + second, pc, nc);
+
+  if(dot(cross(pb - pa, pc - pa), na + nb + nc) < 0.0)
+  {
+    vec3 tp = pb; pb = pc; pc = tp;
+    vec3 tn = nb; nb = nc; nc = tn;
+  }
+
+  if(k == 0)      {p = pa; n = na;}
+  else if(k == 1) {p = pb; n = nb;}
+  else            {p = pc; n = nc;}
+}
+
+
 void main()
 {
+  vec3 position = vPosition;
+  vec3 surface_normal = vNormal;
+
+  if(type == 3)
+    hull_vertex(gl_VertexID / 3, gl_VertexID % 3, position, surface_normal);
+
   // color = vec4(vTexCoord.x,vTexCoord.y,0.2,1.0);
   // color = vec4(vNormal+0.5,1.0);
   // color = vColor;
@@ -54,9 +156,9 @@ void main()
 
 
 
-  if(type == 0) //ship hull
+  if(type == 0 || type == 3) //ship hull
   {
-    if(vPosition.y > -0.11)
+    if(position.y > -0.11)
     {
       color = vec4(0.1, 0.1, 0.1, 1.0);
     }
@@ -81,7 +183,7 @@ void main()
   vec3 pitch_vec = vec3(1,0,0); //pitch is about the axis represented by a vector to the right
   vec3 roll_vec = vec3(0,0,1); //roll is about the axis represented by a vector in the direction of the ship's travel
 
-  vec3 transformed_normal = vNormal;
+  vec3 transformed_normal = surface_normal;
 
 
 //YAW
@@ -110,7 +212,7 @@ void main()
 
   normal = transformed_normal;
 
-  vec4 vPosition_local = apply_roll*(apply_pitch*(apply_yaw*vec4(scale*vPosition, 1.0)));
+  vec4 vPosition_local = apply_roll*(apply_pitch*(apply_yaw*vec4(scale*position, 1.0)));
 
 
 
@@ -0,0 +1,33 @@
+#version 330
+
+in vec3 vpos;
+in vec3 normal;
+in float morph;
+
+uniform vec3 eye_position;
+uniform vec3 fog_color;
+uniform float fog_distance;
+
+uniform int show_lod;   //tints by how far along the morph each vertex is
+
+
+void main()
+{
+  vec3 n = normalize(normal);
+
+  //sand on the flats, darker rock on the slopes
+  vec3 sand = vec3(0.32, 0.29, 0.2);
+  vec3 rock = vec3(0.12, 0.13, 0.12);
+  vec3 color = mix(rock, sand, smoothstep(0.6, 0.9, n.y));
+
+  //light from above, through the water
+  float d = max(dot(n, normalize(vec3(0.3, 1.0, 0.2))), 0.0);
+  color *= 0.25 + 0.75 * d;
+
+  if(show_lod == 1)
+    color = mix(color, vec3(1.0, 0.3, 0.1), morph);
+
+  //fades out into the clear color with distance
+  float f = clamp(distance(vpos, eye_position) / fog_distance, 0.0, 1.0);
+  gl_FragColor = vec4(mix(color, fog_color, f * f), 1.0);
+}
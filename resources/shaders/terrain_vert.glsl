@@ -0,0 +1,68 @@
+#version 330
+
+in  vec2 vPosition;   //on the shared grid, 0 to 1 on each side
+in  vec4 vPatch;      //per instance - x and z of the corner, size, lod level
+
+out vec3 vpos;
+out vec3 normal;
+out float morph;
+
+uniform mat4 proj;
+uniform mat4 view;
+
+uniform vec3 eye_position;
+
+//tiles of the height map that are resident, and which layer each tile is in
+uniform sampler2DArray height_tiles;
+uniform sampler2D page_table;   //-1 where a tile isn't resident
+uniform vec2 tiles;         //across, down
+uniform float tile_size;    //samples per tile, not counting the overlap
+uniform vec2 map_size;      //samples
+
+uniform vec2 origin;        //world x,z of the corner of the height map
+uniform float extent;       //world size of the height map, on each side
+uniform float base;         //world y of a black texel
+uniform float height_scale; //world y from black to white
+
+uniform float grid_cells;   //quads along one side of the grid being drawn
+uniform vec2 morph_range[16];   //start and end of the morph to the next level, by level
+
+
+float height_at(vec2 xz)
+{
+  vec2 sample_pos = clamp((xz - origin) / extent, 0.0, 1.0) * (map_size - 1.0);
+  vec2 tile = min(floor(sample_pos / tile_size), tiles - 1.0);
+
+  float layer = texelFetch(page_table, ivec2(tile), 0).r;
+  if(layer < 0.0)
+    return base;
+
+  //each tile has one extra sample on the far sides, so this never has to reach into the next one
+  vec2 uv = (sample_pos - tile * tile_size + 0.5) / (tile_size + 1.0);
+  return base + height_scale * textureLod(height_tiles, vec3(uv, layer), 0.0).r;
+}
+
+void main()
+{
+  vec2 xz = vPatch.xy + vPosition * vPatch.z;
+
+  //CDLOD morph - going out towards the end of this level's range, every other
+  //vertex slides onto its neighbour, so at the end of the range this patch
+  //matches the coarser level beside it
+  vec2 range = morph_range[int(vPatch.w)];
+  float dist = distance(eye_position, vec3(xz.x, height_at(xz), xz.y));
+  morph = clamp((dist - range.x) / (range.y - range.x), 0.0, 1.0);
+
+  vec2 odd = fract(vPosition * grid_cells * 0.5) * 2.0 / grid_cells;
+  xz -= odd * vPatch.z * morph;
+
+  vpos = vec3(xz.x, height_at(xz), xz.y);
+
+  //central differences, one cell of this patch's grid apart
+  float e = vPatch.z / grid_cells;
+  float dx = height_at(xz + vec2(e, 0.0)) - height_at(xz - vec2(e, 0.0));
+  float dz = height_at(xz + vec2(0.0, e)) - height_at(xz - vec2(0.0, e));
+  normal = normalize(vec3(-dx, 2.0 * e, -dz));
+
+  gl_Position = proj * view * vec4(vpos, 1.0);
+}
@@ -0,0 +1,72 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "common.hpp"
+#include "engine.hpp"
+
+#include <atomic>
+#include <chrono>
+
+
+//******************************************************************************
+//  Class: triple_buffer
+//
+//  Purpose:  Hands data from one writer thread to one reader thread without
+//        either of them ever waiting on the other. There are three slots - the
+//        writer owns one, the reader owns one, and the third is the most
+//        recently published. Publishing and reading are each one atomic
+//        exchange on the index of that middle slot, which also carries a bit
+//        to say whether it holds something the reader hasn't seen yet.
+//******************************************************************************
+
+template <typename T>
+class triple_buffer
+{
+public:
+  triple_buffer() : middle(1), front(0), back(2) {}
+
+  //writer side - fill this in, then publish() it
+  T& write_slot()         {return slots[back];}
+  void publish()          {back = middle.exchange(back | fresh_bit) & index_mask;}
+
+  //reader side - the latest published slot, or the same one as last time if nothing new came in
+  bool fresh() const      {return middle.load() & fresh_bit;}
+  const T& read()
+  {
+    if(fresh())
+      front = middle.exchange(front) & index_mask;
+    return slots[front];
+  }
+
+  //for setting up all three slots before the writer starts
+  T& slot(int i)          {return slots[i];}
+
+private:
+  static const int fresh_bit = 4;
+  static const int index_mask = 3;
+
+  T slots[3];
+  std::atomic<int> middle;
+  int front;    //only touched by the reader
+  int back;     //only touched by the writer
+};
+
+
+//everything the simulation produces in one step
+typedef struct sim_state_t
+{
+  int t;
+  glm::vec3 yawpitchroll;
+  glm::vec3 light_position;
+  std::vector<engine_instance> engine;
+} sim_state;
+
+
+//what the render thread gets - the last two steps, so it can blend between them
+typedef struct frame_snapshot_t
+{
+  sim_state prev, cur;
+  std::chrono::steady_clock::time_point time;   //when cur was stepped
+} frame_snapshot;
+
+#endif
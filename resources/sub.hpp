@@ -11,6 +11,13 @@
 #include "common.hpp"
 #include "accoutrement.hpp"
 #include "engine.hpp"
+#include "bubbles.hpp"
+#include "room_layout.hpp"
+#include "bvh.hpp"
+#include "snapshot.hpp"
+#include "gpu_timer.hpp"
+#include "profiler.hpp"
+#include "render_queue.hpp"
 
 
 //******************************************************************************
@@ -22,7 +29,10 @@
 //  Functions:
 //
 //    Constructor:
-//        Takes no arguments, calls generate_points() to create geometry. Then
+//        Takes capsule_hull, false unless main.cc is given --capsule-hull,
+//        which shrink-wraps the hull onto a capsule instead of building the
+//        rounded box - a capsule hull is only drawn from the mesh, whatever
+//        the hull mode. Calls generate_points() to create geometry. Then
 //        buffers all this data to the GPU memory. Textures are handled by
 //        the class, and each panel has its own display function. This allows
 //        the 6 panels to be drawn in depth-order (back to front)
@@ -45,41 +55,98 @@
 //        and that all the latest values of the uniform variables are sent to the
 //        GPU. In addition to this, make sure that all the textures are bound the
 //        correct texture units.
+//
+//        The draw functions don't draw directly anymore - they submit packets
+//        to a render_queue, which sorts them and issues them in display().
+//
+//    Simulation
+//        Rotation, the engine and the light are stepped at a fixed rate on a
+//        worker thread, which hands each step to display() through a triple
+//        buffer. display() blends the last two steps, so rendering never
+//        waits on the simulation, and the simulation never waits on a frame.
 //******************************************************************************
 
 
 class Sub{
 
 public:
-  Sub();
+  Sub(bool capsule_hull = false);   //capsule_hull: shrink-wrap the hull onto a capsule, instead of the rounded box
+  ~Sub();
 
   void display();
 
   void draw_hull_func();
   void draw_rooms_func();
   void draw_engine_func();
+  void step_effects(int t);
+  void draw_gas_func();
+  void draw_bubbles_func();
 
 
   // void display_panel(int num);  //display the appropriate side, 1-6 - holdover from SpAce
 
 
-  void adjust_roll_rate(float adj)  {roll_rate += adj;}
-  void adjust_pitch_rate(float adj) {pitch_rate += adj;}
-  void adjust_yaw_rate(float adj)   {yaw_rate += adj;}
+  void adjust_roll_rate(float adj)  {roll_rate = snap(roll_rate + adj); dirty = true;}
+  void adjust_pitch_rate(float adj) {pitch_rate = snap(pitch_rate + adj); dirty = true;}
+  void adjust_yaw_rate(float adj)   {yaw_rate = snap(yaw_rate + adj); dirty = true;}
 
   // void adjust_roll(int degrees);   //upcoming, allows for manual control over orientation of the ship - when used, zero out the rate value
   // void adjust_pitch(int degrees);
   // void adjust_yaw(int degrees);
 
-  void update_rotation();
-
   void set_proj(glm::mat4 proj);
   void set_view(glm::mat4 view);
+  glm::mat4 get_proj()            {return proj;}
+  glm::mat4 get_view()            {return view;}
   void set_scale(float scale);
-  void set_time(int tin)          {t = tin; glUniform1i(t_loc,t); sub_engine.set_theta(tin/50.0f);}
 
-  void toggle_hull()              {draw_hull = !draw_hull;}
-  void toggle_room(int n)         {draw_room[n] = !draw_room[n];}
+  void toggle_hull()              {draw_hull = !draw_hull; dirty = true;}
+  //the procedural and raymarched modes only know the rounded box, so the capsule stays a mesh
+  void cycle_hull_mode()          {if(!capsule_hull) {hull_mode = (hull_mode + 1) % num_hull_modes; dirty = true;}}
+
+  //gpu time per hull draw for each of the hull modes, done right away with a glFinish
+  void benchmark_hull(int draws);
+  void toggle_room(int n)         {if(n >= 0 && n < (int)draw_room.size()) {draw_room[n] = !draw_room[n]; rooms_changed = true; dirty = true;}}
+
+  //walkable space from the room layout, for the collision world
+  const std::vector<collision_volume>& get_walkable() {return layout.walkable;}
+
+  //engine and light animation - when this is off and the rates are all zero, nothing moves
+  void toggle_animation()         {animate = !animate; dirty = true;}
+  bool get_animation()            {return animate;}
+
+  //intake and exhaust gas - off, light, or heavy, which is around 100k particles
+  void cycle_gas()                {gas_rate = (gas_rate == 0) ? 20 : (gas_rate == 20) ? 350 : 0; dirty = true;}
+  int get_gas_count()             {return gas.get_count();}
+
+  //bubbles off the propeller and hull - off, some, or lots, which is a few tens of thousands
+  void cycle_bubbles()            {bubble_rate = (bubble_rate == 0) ? 40 : (bubble_rate == 40) ? 160 : 0; dirty = true;}
+  int get_bubble_count()          {return bubbles.get_count();}
+
+  //true if anything changed since the last display(), or anything is in motion
+  bool needs_redraw();
+
+  //for replaying a recorded session - with the simulation thread stopped,
+  //step_to() runs the steps on the calling thread, and frames are drawn
+  //exactly at the newest step instead of blending toward it
+  void stop_simulation();
+  void start_simulation();
+  void reset();                     //simulation and display toggles back to how they start up - thread has to be stopped
+  void step_to(uint64_t tick);      //thread has to be stopped
+
+  uint64_t get_tick()             {return sim_ticks;}
+  double get_step()               {return sim_step;}
+  double get_sim_time()           {return sim_ticks * sim_step;}     //seconds of simulation so far
+
+  //ray queries against the generated geometry - rays are given in model space,
+  //that is, before the scale and the yaw/pitch/roll from the vertex shader
+  bool pick(int x, int y, bvh_hit& hit);  //window coordinates, origin at the bottom left
+  const bvh& get_bvh()            {return scene_bvh;}
+
+  glm::mat4 get_model();   //mirrors the transform done in hull_vert.glsl
+
+  //per pass gpu time, rolling min/avg/p99
+  void write_timings(const std::string& filename) {timers.write_csv(filename);}
 
 
 
@@ -88,10 +155,63 @@ private:
 
   void generate_points();
   void subd_square(glm::vec3 a, glm::vec2 at, glm::vec3 b, glm::vec2 bt, glm::vec3 c, glm::vec2 ct, glm::vec3 d, glm::vec2 dt, glm::vec3 norm, float clow, float chigh);
+  void shrink_wrap(glm::vec3 acap, glm::vec3 bcap, float r);
+  bool capsule_hull;    //set once, by the constructor - the hull is built one way or the other
 
   //pitch, yaw, roll
 
-  float roll_rate, pitch_rate, yaw_rate;
+  //written here on the main thread, read by the simulation thread
+  std::atomic<float> roll_rate, pitch_rate, yaw_rate;
+
+  //so stepping a rate up and back down lands on exactly zero, and the sub can sit still
+  float snap(float rate)          {return (std::abs(rate) < 0.0001f) ? 0.0f : rate;}
+
+  bool dirty;     //set by anything that changes what's on screen, cleared by display()
+  std::atomic<bool> animate;
+
+//SIMULATION THREAD
+  void simulation_loop();             //runs until running goes false
+  void step(sim_state& state);        //one fixed step, same math regardless of frame rate
+  sim_state initial_state();
+
+  //owned by the simulation thread while it runs, by step_to() while it doesn't
+  sim_state sim, sim_prev;
+  bool sim_was_moving;
+  void publish_step(std::chrono::steady_clock::time_point when);
+
+  std::atomic<uint64_t> sim_ticks;    //steps taken since the last reset
+  bool stepped;                       //being driven by step_to(), not the thread
+
+  const double sim_step = 1.0/60.0;   //seconds
+  const double max_behind = 0.25;     //past this, drop time instead of running a pile of steps to catch up
+
+  std::thread sim_thread;
+  std::atomic<bool> running;
+  triple_buffer<frame_snapshot> snapshots;
+
+  //render side copy of what's being drawn - set up in display()
+  std::vector<engine_instance> render_instances;
+  bool render_moving;   //the last snapshot had prev != cur, so there's more blending to do
+  std::chrono::steady_clock::time_point render_time;
+
+//GPU TIMING
+  gpu_timer timers;
+  int hull_pass, rooms_pass, engine_pass;
+
+//DRAWING
+  render_queue queue;
+  draw_packet base_packet(int type, int timer);   //sub_shader, vao, triangles - first and count still to fill in
+  glm::vec3 render_eye;                           //eye position in model space, for the depth part of the sort keys
+  glm::vec3 hull_center;                          //for the same
+  std::vector<glm::vec3> room_center;
+
+  //the enabled rooms go out as one glMultiDrawArraysIndirect - the commands only get rebuilt
+  //when rooms_changed is set, by toggle_room() or anything else that changes which rooms are drawn
+  void build_room_commands();
+  GLuint room_commands;           //GL_DRAW_INDIRECT_BUFFER
+  GLsizei num_room_commands;
+  glm::vec3 rooms_center;         //of the enabled rooms, for the sort key
+  bool rooms_changed;
 
 //BUFFER, VAO
   GLuint vao;
@@ -104,7 +224,6 @@ private:
 
 
 
-  GLuint point_sprite_tex;
 
 
 
@@ -117,7 +236,7 @@ private:
 
 //UNIFORMS
   GLuint yawpitchroll_loc;
-  glm::vec3 yawpitchroll;
+  glm::vec3 render_yawpitchroll;  //blend of the last two simulation steps, what gets drawn
 
   GLuint proj_loc;
   glm::mat4 proj;
@@ -134,7 +253,6 @@ private:
   GLfloat scale;
 
   GLuint t_loc;
-  int t;
 
 
 
@@ -153,10 +271,43 @@ private:
 
 
   bool draw_hull;       //draw for the hull
-  bool draw_room[9];    //draw for each of the rooms
+  std::vector<bool> draw_room;    //draw for each of the rooms
 
   int hull_start, hull_num; //start of hull geometry, number of verticies in the hull geometry
-  int room_start[9], room_num[9]; //start of room geometry, number of verticies in the room geometry, per each of the 9 rooms
+
+  //levels of detail for the hull - level 0 is hull_start/hull_num above, the rest are coarser versions
+  //of the same rounded box, picked each frame by how big the hull is on screen
+  static const int max_hull_lods = 4;
+  int num_hull_lods;
+  int hull_lod_start[max_hull_lods], hull_lod_num[max_hull_lods];
+  int hull_lod;                     //the level currently being drawn
+  float hull_bounding_radius;       //model space, about the origin
+  void add_hull_lod(int segments, float radius, glm::vec3 offset);
+  float hull_screen_radius();       //pixels
+  int select_hull_lod();
+
+  //how the hull gets drawn
+  enum
+  {
+    hull_mesh,          //out of the vertex buffer, at the level of detail picked by select_hull_lod()
+    hull_procedural,    //built in the vertex shader from gl_VertexID - see hull_quad_corner() in hull_vert.glsl
+    hull_raymarched,    //bounding box only, the fragment shader traces the rounded box - see hull_sdf_frag.glsl
+    num_hull_modes
+  };
+  int hull_mode;
+
+  GLuint procedural_vao;            //no attributes, nothing to pull from
+  GLuint hull_segments_loc;
+  int hull_segments;                //what was last sent
+  int procedural_segments();        //for the current size on screen
+
+  GLuint sdf_shader;
+  GLuint sdf_proj_loc, sdf_view_loc, sdf_model_loc, sdf_eye_model_loc, sdf_light_position_loc;
+  room_layout layout;                     //as read from ROOM_LAYOUT_PATH
+  std::vector<int> room_start, room_num;  //start of room geometry, number of verticies in the room geometry, per room
+  int engine_start, engine_num;   //all the engine parts, in their own local spaces
+
+  bvh scene_bvh;  //built over the hull and rooms once they're generated
 
   typedef struct triangle_t{
     glm::vec3 points[3];
@@ -173,13 +324,28 @@ private:
   // roommodel rooms;    //holds the rooms separate from the hull
   engine sub_engine;  //does animation for the engine
 
+  //stepped on the render side, catching up to the simulation's t each frame - nothing is
+  //copied between threads, and it only depends on t and the sub's attitude, so replays get the same gas and bubbles
+  int effects_tick;
+
+  gas_particles gas;
+  int gas_rate;       //see engine::emit_gas
+  int gas_pass;
+
+  bubble_field bubbles;
+  int bubble_rate;    //per step off the propeller, the hull gets a tenth of that
+  int bubbles_pass;
+
+  static float crank_angle(int t) {return t / 50.0f;}
+
 };
 
 
 // //******************************************************************************
 
-Sub::Sub()
+Sub::Sub(bool capsule_hull) : capsule_hull(capsule_hull)
 {
+    PROFILE_ZONE("Sub::Sub");
 
     //initialize all the vectors
     points.clear();
@@ -191,14 +357,49 @@ Sub::Sub()
     generate_points();
 
 
+    //acceleration structure for ray queries on the CPU
+    std::vector<bvh_range> ranges;
+    ranges.push_back({"hull", hull_start, hull_num});
+    for(size_t i = 0; i < room_start.size(); i++)
+      ranges.push_back({"room " + std::to_string(i+1), room_start[i], room_num[i]});
+    //not the engine - its parts are stored in their own local spaces, all at the origin, and only
+    //get put in place per instance, every frame, in the vertex shader
+
+    auto bvh_start = std::chrono::steady_clock::now();
+    scene_bvh.build(points, ranges);
+    cout << "bvh over " << scene_bvh.get_num_triangles() << " triangles has " << scene_bvh.get_num_nodes() << " nodes, built in "
+         << std::chrono::duration<double>(std::chrono::steady_clock::now() - bvh_start).count() * 1000.0 << " ms" << endl;
+
+    //centers for sorting the draws by distance
+    auto center = [&](int start, int num)
+    {
+      glm::vec3 sum(0.0f);
+      for(int i = start; i < start + num; i++)
+        sum += points[i];
+      return num ? sum / float(num) : sum;
+    };
+
+    hull_center = center(hull_start, hull_num);
+    for(size_t i = 0; i < room_start.size(); i++)
+      room_center.push_back(center(room_start[i], room_num[i]));
+
 
 
 
 
     draw_hull = true;
 
-    for(int i = 0; i < 9; i++)
-      draw_room[i] = true;
+    roll_rate = pitch_rate = yaw_rate = 0.0f;
+    dirty = true;
+    animate = true;
+    render_moving = false;
+
+    draw_room.assign(room_start.size(), true);
+    rooms_changed = true;
+
+    effects_tick = 0;
+    gas_rate = 20;
+    bubble_rate = 40;
 
   //SETTING UP GPU STUFF
 
@@ -206,20 +407,29 @@ Sub::Sub()
     //SHADERS (COMPILE, USE)
 
     cout << " compiling ship shaders" << endl;
-    Shader s("resources/shaders/hull_vert.glsl", "resources/shaders/hull_frag.glsl");
+    {
+      PROFILE_ZONE("Shader compile");
+      Shader s("resources/shaders/hull_vert.glsl", "resources/shaders/hull_frag.glsl");
 
-    sub_shader = s.Program;
+      sub_shader = s.Program;
+    }
 
 
     //VAO
     glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    glstate.bind_vertex_array(vao);
 
     //BUFFER, SEND DATA
     glGenBuffers(1, &buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glstate.bind_buffer(GL_ARRAY_BUFFER, buffer);
 
-    glUseProgram(sub_shader);
+    glGenBuffers(1, &room_commands);
+    num_room_commands = 0;
+
+    glGenVertexArrays(1, &procedural_vao);
+    hull_mode = hull_mesh;
+
+    glstate.use_program(sub_shader);
 
 
   //POPULATE THE ARRAYS
@@ -268,8 +478,8 @@ Sub::Sub()
 
     //UNIFORMS
     yawpitchroll_loc = glGetUniformLocation(sub_shader, "yawpitchroll");
-    yawpitchroll = glm::vec3(0,0,0);
-    glUniform3fv(yawpitchroll_loc, 1, glm::value_ptr(yawpitchroll));
+    render_yawpitchroll = glm::vec3(0,0,0);
+    glUniform3fv(yawpitchroll_loc, 1, glm::value_ptr(render_yawpitchroll));
 
     proj_loc = glGetUniformLocation(sub_shader, "proj");
     glUniformMatrix4fv(proj_loc, 1, GL_TRUE, glm::value_ptr(proj));
@@ -283,9 +493,8 @@ Sub::Sub()
     scale_loc = glGetUniformLocation(sub_shader, "scale");
     glUniform1fv(scale_loc, 1, &scale);
 
-    t = 0;
     t_loc = glGetUniformLocation(sub_shader, "t");
-    glUniform1i(t_loc,t);
+    glUniform1i(t_loc,0);
 
 
 
@@ -313,6 +522,50 @@ Sub::Sub()
 
     glUniform1i(glGetUniformLocation(sub_shader, "type"), 0);
 
+    //shape of the procedural hull - only the tessellation changes after this
+    glUniform3f(glGetUniformLocation(sub_shader, "hull_offset"), JonDefault::xoffset, JonDefault::yoffset, JonDefault::zoffset);
+    glUniform1f(glGetUniformLocation(sub_shader, "hull_radius"), JonDefault::radius);
+    hull_segments_loc = glGetUniformLocation(sub_shader, "hull_segments");
+    hull_segments = 0;
+
+
+    //the ray marched hull gets its own program, since it's doing its own depth
+    cout << " compiling ray marched hull shaders" << endl;
+    {
+      PROFILE_ZONE("Shader compile");
+      Shader s("resources/shaders/hull_sdf_vert.glsl", "resources/shaders/hull_sdf_frag.glsl");
+
+      sdf_shader = s.Program;
+    }
+
+    glstate.use_program(sdf_shader);
+    glUniform3f(glGetUniformLocation(sdf_shader, "hull_offset"), JonDefault::xoffset, JonDefault::yoffset, JonDefault::zoffset);
+    glUniform1f(glGetUniformLocation(sdf_shader, "hull_radius"), JonDefault::radius);
+    glUniform3f(glGetUniformLocation(sdf_shader, "box_extent"), JonDefault::xoffset + JonDefault::radius,
+                JonDefault::yoffset + JonDefault::radius, JonDefault::zoffset + JonDefault::radius);
+    glUniform3fv(glGetUniformLocation(sdf_shader, "eye_position"), 1, glm::value_ptr(eye_position));
+
+    sdf_proj_loc = glGetUniformLocation(sdf_shader, "proj");
+    sdf_view_loc = glGetUniformLocation(sdf_shader, "view");
+    sdf_model_loc = glGetUniformLocation(sdf_shader, "model");
+    sdf_eye_model_loc = glGetUniformLocation(sdf_shader, "eye_model");
+    sdf_light_position_loc = glGetUniformLocation(sdf_shader, "light_position");
+
+    glstate.use_program(sub_shader);
+
+
+    //one timer per draw function - add new passes here, and bracket them in display()
+    hull_pass = timers.add_pass("hull");
+    rooms_pass = timers.add_pass("rooms");
+    engine_pass = timers.add_pass("engine");
+    gas_pass = timers.add_pass("gas");
+    bubbles_pass = timers.add_pass("bubbles");
+
+    gas.init();
+    bubbles.init();
+    bubbles.set_hull(points, hull_start, hull_num);
+    queue.set_timers(&timers);
+
 
 
 
@@ -327,6 +580,27 @@ Sub::Sub()
 
 
     glPointSize(6.0f);
+
+
+    //SIMULATION - every slot starts out holding step zero, so display() has something to read right away
+    sim = sim_prev = initial_state();
+    sim_was_moving = false;
+    sim_ticks = 0;
+    stepped = false;
+
+    for(int i = 0; i < 3; i++)
+    {
+      snapshots.slot(i).prev = snapshots.slot(i).cur = sim;
+      snapshots.slot(i).time = std::chrono::steady_clock::now();
+    }
+
+    running = false;
+    start_simulation();
+}
+
+Sub::~Sub()
+{
+  stop_simulation();
 }
 
 // //******************************************************************************
@@ -341,6 +615,7 @@ Sub::Sub()
 
 void Sub::generate_points()
 {
+  PROFILE_ZONE("Sub::generate_points");
 //GENERATING GEOMETRY
 
   hull_start = points.size();
@@ -457,128 +732,6 @@ void Sub::generate_points()
 
 
 
-  // glm::vec3 acap,bcap;
-  // float r;
-  //
-  // // acap = glm::vec3(0.5, 0, 0);
-  // // bcap = glm::vec3(-0.5, 0,0);
-  // // r = 0.1618;
-  //
-  // acap = glm::vec3( 0.3,0,0);
-  // bcap = glm::vec3(-0.3,0,0);
-  // r = 0.5;
-  //
-  //
-  // int passes = 0;
-  // int count = 0;
-  //
-  //
-  // bool some_not_done = true;
-  //
-  // while(some_not_done)
-  // {
-  //   some_not_done = false;
-  //   count = 0;
-  //   for(auto &x : triangles)
-  //   {
-  //     if(!x.done)
-  //     {
-  //       //shrink each point in, if it's still outside the shape
-  //       float d0,d1,d2;
-  //
-  //       d0 = capsdf(x.points[0],acap,bcap,r);
-  //       d1 = capsdf(x.points[1],acap,bcap,r);
-  //       d2 = capsdf(x.points[2],acap,bcap,r);
-  //
-  //
-  //       if(abs(d0)>0.0001)
-  //       {
-  //         if(d0 > 0)
-  //           x.points[0] *= 0.99999;
-  //
-  //         if(d0 < 0)
-  //           x.points[0] /= 0.5;
-  //       }
-  //
-  //
-  //
-  //       if(abs(d1)>0.0001)
-  //       {
-  //         if(d1 > 0)
-  //           x.points[1] *= 0.99999;
-  //
-  //         if(d1 < 0)
-  //           x.points[1] /= 0.5;
-  //       }
-  //
-  //
-  //
-  //       if(abs(d2)>0.0001)
-  //       {
-  //         if(d2 > 0)
-  //           x.points[2] *= 0.99999;
-  //
-  //         if(d2 < 0)
-  //           x.points[2] /= 0.5;
-  //       }
-  //
-  //       glm::vec3 mid = (x.points[0] + x.points[1] + x.points[2]) / 3.0f;
-  //
-  //       if((abs(capsdf(x.points[0], acap, bcap, r)) < 0.0001) && (abs(capsdf(x.points[1], acap, bcap, r)) < 0.0001) && (abs(capsdf(x.points[2], acap, bcap, r)) < 0.0001))
-  //       {
-  //         x.done = true;
-  //
-  //         // glm::vec3 norm = glm::normalize(glm::cross(x.points[0]-x.points[1], x.points[0]-x.points[2]));
-  //         // if(!planetest(mid, norm, glm::vec3(0,0,0)))
-  //         //    norm = norm * -1.0f;
-  //
-  //         float d = capsdf(mid, acap, bcap, r);
-  //         glm::vec2 e = glm::vec2(0.01, 0);
-  //
-  //         // glm::vec3 norm = glm::normalize(glm::vec3(d,d,d) -
-  //         //   glm::vec3(capsdf(glm::vec3(mid.x-e.x,mid.y-e.y,mid.z-e.y), acap, bcap, r),
-  //         //             capsdf(glm::vec3(mid.x-e.y,mid.y-e.x,mid.z-e.y), acap, bcap, r),
-  //         //             capsdf(glm::vec3(mid.x-e.y,mid.y-e.y,mid.z-e.x), acap, bcap, r)));
-  //         // x.normals[0] = norm;
-  //         // x.normals[1] = norm;
-  //         // x.normals[2] = norm;
-  //
-  //         x.normals[0] = glm::normalize(glm::vec3(d,d,d) -
-  //           glm::vec3(capsdf(glm::vec3(x.points[0].x-e.x,x.points[0].y-e.y,x.points[0].z-e.y), acap, bcap, r),
-  //                     capsdf(glm::vec3(x.points[0].x-e.y,x.points[0].y-e.x,x.points[0].z-e.y), acap, bcap, r),
-  //                     capsdf(glm::vec3(x.points[0].x-e.y,x.points[0].y-e.y,x.points[0].z-e.x), acap, bcap, r)));
-  //
-  //         x.normals[1] = glm::normalize(glm::vec3(d,d,d) -
-  //           glm::vec3(capsdf(glm::vec3(x.points[1].x-e.x,x.points[1].y-e.y,x.points[1].z-e.y), acap, bcap, r),
-  //                     capsdf(glm::vec3(x.points[1].x-e.y,x.points[1].y-e.x,x.points[1].z-e.y), acap, bcap, r),
-  //                     capsdf(glm::vec3(x.points[1].x-e.y,x.points[1].y-e.y,x.points[1].z-e.x), acap, bcap, r)));
-  //
-  //         x.normals[2] = glm::normalize(glm::vec3(d,d,d) -
-  //           glm::vec3(capsdf(glm::vec3(x.points[2].x-e.x,x.points[2].y-e.y,x.points[2].z-e.y), acap, bcap, r),
-  //                     capsdf(glm::vec3(x.points[2].x-e.y,x.points[2].y-e.x,x.points[2].z-e.y), acap, bcap, r),
-  //                     capsdf(glm::vec3(x.points[2].x-e.y,x.points[2].y-e.y,x.points[2].z-e.x), acap, bcap, r)));
-  //
-  //
-  //
-  //
-  //       }
-  //     }
-  //
-  //     if(!x.done)
-  //     {
-  //       some_not_done = true;
-  //       count++;
-  //     }
-  //   }
-  //   passes++;
-  //
-  //   cout << "\rpass number " << passes  << " touched " << count << "                      ";
-  // }
-
-
-
-
-
   float xoffset, yoffset, zoffset, radius;
 
 
@@ -591,6 +744,29 @@ void Sub::generate_points()
   bool panels = true;
 
 
+//CAPSULE - shrink-wraps the subdivided cube onto capsdf instead of building the rounded box, with --capsule-hull
+  if(capsule_hull)
+  {
+    //the segment has to end inside the cube, or the end faces collapse onto it instead of the caps
+    shrink_wrap(glm::vec3(0,0,-0.5f*zoffset), glm::vec3(0,0,0.5f*zoffset), radius+yoffset);
+
+    for(auto x : triangles)
+      for(int i = 0; i < 3; i++)
+      {
+        points.push_back(x.points[i]);
+        texcoords.push_back(x.texcoords[i]);
+        normals.push_back(x.normals[i]);
+        colors.push_back(x.colors[i]);
+      }
+
+    //nothing left for the rounded box to do
+    triangles.clear();
+    panels = false;
+  }
+
+
+
+
 
 
 // //CUBOID
@@ -732,6 +908,7 @@ void Sub::generate_points()
   float rot_inc = twopi/400;
 
   //cylinders +/- x
+  if(!capsule_hull)
   for(float rot = -rot_inc; rot <= 5*twopi; rot += rot_inc)
   {
     float xcur = radius * cos(rot);
@@ -810,6 +987,7 @@ void Sub::generate_points()
 
 
   //cylinders +/- y
+  if(!capsule_hull)
   for(float rot = -rot_inc; rot <= 5*twopi; rot += rot_inc)
   {
     float xcur = radius * cos(rot);
@@ -889,6 +1067,7 @@ void Sub::generate_points()
 
 
   //cylinders +/- z
+  if(!capsule_hull)
   for(float rot = -rot_inc; rot <= 5*twopi; rot += rot_inc)
   {
     float ycur = radius * cos(rot);
@@ -1074,6 +1253,27 @@ void Sub::generate_points()
   hull_num = points.size() - hull_start;
   cout << "hull starts at " << hull_start << " and is " << hull_num << " verticies" << endl;
 
+  hull_lod = 0;
+  num_hull_lods = 1;
+  hull_lod_start[0] = hull_start;
+  hull_lod_num[0] = hull_num;
+  hull_bounding_radius = glm::length(glm::vec3(xoffset, yoffset, zoffset)) + radius;
+
+  //coarser hulls, segments per quarter circle - the capsule doesn't have a coarse version
+  if(!capsule_hull)
+  {
+    int segments[max_hull_lods - 1] = {16, 6, 2};
+    for(int i = 0; i < max_hull_lods - 1; i++)
+    {
+      hull_lod_start[num_hull_lods] = points.size();
+      add_hull_lod(segments[i], radius, glm::vec3(xoffset, yoffset, zoffset));
+      hull_lod_num[num_hull_lods] = points.size() - hull_lod_start[num_hull_lods];
+
+      cout << "hull lod " << num_hull_lods << " is " << hull_lod_num[num_hull_lods] << " verticies" << endl;
+      num_hull_lods++;
+    }
+  }
+
 
 
 
@@ -1111,884 +1311,798 @@ void Sub::generate_points()
   //******************************************************************************
 
 
-  float inc = 0.01f;
+  //the rooms themselves are described in resources/rooms.layout, and built from that by build_rooms()
+  auto rooms_start_time = std::chrono::steady_clock::now();
+  if(load_room_layout(ROOM_LAYOUT_PATH, layout))
+    build_rooms(layout, points, normals, colors, room_start, room_num);
 
+  int rooms_begin = room_start.empty() ? points.size() : room_start[0];
+  cout << "the " << room_start.size() << " rooms collectively have " << points.size() - rooms_begin << " verticies, built in "
+       << std::chrono::duration<double>(std::chrono::steady_clock::now() - rooms_start_time).count() * 1000.0 << " ms" << endl;
 
-  float room1start, room1end;
-  float room2start, room2end;
-  float room3start, room3end;
 
-  float tallroom1start, tallroom1end;
-  float tallroom2start, tallroom2end;
-
-  room1start =  JonDefault::room1start;
-  room1end =  JonDefault::room1end;
+  //THIS IS GOING TO CHANGE - HOWEVER, FOR TIME'S SAKE, THIS IS GOING TO BE FUNCTIONING AS A SCENE CLASS
+//THE SCENE CLASS INSTANTIATES ALL THE OBJECTS WHICH HOLD GEOMETRY - WE'RE INHERENTLY SORT OF SINGLE THREADED HERE, BECAUSE OF THE
+//NATURE OF OPENGL, SO A TREE STRUCTURE MAKES A LOT OF SENSE - SOME KIND OF TRAVERSAL TO PLACE ALL THE THINGS IN THE WORLD
 
-  room2start =  JonDefault::room2start;
-  room2end = JonDefault::room2end;
 
-  room3start = JonDefault::room3start;
-  room3end = JonDefault::room3end;
 
-  tallroom1start =  JonDefault::tallroom1start;
-  tallroom1end =  JonDefault::tallroom1end;
 
-  tallroom2start =  JonDefault::tallroom2start;
-  tallroom2end = JonDefault::tallroom2end;
 
-  float floor1yoffset = JonDefault::floor1yoffset;
-  float floor2yoffset = JonDefault::floor2yoffset;
-  float floor3yoffset = JonDefault::floor3yoffset;
+  // sub_engine.init(points, normals, colors); //I think this might be a good pattern, to pass the vectors by reference, keep one vertex array
 
+  engine_start = points.size();
+  sub_engine.init(points,normals,colors);
+  engine_num = points.size() - engine_start;
 
 
-  //ROOM 1
-  room_start[0] = points.size();
 
-  //first the round part of the room
-  for(float i = 0.0f; i < 3.141592654; i += inc)
-  {
-    //add a 'slat' about the cylinder - the ends are at room1start and room1end on the z axis
-    points.push_back(glm::vec3(radius*cos(i), radius*0.75*sin(i) + floor1yoffset, room1start));
-    points.push_back(glm::vec3(radius*cos(i), radius*0.75*sin(i) + floor1yoffset, room1end));
-    points.push_back(glm::vec3(radius*cos(i+inc), radius*0.75*sin(i+inc) + floor1yoffset, room1end));
 
-    points.push_back(glm::vec3(radius*cos(i+inc), radius*0.75*sin(i+inc) + floor1yoffset, room1start));
-    points.push_back(glm::vec3(radius*cos(i), radius*0.75*sin(i) + floor1yoffset, room1start));
-    points.push_back(glm::vec3(radius*cos(i+inc), radius*0.75*sin(i+inc) + floor1yoffset, room1end));
+}
 
-    for(int j = 0; j < 6; j++)
-    {
-      normals.push_back(glm::vec3(-cos(i),-sin(i),0));
-      colors.push_back(glm::vec4(1,0,0,1));
-    }
+// //******************************************************************************
 
-  }
+void Sub::subd_square(glm::vec3 a, glm::vec2 at, glm::vec3 b, glm::vec2 bt, glm::vec3 c, glm::vec2 ct, glm::vec3 d, glm::vec2 dt, glm::vec3 norm, float clow, float chigh)
+{
+  PROFILE_ZONE("Sub::subd_square");
 
-  //then the bottom, just a plane
-  points.push_back(glm::vec3(radius, floor1yoffset, room1start));
-  points.push_back(glm::vec3(-radius, floor1yoffset, room1start));
-  points.push_back(glm::vec3(radius, floor1yoffset, room1end));
+  float thresh = 0.01;
+  if(glm::distance(a, b) < thresh || glm::distance(a,c) < thresh || glm::distance(a,d) < thresh)
+  {//add points
 
-  points.push_back(glm::vec3(-radius, floor1yoffset, room1start));
-  points.push_back(glm::vec3(-radius, floor1yoffset, room1end));
-  points.push_back(glm::vec3(radius, floor1yoffset, room1end));
 
+    triangle temp1, temp2;
 
+    //initially not done, want to still move these around since they're just at the initial positions.
+    temp1.done = false;
+    temp2.done = false;
 
+    temp1.points[0] = a;
+    temp1.points[1] = b;
+    temp1.points[2] = c;
 
-//walkway
-  points.push_back(glm::vec3(0.2f*radius, floor1yoffset, room1end));
-  points.push_back(glm::vec3(-0.2f*radius, floor1yoffset, room1end));
-  points.push_back(glm::vec3(0.2f*radius, floor1yoffset, room2start));
+    temp2.points[0] = c;
+    temp2.points[1] = b;
+    temp2.points[2] = d;
 
-  points.push_back(glm::vec3(-0.2f*radius, floor1yoffset, room1end));
-  points.push_back(glm::vec3(-0.2f*radius, floor1yoffset, room2start));
-  points.push_back(glm::vec3(0.2f*radius, floor1yoffset, room2start));
 
 
 
+    //random number generation
+    std::random_device rd;
+    std::mt19937 mt(rd());
+    std::uniform_real_distribution<float> dist(clow, chigh);
 
-//walkway
-  points.push_back(glm::vec3(0.2f*radius, floor1yoffset, room2end));
-  points.push_back(glm::vec3(-0.2f*radius, floor1yoffset, room2end));
-  points.push_back(glm::vec3(0.2f*radius, floor1yoffset, room3start));
+    //colors
+    temp1.colors[0] = glm::vec4(dist(mt), dist(mt), 0, 1);
+    temp1.colors[1] = glm::vec4(dist(mt), dist(mt), 0, 1);
+    temp1.colors[2] = glm::vec4(dist(mt), dist(mt), 0, 1);
 
-  points.push_back(glm::vec3(-0.2f*radius, floor1yoffset, room2end));
-  points.push_back(glm::vec3(-0.2f*radius, floor1yoffset, room3start));
-  points.push_back(glm::vec3(0.2f*radius, floor1yoffset, room3start));
+    temp2.colors[0] = glm::vec4(dist(mt), dist(mt), 0, 1);
+    temp2.colors[1] = glm::vec4(dist(mt), dist(mt), 0, 1);
+    temp2.colors[2] = glm::vec4(dist(mt), dist(mt), 0, 1);
 
 
+    //texcoords
 
+    temp1.texcoords[0] = at;
+    temp1.texcoords[1] = bt;
+    temp1.texcoords[2] = ct;
 
-  for(int j = 0; j < 18; j++)
-  {
-    normals.push_back(glm::vec3(0,1,0));
-    colors.push_back(glm::vec4(1,0,0,1));
-  }
+    temp2.texcoords[0] = bt;
+    temp2.texcoords[1] = ct;
+    temp2.texcoords[2] = dt;
 
 
-  //then the end caps
+    //this scheme uses one point at the center - it was for the spaceship but might be useful elsewhere.
+    // glm::vec2 tc = (at + bt + ct + dt)/4.0f;
+    //
+    // temp1.texcoords[0] = tc;
+    // temp1.texcoords[1] = tc;
+    // temp1.texcoords[2] = tc;
+    //
+    // temp2.texcoords[0] = tc;
+    // temp2.texcoords[1] = tc;
+    // temp2.texcoords[2] = tc;
 
-  room_num[0] = points.size() - room_start[0];
 
-  //******************************************************************************
+    //normals
+    temp1.normals[0] = norm;
+    temp1.normals[1] = norm;
+    temp1.normals[2] = norm;
 
-  //ROOM 2
-  room_start[1] = points.size();
-  //GENER8
-  //first the round part of the room
-  for(float i = 0.0f; i < 3.141592654; i += inc)
-  {
-    //add a 'slat' about the cylinder - the ends are at room1start and room1end on the z axis
-    points.push_back(glm::vec3(radius*cos(i), radius*0.75*sin(i) + floor1yoffset, room2start));
-    points.push_back(glm::vec3(radius*cos(i), radius*0.75*sin(i) + floor1yoffset, room2end));
-    points.push_back(glm::vec3(radius*cos(i+inc), radius*0.75*sin(i+inc) + floor1yoffset, room2end));
+    temp2.normals[0] = norm;
+    temp2.normals[1] = norm;
+    temp2.normals[2] = norm;
 
-    points.push_back(glm::vec3(radius*cos(i+inc), radius*0.75*sin(i+inc) + floor1yoffset, room2start));
-    points.push_back(glm::vec3(radius*cos(i), radius*0.75*sin(i) + floor1yoffset, room2start));
-    points.push_back(glm::vec3(radius*cos(i+inc), radius*0.75*sin(i+inc) + floor1yoffset, room2end));
+    triangles.push_back(temp1);
+    triangles.push_back(temp2);
 
-    for(int j = 0; j < 6; j++)
-    {
-      normals.push_back(glm::vec3(-cos(i),-sin(i),0));
-      colors.push_back(glm::vec4(1,0,0,1));
-    }
-  }
 
-  //then the bottom, just a plane
-  points.push_back(glm::vec3(radius, floor1yoffset, room2start));
-  points.push_back(glm::vec3(-radius, floor1yoffset, room2start));
-  points.push_back(glm::vec3(radius, floor1yoffset, room2end));
 
-  points.push_back(glm::vec3(-radius, floor1yoffset, room2start));
-  points.push_back(glm::vec3(-radius, floor1yoffset, room2end));
-  points.push_back(glm::vec3(radius, floor1yoffset, room2end));
 
-  for(int j = 0; j < 6; j++)
-  {
-    normals.push_back(glm::vec3(0,1,0));
-    colors.push_back(glm::vec4(1,0,0,1));
   }
+  else
+  { //recurse
+    glm::vec3 center = (a + b + c + d) / 4.0f;    //center of the square
+    glm::vec2 centert = (at + bt + ct + dt) / 4.0f;
 
-  //then the end caps
-
-  room_num[1] = points.size() - room_start[1];
-
-  //******************************************************************************
-
-  //ROOM 3
-  room_start[2] = points.size();
-  //GENER8
-  //first the round part of the room
-  for(float i = 0.0f; i < 3.141592654; i += inc)
-  {
-    //add a 'slat' about the cylinder - the ends are at room1start and room1end on the z axis
-    points.push_back(glm::vec3(radius*cos(i), radius*0.75*sin(i) + floor1yoffset, room3start));
-    points.push_back(glm::vec3(radius*cos(i), radius*0.75*sin(i) + floor1yoffset, room3end));
-    points.push_back(glm::vec3(radius*cos(i+inc), radius*0.75*sin(i+inc) + floor1yoffset, room3end));
-
-    points.push_back(glm::vec3(radius*cos(i+inc), radius*0.75*sin(i+inc) + floor1yoffset, room3start));
-    points.push_back(glm::vec3(radius*cos(i), radius*0.75*sin(i) + floor1yoffset, room3start));
-    points.push_back(glm::vec3(radius*cos(i+inc), radius*0.75*sin(i+inc) + floor1yoffset, room3end));
+    glm::vec3 bdmidp = (b + d) / 2.0f;            //midpoint between b and d
+    glm::vec2 bdmidpt = (bt + dt) / 2.0f;
 
-    for(int j = 0; j < 6; j++)
-    {
-      normals.push_back(glm::vec3(-cos(i),-sin(i),0));
-      colors.push_back(glm::vec4(1,0,0,1));
-    }
-  }
+    glm::vec3 abmidp = (a + b) / 2.0f;            //midpoint between a and b
+    glm::vec2 abmidpt = (at + bt) / 2.0f;
 
-  //then the bottom, just a plane
-  points.push_back(glm::vec3(radius, floor1yoffset, room3start));
-  points.push_back(glm::vec3(-radius, floor1yoffset, room3start));
-  points.push_back(glm::vec3(radius, floor1yoffset, room3end));
+    glm::vec3 cdmidp = (c + d) / 2.0f;            //midpoint between c and d
+    glm::vec2 cdmidpt = (ct + dt) / 2.0f;
 
-  points.push_back(glm::vec3(-radius, floor1yoffset, room3start));
-  points.push_back(glm::vec3(-radius, floor1yoffset, room3end));
-  points.push_back(glm::vec3(radius, floor1yoffset, room3end));
+    glm::vec3 acmidp = (a + c) / 2.0f;            //midpoint between a and c
+    glm::vec2 acmidpt = (at + ct) / 2.0f;
 
-  for(int j = 0; j < 6; j++)
-  {
-    normals.push_back(glm::vec3(0,1,0));
-    colors.push_back(glm::vec4(1,0,0,1));
+    subd_square(abmidp, abmidpt, b, bt, center, centert, bdmidp, bdmidpt, norm, clow, chigh);
+    subd_square(a, at, abmidp, abmidpt, acmidp, acmidpt, center, centert, norm, clow, chigh);
+    subd_square(center, centert, bdmidp, bdmidpt, cdmidp, cdmidpt, d, dt, norm, clow, chigh);
+    subd_square(acmidp, acmidpt, center, centert, c, ct, cdmidp, cdmidpt, norm, clow, chigh);
   }
+}
 
-  //then the end caps
-
-
-
-// "ladder"
-  points.push_back(glm::vec3(-0.1f*radius, floor1yoffset+0.02, room3end-0.075));
-  points.push_back(glm::vec3(0.1f*radius, floor1yoffset+0.02, room3end-0.075));
-  points.push_back(glm::vec3(0.1f*radius, floor3yoffset, room3end-0.075));
+// //******************************************************************************
 
-  points.push_back(glm::vec3(-0.1f*radius, floor1yoffset+0.02, room3end-0.075));
-  points.push_back(glm::vec3(0.1f*radius, floor3yoffset, room3end-0.075));
-  points.push_back(glm::vec3(-0.1f*radius, floor3yoffset, room3end-0.075));
-  for(int i = 0; i < 6; i++)
-  {
-    normals.push_back(glm::vec3(0,0,1));
-    colors.push_back(glm::vec4(1,0,0,1));
-  }
+  //****************************************************************************
+  //  Function: Sub::shrink_wrap()
+  //
+  //  Purpose:
+  //    Moves every vertex in triangles onto the surface of the capsule given
+  //    by acap, bcap and r. Since capsdf is an exact distance, stepping back
+  //    along its gradient by the distance is a Newton step on the surface, and
+  //    lands on it in one or two iterations - the old version scaled every
+  //    vertex by 0.99999 per pass, and took forever. The gradient at the final
+  //    position is the normal, so no extra SDF evaluations are needed for it.
+  //    The vertices are split across threads.
+  //****************************************************************************
 
+void Sub::shrink_wrap(glm::vec3 acap, glm::vec3 bcap, float r)
+{
+  PROFILE_ZONE("Sub::shrink_wrap");
 
-// "ladder"
-  points.push_back(glm::vec3(-0.1f*radius, floor1yoffset+0.02, room3end-0.074));
-  points.push_back(glm::vec3(0.1f*radius, floor3yoffset, room3end-0.074));
-  points.push_back(glm::vec3(0.1f*radius, floor1yoffset+0.02, room3end-0.074));
+  int n = triangles.size();
+  int num_threads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::thread> workers;
 
-  points.push_back(glm::vec3(-0.1f*radius, floor1yoffset+0.02, room3end-0.074));
-  points.push_back(glm::vec3(-0.1f*radius, floor3yoffset, room3end-0.074));
-  points.push_back(glm::vec3(0.1f*radius, floor3yoffset, room3end-0.074));
-  for(int i = 0; i < 6; i++)
+  for(int w = 0; w < num_threads; w++)
   {
-    normals.push_back(glm::vec3(0,0,-1));
-    colors.push_back(glm::vec4(1,0,0,1));
-  }
+    workers.push_back(std::thread([&, w]()
+    {
+      PROFILE_ZONE("shrink_wrap worker");
+      for(int i = (n * w) / num_threads; i < (n * (w + 1)) / num_threads; i++)
+      {
+        triangle& x = triangles[i];
 
+        for(int j = 0; j < 3; j++)
+        {
+          glm::vec3 p = x.points[j];
+          glm::vec3 g = capsdf_gradient(p, acap, bcap);
 
+          if(g == glm::vec3(0.0f))  //sitting right on the segment, head out along the face
+            g = x.normals[j];
 
+          for(int iteration = 0; iteration < 8; iteration++)
+          {
+            float d = capsdf(p, acap, bcap, r);
+            if(std::abs(d) < 0.0001f)
+              break;
 
+            p -= d * g;
 
+            glm::vec3 next = capsdf_gradient(p, acap, bcap);
+            if(next != glm::vec3(0.0f))
+              g = next;
+          }
 
+          x.points[j] = p;
+          x.normals[j] = g;
+        }
 
+        x.done = true;
+      }
+    }));
+  }
 
+  for(auto& w : workers)
+    w.join();
+}
 
-  room_num[2] = points.size() - room_start[2];
+// //******************************************************************************
 
-  //******************************************************************************
+void Sub::display()
+{
+  PROFILE_ZONE("Sub::display");
 
-  //ROOM 4
-  room_start[3] = points.size();
+  timers.new_frame();
 
+  glstate.bind_vertex_array(vao);
+  glstate.use_program(sub_shader);
 
+  //latest pair of steps from the simulation thread, blended by how far we are past the newer one
+  const frame_snapshot& s = snapshots.read();
+  render_time = s.time;
+  render_moving = s.prev.t != s.cur.t || s.prev.yawpitchroll != s.cur.yawpitchroll;
 
-  points.push_back(glm::vec3(-0.6f*radius, floor2yoffset, room3end));
-  points.push_back(glm::vec3(0.6f*radius, floor2yoffset, room3end));
-  points.push_back(glm::vec3(0.6f*radius, floor2yoffset, tallroom2end+0.07f));
+  float alpha = std::chrono::duration<float>(std::chrono::steady_clock::now() - s.time).count() / float(sim_step);
+  alpha = stepped ? 1.0f : glm::clamp(alpha, 0.0f, 1.0f);   //stepped frames land exactly on a step, so replays match
 
-  points.push_back(glm::vec3(-0.6f*radius, floor2yoffset, room3end));
-  points.push_back(glm::vec3(0.6f*radius, floor2yoffset, tallroom2end+0.07f));
-  points.push_back(glm::vec3(-0.6f*radius, floor2yoffset, tallroom2end+0.07f));
-  for(int i = 0; i < 6; i++)
+  //go the short way around if one of the angles wrapped during the last step
+  glm::vec3 delta = s.cur.yawpitchroll - s.prev.yawpitchroll;
+  for(int i = 0; i < 3; i++)
   {
-    normals.push_back(glm::vec3(0,1,0));
-    colors.push_back(glm::vec4(1,0,0,1));
+    if(delta[i] > 3.14f)
+      delta[i] -= 2*3.14f;
+    else if(delta[i] < -3.14f)
+      delta[i] += 2*3.14f;
   }
+  render_yawpitchroll = s.prev.yawpitchroll + alpha * delta;
+  glUniform3fv(yawpitchroll_loc, 1, glm::value_ptr(render_yawpitchroll));
 
+  light_position = glm::mix(s.prev.light_position, s.cur.light_position, alpha);
+  glUniform3fv(light_position_loc, 1, glm::value_ptr(light_position));
 
+  glUniform1i(t_loc, s.cur.t);
 
+  render_instances = s.cur.engine;
+  if(s.prev.engine.size() == render_instances.size())
+    for(size_t i = 0; i < render_instances.size(); i++)
+    {
+      render_instances[i].angle = glm::mix(s.prev.engine[i].angle, s.cur.engine[i].angle, alpha);
+      render_instances[i].offset = glm::mix(s.prev.engine[i].offset, s.cur.engine[i].offset, alpha);
+    }
 
 
 
 
+  //view is sent untransposed, so this is what the shader sees
+  render_eye = glm::vec3(glm::inverse(view * get_model())[3]);
 
+  queue.begin_frame();
 
+  draw_hull_func();
+  draw_rooms_func();
 
+  //draw_decor_func();
 
-  room_num[3] = points.size() - room_start[3];
-
-
+  draw_engine_func();
 
+  queue.flush();
 
+  step_effects(s.cur.t);
+  draw_gas_func();
+  draw_bubbles_func();
 
 
 
 
+  //draw_accoutremont_func();
+    //the doors will have windows, which might require alpha
 
-  //******************************************************************************
-  //ROOM 5
-  room_start[4] = points.size();
-  //GENER8
+  dirty = false;
+}
 
+// //******************************************************************************
 
-  points.push_back(glm::vec3(0.3f*radius, floor2yoffset, tallroom1end));
-  points.push_back(glm::vec3(-0.3f*radius, floor2yoffset, tallroom1end));
-  points.push_back(glm::vec3(0.3f*radius, floor2yoffset, tallroom2end+0.07f));
+bool Sub::needs_redraw()
+{
+  if(dirty || snapshots.fresh())
+    return true;
 
-  points.push_back(glm::vec3(-0.3f*radius, floor2yoffset, tallroom1end));
-  points.push_back(glm::vec3(-0.3f*radius, floor2yoffset, tallroom2end+0.07f));
-  points.push_back(glm::vec3(0.3f*radius, floor2yoffset, tallroom2end+0.07f));
+  //no new step yet, but the blend toward the last one isn't finished
+  return render_moving && std::chrono::duration<double>(std::chrono::steady_clock::now() - render_time).count() < sim_step;
+}
 
-  for(int j = 0; j < 6; j++)
-  {
-    normals.push_back(glm::vec3(0,1,0));
-    colors.push_back(glm::vec4(1,0,0,1));
-  }
-
-
-  room_num[4] = points.size() - room_start[4];
-
-
-  //******************************************************************************
-
-
-  //ROOM 6
-  room_start[5] = points.size();
-  //GENER8
-
-  points.push_back(glm::vec3(0.75f*radius, floor2yoffset, tallroom1start-0.75*(tallroom1start-tallroom1end)));
-  points.push_back(glm::vec3(-0.75f*radius, floor2yoffset, tallroom1start-0.75*(tallroom1start-tallroom1end)));
-  points.push_back(glm::vec3(0.75f*radius, floor2yoffset, tallroom1end));
-
-  points.push_back(glm::vec3(-0.75f*radius, floor2yoffset, tallroom1start-0.75*(tallroom1start-tallroom1end)));
-  points.push_back(glm::vec3(-0.75f*radius, floor2yoffset, tallroom1end));
-  points.push_back(glm::vec3(0.75f*radius, floor2yoffset, tallroom1end));
-
-  for(int j = 0; j < 6; j++)
+void Sub::draw_hull_func()
+{
+  PROFILE_ZONE("draw hull");
+  if(draw_hull)
   {
-    normals.push_back(glm::vec3(0,1,0));
-    colors.push_back(glm::vec4(1,0,0,1));
-  }
-
-  room_num[5] = points.size() - room_start[5];
-
-
-
-
-
-
-
-
-  //******************************************************************************
-
-  //ROOM 7
-  room_start[6] = points.size();
-  //GENER8
+    //the hull is pretty simple
+    draw_packet p = base_packet(0, hull_pass);
 
+    switch(hull_mode)
+    {
+      case hull_mesh:
+        hull_lod = select_hull_lod();
+        p.first = hull_lod_start[hull_lod];
+        p.count = hull_lod_num[hull_lod];
+        break;
+
+      case hull_procedural:
+      {//tessellation follows the size on screen directly, there's nothing to upload when it changes
+        int segments = procedural_segments();
+        if(segments != hull_segments)
+        {
+          glstate.use_program(sub_shader);
+          glUniform1i(hull_segments_loc, segments);
+          hull_segments = segments;
+        }
+
+        p.type = 3;
+        p.vao = procedural_vao;
+        p.first = 0;
+        p.count = 6 * (8 * segments * segments + 12 * segments + 6);
+        break;
+      }
 
-  points.push_back(glm::vec3(-0.6f*radius, floor3yoffset, room3end));
-  points.push_back(glm::vec3(0.6f*radius, floor3yoffset, room3end));
-  points.push_back(glm::vec3(0.6f*radius, floor3yoffset, tallroom2end+0.07f));
+      case hull_raymarched:
+        glstate.use_program(sdf_shader);
+        glUniformMatrix4fv(sdf_model_loc, 1, GL_FALSE, glm::value_ptr(get_model()));
+        glUniform3fv(sdf_eye_model_loc, 1, glm::value_ptr(render_eye));
+        glUniform3fv(sdf_light_position_loc, 1, glm::value_ptr(light_position));
+
+        p.program = sdf_shader;
+        p.vao = procedural_vao;
+        p.first = 0;
+        p.count = 36;   //the bounding box
+        break;
+    }
 
-  points.push_back(glm::vec3(-0.6f*radius, floor3yoffset, room3end));
-  points.push_back(glm::vec3(0.6f*radius, floor3yoffset, tallroom2end+0.07f));
-  points.push_back(glm::vec3(-0.6f*radius, floor3yoffset, tallroom2end+0.07f));
-  for(int i = 0; i < 6; i++)
-  {
-    normals.push_back(glm::vec3(0,1,0));
-    colors.push_back(glm::vec4(1,0,0,1));
+    queue.submit(p, pass_opaque, glm::distance(render_eye, hull_center));
   }
+}
 
+int Sub::procedural_segments()
+{
+  return glm::clamp(int(hull_screen_radius() / 20.0f), 2, 48);
+}
 
+// //******************************************************************************
 
+void Sub::benchmark_hull(int draws)
+{
+  cout << "hull benchmark, " << draws << " draws per mode:" << endl;
 
-  room_num[6] = points.size() - room_start[6];
-
-  //******************************************************************************
-
-  //ROOM 8
-  room_start[7] = points.size();
-  //GENER8
-
-
-
-  // //TEMPORARY
-  //   points.push_back(glm::vec3(radius, floor3yoffset, tallroom1start));
-  //   points.push_back(glm::vec3(-radius, floor3yoffset, tallroom1start));
-  //   points.push_back(glm::vec3(radius, floor3yoffset, tallroom1end));
-  //
-  //   points.push_back(glm::vec3(-radius, floor3yoffset, tallroom1start));
-  //   points.push_back(glm::vec3(-radius, floor3yoffset, tallroom1end));
-  //   points.push_back(glm::vec3(radius, floor3yoffset, tallroom1end));
-  //
-  //   for(int j = 0; j < 6; j++)
-  //     normals.push_back(glm::vec3(0,1,0));
-  // //TEMPORARY
-
-
-
-
-
-
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius+0.2, tallroom1start));
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius+0.2, tallroom1start));
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius+0.2, tallroom1end));
-
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius+0.2, tallroom1start));
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius+0.2, tallroom1end));
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius+0.2, tallroom1end));
+  GLuint query;
+  glGenQueries(1, &query);
 
+  //every draw shades every fragment it covers - otherwise the mesh paths get early z rejection after
+  //the first draw, and the ray marched path (which writes gl_FragDepth) doesn't
+  glstate.depth_func(GL_ALWAYS);
 
-  for(int i = 0; i < 6; i++)
+  for(int mode = 0; mode < num_hull_modes; mode++)
   {
-    normals.push_back(glm::vec3(0,-1,0));
-    colors.push_back(glm::vec4(1,0,0,1));
-
-  }
-
+    int first = 0, count = 0;
+    switch(mode)
+    {
+      case hull_mesh:
+        glstate.use_program(sub_shader);
+        glstate.bind_vertex_array(vao);
+        glUniform1i(glGetUniformLocation(sub_shader, "type"), 0);
+        first = hull_lod_start[0];
+        count = hull_lod_num[0];
+        break;
+
+      case hull_procedural:
+        glstate.use_program(sub_shader);
+        glstate.bind_vertex_array(procedural_vao);
+        glUniform1i(glGetUniformLocation(sub_shader, "type"), 3);
+        hull_segments = procedural_segments();
+        glUniform1i(hull_segments_loc, hull_segments);
+        count = 6 * (8 * hull_segments * hull_segments + 12 * hull_segments + 6);
+        break;
+
+      case hull_raymarched:
+        glstate.use_program(sdf_shader);
+        glstate.bind_vertex_array(procedural_vao);
+        glUniformMatrix4fv(sdf_model_loc, 1, GL_FALSE, glm::value_ptr(get_model()));
+        glUniform3fv(sdf_eye_model_loc, 1, glm::value_ptr(render_eye));
+        glUniform3fv(sdf_light_position_loc, 1, glm::value_ptr(light_position));
+        count = 36;
+        break;
+    }
 
+    glDrawArrays(GL_TRIANGLES, first, count);   //warm up
+    glFinish();
 
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    for(int i = 0; i < draws; i++)
+      glDrawArrays(GL_TRIANGLES, first, count);
+    glEndQuery(GL_TIME_ELAPSED);
 
+    GLuint64 ns = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
 
+    const char* names[num_hull_modes] = {"mesh (full detail)", "procedural", "ray marched"};
+    cout << "  " << names[mode] << ": " << count << " verticies, " << (ns / 1000000.0) / draws << " ms per draw" << endl;
+  }
 
+  glstate.depth_func(GL_LESS);
+  glDeleteQueries(1, &query);
 
+  dirty = true;   //the back buffer is full of hulls
+}
 
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius+0.2, tallroom1start));
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius, tallroom1start));
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius, tallroom1end));
+// //******************************************************************************
 
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius+0.2, tallroom1start));
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius, tallroom1end));
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius+0.2, tallroom1end));
+float Sub::hull_screen_radius()
+{
+  //pixel radius on screen of the hull's bounding sphere - the eye is in model space, so scale cancels out
+  float distance = glm::length(render_eye);
+  if(distance <= hull_bounding_radius)
+    return 1e6f;
 
+  return (hull_bounding_radius / (distance - hull_bounding_radius)) * proj[1][1] * 0.5f * glutGet(GLUT_WINDOW_HEIGHT);
+}
 
+int Sub::select_hull_lod()
+{
+  float pixels = hull_screen_radius();
 
+  //boundary between level i and level i+1, in pixels - has to get past it by the hysteresis margin
+  //to switch, so it doesn't flicker back and forth when sitting right on one
+  const float threshold[max_hull_lods - 1] = {500.0f, 160.0f, 50.0f};
+  const float hysteresis = 0.15f;
 
+  int level = std::min(hull_lod, num_hull_lods - 1);
+  while(level > 0 && pixels > threshold[level - 1] * (1.0f + hysteresis))
+    level--;
+  while(level < num_hull_lods - 1 && pixels < threshold[level] * (1.0f - hysteresis))
+    level++;
 
+  return level;
+}
 
-  for(int i = 0; i < 6; i++)
-  {
-    normals.push_back(glm::vec3(-1,0,0));
-    colors.push_back(glm::vec4(1,0,0,1));
-  }
+// //******************************************************************************
 
+void Sub::add_hull_lod(int segments, float radius, glm::vec3 offset)
+{
+  //same rounded box as the full detail hull - spherical corners, cylindrical edges, flat panels,
+  //but with a set number of segments per quarter circle instead of the fine fixed tessellation
+  float quarter = JonDefault::twopi / 4.0f;
+  float step = quarter / segments;
 
-  float temp;
-  for(float i = 0.0f; i > -3.141592654/2; i -= inc)
+  //keeps the winding counterclockwise from outside, the fragment shader uses gl_FrontFacing
+  auto add_triangle = [&](glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 na, glm::vec3 nb, glm::vec3 nc)
   {
-    //add a 'slat' about the cylinder - the ends are at room1start and room1end on the z axis
-    points.push_back(glm::vec3(radius*0.25*cos(i) + 0.75*radius, radius*0.25*sin(i) + floor3yoffset+0.25*radius, tallroom1start));
-    points.push_back(glm::vec3(radius*0.25*cos(i) + 0.75*radius, radius*0.25*sin(i) + floor3yoffset+0.25*radius, tallroom1end));
-    points.push_back(glm::vec3(radius*0.25*cos(i+inc) + 0.75*radius, radius*0.25*sin(i+inc) + floor3yoffset+0.25*radius, tallroom1end));
-
-    points.push_back(glm::vec3(radius*0.25*cos(i+inc) + 0.75*radius, radius*0.25*sin(i+inc) + floor3yoffset+0.25*radius, tallroom1start));
-    points.push_back(glm::vec3(radius*0.25*cos(i) + 0.75*radius, radius*0.25*sin(i) + floor3yoffset+0.25*radius, tallroom1start));
-    points.push_back(glm::vec3(radius*0.25*cos(i+inc) + 0.75*radius, radius*0.25*sin(i+inc) + floor3yoffset+0.25*radius, tallroom1end));
-
-    for(int j = 0; j < 6; j++)
+    if(glm::dot(glm::cross(b - a, c - a), na + nb + nc) < 0.0f)
     {
-      normals.push_back(glm::vec3(-cos(i),-sin(i),0));
-      colors.push_back(glm::vec4(1,0,0,1));
+      std::swap(b, c);
+      std::swap(nb, nc);
     }
 
-    temp = i;
-  }
-
-  // points.push_back(glm::vec3());
-
-
-  points.push_back(glm::vec3(radius*0.25*cos(temp) + 0.75*radius, radius*0.25*sin(temp) + floor3yoffset+0.25*radius, tallroom1start));
-  points.push_back(glm::vec3(radius*0.25*cos(temp) - 0.75*radius, radius*0.25*sin(temp) + floor3yoffset+0.25*radius, tallroom1start));
-  points.push_back(glm::vec3(radius*0.25*cos(temp) + 0.75*radius, radius*0.25*sin(temp) + floor3yoffset+0.25*radius, tallroom1end));
-
-  points.push_back(glm::vec3(radius*0.25*cos(temp) + 0.75*radius, radius*0.25*sin(temp) + floor3yoffset+0.25*radius, tallroom1end));
-  points.push_back(glm::vec3(radius*0.25*cos(temp) - 0.75*radius, radius*0.25*sin(temp) + floor3yoffset+0.25*radius, tallroom1start));
-  points.push_back(glm::vec3(radius*0.25*cos(temp) - 0.75*radius, radius*0.25*sin(temp) + floor3yoffset+0.25*radius, tallroom1end));
-
-
-
-  for(int j = 0; j < 6; j++)
-  {
-    normals.push_back(glm::vec3(-cos(temp),-sin(temp),0));
-    colors.push_back(glm::vec4(1,0,0,1));
-  }
+    points.push_back(a);  normals.push_back(na);
+    points.push_back(b);  normals.push_back(nb);
+    points.push_back(c);  normals.push_back(nc);
 
+    for(int i = 0; i < 3; i++)
+    {
+      colors.push_back(glm::vec4(0,0,0,1));
+      texcoords.push_back(glm::vec2(0,0));
+    }
+  };
 
+  auto add_quad = [&](glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 d, glm::vec3 na, glm::vec3 nb, glm::vec3 nc, glm::vec3 nd)
+  {//a b c d going around
+    add_triangle(a, b, c, na, nb, nc);
+    add_triangle(a, c, d, na, nc, nd);
+  };
 
-  for(float i = temp; i > -3.141592654; i-=inc)
+  for(int sx = -1; sx <= 1; sx += 2)
+  for(int sy = -1; sy <= 1; sy += 2)
+  for(int sz = -1; sz <= 1; sz += 2)
   {
-    points.push_back(glm::vec3(radius*0.25*cos(i) - 0.75*radius, radius*0.25*sin(i) + floor3yoffset+0.25*radius, tallroom1start));
-    points.push_back(glm::vec3(radius*0.25*cos(i) - 0.75*radius, radius*0.25*sin(i) + floor3yoffset+0.25*radius, tallroom1end));
-    points.push_back(glm::vec3(radius*0.25*cos(i+inc) - 0.75*radius, radius*0.25*sin(i+inc) + floor3yoffset+0.25*radius, tallroom1end));
-
-    points.push_back(glm::vec3(radius*0.25*cos(i+inc) - 0.75*radius, radius*0.25*sin(i+inc) + floor3yoffset+0.25*radius, tallroom1start));
-    points.push_back(glm::vec3(radius*0.25*cos(i) - 0.75*radius, radius*0.25*sin(i) + floor3yoffset+0.25*radius, tallroom1start));
-    points.push_back(glm::vec3(radius*0.25*cos(i+inc) - 0.75*radius, radius*0.25*sin(i+inc) + floor3yoffset+0.25*radius, tallroom1end));
+    glm::vec3 sign = glm::vec3(sx, sy, sz);
+    glm::vec3 corner = sign * offset;
 
-    for(int j = 0; j < 6; j++)
+    //corner - one octant of a sphere, polar angle from the y axis
+    auto dir = [&](int i, int j)
     {
-      normals.push_back(glm::vec3(-cos(i),-sin(i),0));
-      colors.push_back(glm::vec4(1,0,0,1));
-    }
+      float polar = i * step, around = j * step;
+      return sign * glm::vec3(sin(polar) * cos(around), cos(polar), sin(polar) * sin(around));
+    };
 
+    for(int i = 0; i < segments; i++)
+      for(int j = 0; j < segments; j++)
+      {
+        glm::vec3 n00 = dir(i, j), n10 = dir(i+1, j), n11 = dir(i+1, j+1), n01 = dir(i, j+1);
+        add_quad(corner + radius * n00, corner + radius * n10, corner + radius * n11, corner + radius * n01, n00, n10, n11, n01);
+      }
   }
 
-
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius+0.2, tallroom1start));
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius, tallroom1end));
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius, tallroom1start));
-
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius+0.2, tallroom1start));
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius+0.2, tallroom1end));
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius, tallroom1end));
-
-
-  for(int i = 0; i < 6; i++)
+  //edges - a quarter cylinder between each pair of neighboring corners, 4 running along each axis
+  for(int axis = 0; axis < 3; axis++)
   {
-    normals.push_back(glm::vec3(1,0,0));
-    colors.push_back(glm::vec4(1,0,0,1));
-  }
-
+    int u = (axis + 1) % 3, v = (axis + 2) % 3;   //the two directions the arc sweeps through
 
-
-
-  //walkway
-    points.push_back(glm::vec3(0.3f*radius, floor3yoffset, tallroom2start));
-    points.push_back(glm::vec3(0.3f*radius, floor3yoffset, tallroom1end));
-    points.push_back(glm::vec3(-0.3f*radius, floor3yoffset, tallroom2start));
-
-    points.push_back(glm::vec3(-0.3f*radius, floor3yoffset, tallroom2start));
-    points.push_back(glm::vec3(0.3f*radius, floor3yoffset, tallroom1end));
-    points.push_back(glm::vec3(-0.3f*radius, floor3yoffset, tallroom1end));
-    for(int i = 0; i < 6; i++)
+    for(int su = -1; su <= 1; su += 2)
+    for(int sv = -1; sv <= 1; sv += 2)
     {
-      normals.push_back(glm::vec3(0,1,0));
-      colors.push_back(glm::vec4(1,0,0,1));
-    }
+      glm::vec3 low(0.0f), high(0.0f);
+      low[axis] = -offset[axis];
+      high[axis] = offset[axis];
+      low[u] = high[u] = su * offset[u];
+      low[v] = high[v] = sv * offset[v];
 
+      for(int i = 0; i < segments; i++)
+      {
+        glm::vec3 n0(0.0f), n1(0.0f);
+        n0[u] = su * cos(i * step);       n0[v] = sv * sin(i * step);
+        n1[u] = su * cos((i+1) * step);   n1[v] = sv * sin((i+1) * step);
 
-
-
-
-  //walkway
-    points.push_back(glm::vec3(0.3f*radius, floor3yoffset, tallroom2end));
-    points.push_back(glm::vec3(-0.3f*radius, floor3yoffset, tallroom2end));
-    points.push_back(glm::vec3(0.3f*radius, floor3yoffset, tallroom2end+0.07f));
-
-    points.push_back(glm::vec3(-0.3f*radius, floor3yoffset, tallroom2end));
-    points.push_back(glm::vec3(-0.3f*radius, floor3yoffset, tallroom2end+0.07f));
-    points.push_back(glm::vec3(0.3f*radius, floor3yoffset, tallroom2end+0.07f));
-    for(int i = 0; i < 6; i++)
-    {
-      normals.push_back(glm::vec3(0,1,0));
-      colors.push_back(glm::vec4(1,0,0,1));
+        add_quad(low + radius * n0, high + radius * n0, high + radius * n1, low + radius * n1, n0, n0, n1, n1);
+      }
     }
-
-
-
-
-
-
-
-
-
-  room_num[7] = points.size() - room_start[7];
-
-  //******************************************************************************
-
-  //ROOM 9
-  room_start[8] = points.size();
-  //GENER8
-
-
-
-  // points.push_back(glm::vec3(radius, floor3yoffset, tallroom2start));
-  // points.push_back(glm::vec3(-radius, floor3yoffset, tallroom2start));
-  // points.push_back(glm::vec3(radius, floor3yoffset, tallroom2end));
-  //
-  // points.push_back(glm::vec3(-radius, floor3yoffset, tallroom2start));
-  // points.push_back(glm::vec3(-radius, floor3yoffset, tallroom2end));
-  // points.push_back(glm::vec3(radius, floor3yoffset, tallroom2end));
-  //
-  // for(int j = 0; j < 6; j++)
-  //   normals.push_back(glm::vec3(0,1,0));
-
-
-// #HEADING
-
-
-
-
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius+0.2, tallroom2start));
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius+0.2, tallroom2start));
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius+0.2, tallroom2end));
-
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius+0.2, tallroom2start));
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius+0.2, tallroom2end));
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius+0.2, tallroom2end));
-
-
-  for(int i = 0; i < 6; i++)
-  {
-    normals.push_back(glm::vec3(0,-1,0));
-    colors.push_back(glm::vec4(1,0,0,1));
   }
 
-
-
-
-
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius+0.2, tallroom2start));
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius, tallroom2start));
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius, tallroom2end));
-
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius+0.2, tallroom2start));
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius, tallroom2end));
-  points.push_back(glm::vec3(radius, floor3yoffset+0.25*radius+0.2, tallroom2end));
-
-
-  for(int i = 0; i < 6; i++)
+  //panels - one quad per face
+  for(int axis = 0; axis < 3; axis++)
   {
-    normals.push_back(glm::vec3(-1,0,0));
-    colors.push_back(glm::vec4(1,0,0,1));
-  }
-
+    int u = (axis + 1) % 3, v = (axis + 2) % 3;
 
-  for(float i = 0.0f; i > -3.141592654/2; i -= inc)
-  {
-    //add a 'slat' about the cylinder - the ends are at room1start and room1end on the z axis
-    points.push_back(glm::vec3(radius*0.25*cos(i) + 0.75*radius, radius*0.25*sin(i) + floor3yoffset+0.25*radius, tallroom2start));
-    points.push_back(glm::vec3(radius*0.25*cos(i) + 0.75*radius, radius*0.25*sin(i) + floor3yoffset+0.25*radius, tallroom2end));
-    points.push_back(glm::vec3(radius*0.25*cos(i+inc) + 0.75*radius, radius*0.25*sin(i+inc) + floor3yoffset+0.25*radius, tallroom2end));
+    for(int s = -1; s <= 1; s += 2)
+    {
+      glm::vec3 n(0.0f);
+      n[axis] = s;
 
-    points.push_back(glm::vec3(radius*0.25*cos(i+inc) + 0.75*radius, radius*0.25*sin(i+inc) + floor3yoffset+0.25*radius, tallroom2start));
-    points.push_back(glm::vec3(radius*0.25*cos(i) + 0.75*radius, radius*0.25*sin(i) + floor3yoffset+0.25*radius, tallroom2start));
-    points.push_back(glm::vec3(radius*0.25*cos(i+inc) + 0.75*radius, radius*0.25*sin(i+inc) + floor3yoffset+0.25*radius, tallroom2end));
+      glm::vec3 a, b, c, d;
+      a[axis] = b[axis] = c[axis] = d[axis] = s * (offset[axis] + radius);
+      a[u] = -offset[u];  a[v] = -offset[v];
+      b[u] =  offset[u];  b[v] = -offset[v];
+      c[u] =  offset[u];  c[v] =  offset[v];
+      d[u] = -offset[u];  d[v] =  offset[v];
 
-    for(int j = 0; j < 6; j++)
-    {
-      normals.push_back(glm::vec3(-cos(i),-sin(i),0));
-      colors.push_back(glm::vec4(1,0,0,1));
+      add_quad(a, b, c, d, n, n, n, n);
     }
-
-    temp = i;
   }
+}
 
-  // points.push_back(glm::vec3());
-
+// //******************************************************************************
 
-  points.push_back(glm::vec3(radius*0.25*cos(temp) + 0.75*radius, radius*0.25*sin(temp) + floor3yoffset+0.25*radius, tallroom2start));
-  points.push_back(glm::vec3(radius*0.25*cos(temp) - 0.75*radius, radius*0.25*sin(temp) + floor3yoffset+0.25*radius, tallroom2start));
-  points.push_back(glm::vec3(radius*0.25*cos(temp) + 0.75*radius, radius*0.25*sin(temp) + floor3yoffset+0.25*radius, tallroom2end));
+void Sub::draw_rooms_func()
+{
+  PROFILE_ZONE("draw rooms");
 
-  points.push_back(glm::vec3(radius*0.25*cos(temp) + 0.75*radius, radius*0.25*sin(temp) + floor3yoffset+0.25*radius, tallroom2end));
-  points.push_back(glm::vec3(radius*0.25*cos(temp) - 0.75*radius, radius*0.25*sin(temp) + floor3yoffset+0.25*radius, tallroom2start));
-  points.push_back(glm::vec3(radius*0.25*cos(temp) - 0.75*radius, radius*0.25*sin(temp) + floor3yoffset+0.25*radius, tallroom2end));
+  //set up lights, on a per-room basis - perhaps pass in the neighboring lights, so as to have light spillover
 
+  //swap textures here, probably a switch statement
 
+  // glUseProgram(room_shader);  //they all use the same shader, using the per-vertex normals, texcoords,
+                                //positions (colors ignored) - and reference the same texture UNITS
+                                // - not the same textures, but as far as the shader is concerned, the
+                                //behavior is identical and it doesn't need to know anything about it
 
-  for(int j = 0; j < 6; j++)
-  {
-    normals.push_back(glm::vec3(-cos(temp),-sin(temp),0));
-    colors.push_back(glm::vec4(1,0,0,1));
-  }
+                                //we'll follow up on this, I asked on /r/opengl
 
+  if(rooms_changed)
+    build_room_commands();
 
+  if(num_room_commands == 0)
+    return;
 
-  for(float i = temp; i > -3.141592654; i-=inc)
-  {
-    points.push_back(glm::vec3(radius*0.25*cos(i) - 0.75*radius, radius*0.25*sin(i) + floor3yoffset+0.25*radius, tallroom2start));
-    points.push_back(glm::vec3(radius*0.25*cos(i) - 0.75*radius, radius*0.25*sin(i) + floor3yoffset+0.25*radius, tallroom2end));
-    points.push_back(glm::vec3(radius*0.25*cos(i+inc) - 0.75*radius, radius*0.25*sin(i+inc) + floor3yoffset+0.25*radius, tallroom2end));
+  draw_packet p = base_packet(1, rooms_pass);
+  p.indirect = room_commands;
+  p.draw_count = num_room_commands;
+  queue.submit(p, pass_opaque, glm::distance(render_eye, rooms_center));
+}
 
-    points.push_back(glm::vec3(radius*0.25*cos(i+inc) - 0.75*radius, radius*0.25*sin(i+inc) + floor3yoffset+0.25*radius, tallroom2start));
-    points.push_back(glm::vec3(radius*0.25*cos(i) - 0.75*radius, radius*0.25*sin(i) + floor3yoffset+0.25*radius, tallroom2start));
-    points.push_back(glm::vec3(radius*0.25*cos(i+inc) - 0.75*radius, radius*0.25*sin(i+inc) + floor3yoffset+0.25*radius, tallroom2end));
+void Sub::build_room_commands()
+{
+  std::vector<draw_arrays_command> commands;
+  glm::vec3 sum(0.0f);
+  int enabled = 0;
 
-    for(int j = 0; j < 6; j++)
+  for(size_t i = 0; i < room_start.size(); i++)
+    if(draw_room[i] && room_num[i] > 0)
     {
-      normals.push_back(glm::vec3(-cos(i),-sin(i),0));
-      colors.push_back(glm::vec4(1,0,0,1));
-    }
-
-  }
-
-
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius+0.2, tallroom2start));
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius, tallroom2end));
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius, tallroom2start));
+      sum += room_center[i];
+      enabled++;
 
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius+0.2, tallroom2start));
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius+0.2, tallroom2end));
-  points.push_back(glm::vec3(-radius, floor3yoffset+0.25*radius, tallroom2end));
+      //rooms that sit next to each other in the buffer can share a command
+      if(!commands.empty() && commands.back().first + commands.back().count == (GLuint)room_start[i])
+        commands.back().count += room_num[i];
+      else
+        commands.push_back({(GLuint)room_num[i], 1, (GLuint)room_start[i], 0});
+    }
 
+  num_room_commands = commands.size();
+  rooms_center = enabled ? sum / float(enabled) : sum;
 
-  for(int i = 0; i < 6; i++)
+  if(num_room_commands)
   {
-    normals.push_back(glm::vec3(1,0,0));
-    colors.push_back(glm::vec4(1,0,0,1));
+    glstate.bind_buffer(GL_DRAW_INDIRECT_BUFFER, room_commands);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(draw_arrays_command), &commands[0], GL_STATIC_DRAW);
   }
 
+  rooms_changed = false;
+}
 
+draw_packet Sub::base_packet(int type, int timer)
+{
+  draw_packet p;
+  p.program = sub_shader;
+  p.vao = vao;
+  p.type = type;
+  p.mode = GL_TRIANGLES;
+  p.first = p.count = 0;
+  p.transforms = nullptr;
+  p.timer = timer;
+  p.indirect = 0;
+  p.draw_count = 0;
+  return p;
+}
 
-  room_num[8] = points.size() - room_start[8];
-
-
-  cout << "the rooms collectively have " << points.size() - room_start[0] << " verticies" << endl;
-
-
-  //THIS IS GOING TO CHANGE - HOWEVER, FOR TIME'S SAKE, THIS IS GOING TO BE FUNCTIONING AS A SCENE CLASS
-//THE SCENE CLASS INSTANTIATES ALL THE OBJECTS WHICH HOLD GEOMETRY - WE'RE INHERENTLY SORT OF SINGLE THREADED HERE, BECAUSE OF THE
-//NATURE OF OPENGL, SO A TREE STRUCTURE MAKES A LOT OF SENSE - SOME KIND OF TRAVERSAL TO PLACE ALL THE THINGS IN THE WORLD
 
+// //******************************************************************************
 
+void Sub::draw_engine_func()
+{
+  PROFILE_ZONE("draw engine");
+  sub_engine.submit(queue, render_instances, base_packet(2, engine_pass), render_eye);
+}
 
+void Sub::step_effects(int t)
+{
+  PROFILE_ZONE("Sub::step_effects");
 
+  if(t < effects_tick)  //went back to the start
+  {
+    gas.clear();
+    bubbles.clear();
+    effects_tick = 0;
+  }
 
-  // sub_engine.init(points, normals, colors); //I think this might be a good pattern, to pass the vectors by reference, keep one vertex array
+  //a long way behind (the first frame after a hitch) isn't worth catching all the way up on
+  const int max_steps = 30;
+  if(t - effects_tick > max_steps)
+    effects_tick = t - max_steps;
 
-  sub_engine.init(points,normals,colors);
+  //bubbles rise whichever way is up outside the sub
+  glm::vec3 up = glm::normalize(glm::vec3(glm::inverse(get_model()) * glm::vec4(0.0f, 1.0f, 0.0f, 0.0f)));
 
+  for(; effects_tick < t; effects_tick++)
+  {
+    sub_engine.emit_gas(crank_angle(effects_tick + 1), gas_rate, gas);
+    gas.step(sim_step);
 
+    bubbles.emit_propeller(sub_engine.propeller_hub(), sub_engine.propeller_radius(), bubble_rate);
+    bubbles.emit_hull(bubble_rate / 10);
+    bubbles.step(sim_step, up);
+  }
+}
 
+void Sub::draw_gas_func()
+{
+  PROFILE_ZONE("draw gas");
+  timers.begin(gas_pass);
+  gas.display(proj, view, get_model());
+  timers.end(gas_pass);
+}
 
+void Sub::draw_bubbles_func()
+{
+  PROFILE_ZONE("draw bubbles");
+  timers.begin(bubbles_pass);
+  bubbles.display(proj, view, get_model());
+  timers.end(bubbles_pass);
 }
 
 // //******************************************************************************
 
-void Sub::subd_square(glm::vec3 a, glm::vec2 at, glm::vec3 b, glm::vec2 bt, glm::vec3 c, glm::vec2 ct, glm::vec3 d, glm::vec2 dt, glm::vec3 norm, float clow, float chigh)
+void Sub::simulation_loop()
 {
+  profiler::instance().name_thread("simulation");
 
-  float thresh = 0.01;
-  if(glm::distance(a, b) < thresh || glm::distance(a,c) < thresh || glm::distance(a,d) < thresh)
-  {//add points
-
-
-    triangle temp1, temp2;
-
-    //initially not done, want to still move these around since they're just at the initial positions.
-    temp1.done = false;
-    temp2.done = false;
-
-    temp1.points[0] = a;
-    temp1.points[1] = b;
-    temp1.points[2] = c;
-
-    temp2.points[0] = c;
-    temp2.points[1] = b;
-    temp2.points[2] = d;
-
-
-
-
-    //random number generation
-    std::random_device rd;
-    std::mt19937 mt(rd());
-    std::uniform_real_distribution<float> dist(clow, chigh);
-
-    //colors
-    temp1.colors[0] = glm::vec4(dist(mt), dist(mt), 0, 1);
-    temp1.colors[1] = glm::vec4(dist(mt), dist(mt), 0, 1);
-    temp1.colors[2] = glm::vec4(dist(mt), dist(mt), 0, 1);
-
-    temp2.colors[0] = glm::vec4(dist(mt), dist(mt), 0, 1);
-    temp2.colors[1] = glm::vec4(dist(mt), dist(mt), 0, 1);
-    temp2.colors[2] = glm::vec4(dist(mt), dist(mt), 0, 1);
-
-
-    //texcoords
-
-    temp1.texcoords[0] = at;
-    temp1.texcoords[1] = bt;
-    temp1.texcoords[2] = ct;
-
-    temp2.texcoords[0] = bt;
-    temp2.texcoords[1] = ct;
-    temp2.texcoords[2] = dt;
-
-
-    //this scheme uses one point at the center - it was for the spaceship but might be useful elsewhere.
-    // glm::vec2 tc = (at + bt + ct + dt)/4.0f;
-    //
-    // temp1.texcoords[0] = tc;
-    // temp1.texcoords[1] = tc;
-    // temp1.texcoords[2] = tc;
-    //
-    // temp2.texcoords[0] = tc;
-    // temp2.texcoords[1] = tc;
-    // temp2.texcoords[2] = tc;
-
-
-    //normals
-    temp1.normals[0] = norm;
-    temp1.normals[1] = norm;
-    temp1.normals[2] = norm;
-
-    temp2.normals[0] = norm;
-    temp2.normals[1] = norm;
-    temp2.normals[2] = norm;
-
-    triangles.push_back(temp1);
-    triangles.push_back(temp2);
+  typedef std::chrono::steady_clock clock;
+  const clock::duration dt = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(sim_step));
+  const clock::duration late = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(max_behind));
 
+  clock::time_point next = clock::now() + dt;
 
+  while(running)
+  {
+    std::this_thread::sleep_until(next);
 
+    clock::time_point now = clock::now();
+    if(now - next > late)   //fell way behind, e.g. stopped in a debugger - pick up from here
+      next = now;
+    next += dt;
 
+    sim_prev = sim;
+    step(sim);
+    sim_ticks++;
+    publish_step(now);
   }
-  else
-  { //recurse
-    glm::vec3 center = (a + b + c + d) / 4.0f;    //center of the square
-    glm::vec2 centert = (at + bt + ct + dt) / 4.0f;
-
-    glm::vec3 bdmidp = (b + d) / 2.0f;            //midpoint between b and d
-    glm::vec2 bdmidpt = (bt + dt) / 2.0f;
-
-    glm::vec3 abmidp = (a + b) / 2.0f;            //midpoint between a and b
-    glm::vec2 abmidpt = (at + bt) / 2.0f;
-
-    glm::vec3 cdmidp = (c + d) / 2.0f;            //midpoint between c and d
-    glm::vec2 cdmidpt = (ct + dt) / 2.0f;
+}
 
-    glm::vec3 acmidp = (a + c) / 2.0f;            //midpoint between a and c
-    glm::vec2 acmidpt = (at + ct) / 2.0f;
+// //******************************************************************************
 
-    subd_square(abmidp, abmidpt, b, bt, center, centert, bdmidp, bdmidpt, norm, clow, chigh);
-    subd_square(a, at, abmidp, abmidpt, acmidp, acmidpt, center, centert, norm, clow, chigh);
-    subd_square(center, centert, bdmidp, bdmidpt, cdmidp, cdmidpt, d, dt, norm, clow, chigh);
-    subd_square(acmidp, acmidpt, center, centert, c, ct, cdmidp, cdmidpt, norm, clow, chigh);
+void Sub::publish_step(std::chrono::steady_clock::time_point when)
+{
+  //once things stop, publish one more step with prev == cur so the blend lands exactly, then go quiet
+  bool moving = sim.t != sim_prev.t || sim.yawpitchroll != sim_prev.yawpitchroll;
+  if(moving || sim_was_moving)
+  {
+    frame_snapshot& s = snapshots.write_slot();
+    s.prev = sim_prev;
+    s.cur = sim;
+    s.time = when;
+    snapshots.publish();
   }
+  sim_was_moving = moving;
 }
 
 // //******************************************************************************
 
-void Sub::display()
+void Sub::stop_simulation()
 {
-
-  glBindVertexArray(vao);
-  glUseProgram(sub_shader);
-
-  light_position = original_light_position + glm::vec3(2*cos(0.005*t),-2,2*sin(0.01*t));
-  glUniform3fv(light_position_loc, 1, glm::value_ptr(light_position));
-
-
-
-
-  GLint id;
-  glGetIntegerv(GL_CURRENT_PROGRAM,&id);
-
-
-  glUniform1i(glGetUniformLocation(id, "type"), 0);
-  draw_hull_func();
-
-  glUniform1i(glGetUniformLocation(id, "type"), 1);
-  draw_rooms_func();
-
-  //draw_decor_func();
-
-  draw_engine_func();
-
-
-
-
-  //draw_accoutremont_func();
-    //the doors will have windows, which might require alpha
-
+  running = false;
+  if(sim_thread.joinable())
+    sim_thread.join();
+  stepped = true;
 }
 
-void Sub::draw_hull_func()
+void Sub::start_simulation()
 {
-  if(draw_hull)
-  {
-    //the hull is pretty simple
-    glUseProgram(sub_shader);
-    glDrawArrays(GL_TRIANGLES, hull_start, hull_num);
-  }
+  if(running)
+    return;
+  stepped = false;
+  running = true;
+  sim_thread = std::thread(&Sub::simulation_loop, this);
 }
 
-void Sub::draw_rooms_func()
+void Sub::reset()
 {
-  for(int i = 0; i < 9; i++)
-    if(draw_room[i])
-    {
-      //set up lights, on a per-room basis - perhaps pass in the neighboring lights, so as to have light spillover
-
-      //swap textures here, probably a switch statement
-
-      // glUseProgram(room_shader);  //they all use the same shader, using the per-vertex normals, texcoords,
-                                    //positions (colors ignored) - and reference the same texture UNITS
-                                    // - not the same textures, but as far as the shader is concerned, the
-                                    //behavior is identical and it doesn't need to know anything about it
+  roll_rate = pitch_rate = yaw_rate = 0.0f;
+  animate = true;
+
+  draw_hull = true;
+  hull_mode = hull_mesh;
+  hull_lod = 0;
+  draw_room.assign(room_start.size(), true);
+  rooms_changed = true;
+
+  effects_tick = 0;
+  gas.clear();
+  gas_rate = 20;
+  bubbles.clear();
+  bubble_rate = 40;
+
+  sim = sim_prev = initial_state();
+  sim_ticks = 0;
+  sim_was_moving = true;    //so the reset gets published even though nothing moved
+  publish_step(std::chrono::steady_clock::now());
+  dirty = true;
+}
 
-                                    //we'll follow up on this, I asked on /r/opengl
+void Sub::step_to(uint64_t tick)
+{
+  while(sim_ticks < tick)
+  {
+    sim_prev = sim;
+    step(sim);
+    sim_ticks++;
+  }
 
-      glDrawArrays(GL_TRIANGLES, room_start[i], room_num[i]);
-    }
+  //prev == cur when nothing moved, so this is always safe to publish
+  sim_was_moving = true;
+  publish_step(std::chrono::steady_clock::now());
 }
 
-
 // //******************************************************************************
 
-void Sub::draw_engine_func()
+sim_state Sub::initial_state()
 {
-  sub_engine.draw();
+  sim_state initial;
+  initial.t = 0;
+  initial.yawpitchroll = glm::vec3(0,0,0);
+  initial.light_position = original_light_position + glm::vec3(2,-2,0);
+  sub_engine.update(crank_angle(0), initial.engine);
+  return initial;
 }
 
 // //******************************************************************************
 
-void Sub::update_rotation()
+void Sub::step(sim_state& state)
 {
+  PROFILE_ZONE("Sub::step");
+  glm::vec3& yawpitchroll = state.yawpitchroll;
+
   yawpitchroll[0] += (3.14/180.0) * yaw_rate;
   yawpitchroll[1] += (3.14/180.0) * pitch_rate;
   yawpitchroll[2] += (3.14/180.0) * roll_rate;
@@ -2011,13 +2125,49 @@ void Sub::update_rotation()
     else
       yawpitchroll[2] += 2*3.14;
 
-  glUniform3fv(yawpitchroll_loc, 1, glm::value_ptr(yawpitchroll));
+  if(animate)
+  {
+    state.t++;
+    state.light_position = original_light_position + glm::vec3(2*cos(0.005*state.t),-2,2*sin(0.01*state.t));
+    sub_engine.update(crank_angle(state.t), state.engine);
+  }
+}
+
+// //******************************************************************************
 
+glm::mat4 Sub::get_model()
+{
+  //uses the interpolated angles, so it matches what was last drawn
+  //the shader builds its rotation matrices transposed, so these go the other way
+  glm::vec3 pitch_vec = glm::vec3(1,0,0);
+  glm::vec3 roll_vec = glm::vec3(0,0,1);
+
+  glm::mat4 apply_yaw = glm::rotate(-render_yawpitchroll.x, glm::vec3(0,1,0));
+  pitch_vec = glm::vec3(apply_yaw * glm::vec4(pitch_vec, 0.0f));
+  roll_vec = glm::vec3(apply_yaw * glm::vec4(roll_vec, 0.0f));
+
+  glm::mat4 apply_pitch = glm::rotate(-render_yawpitchroll.y, pitch_vec);
+  roll_vec = glm::vec3(apply_pitch * glm::vec4(roll_vec, 0.0f));
+
+  glm::mat4 apply_roll = glm::rotate(-render_yawpitchroll.z, roll_vec);
+
+  return apply_roll * apply_pitch * apply_yaw * glm::scale(glm::vec3(scale));
+}
+
+// //******************************************************************************
+
+bool Sub::pick(int x, int y, bvh_hit& hit)
+{
+  GLint vp[4];
+  glGetIntegerv(GL_VIEWPORT, vp);
 
-  // view = view * glm::rotate(1.0f/200.0f,glm::vec3(view[0][0], view[0][1], view[0][2]));
-  // glUniformMatrix4fv(view_loc, 1, GL_TRUE, glm::value_ptr(view));
+  glm::mat4 model = get_model();
+  glm::vec4 viewport = glm::vec4(vp[0], vp[1], vp[2], vp[3]);
 
+  glm::vec3 near_point = glm::unProject(glm::vec3(x, y, 0.0f), view * model, proj, viewport);
+  glm::vec3 far_point = glm::unProject(glm::vec3(x, y, 1.0f), view * model, proj, viewport);
 
+  return scene_bvh.intersect_segment(near_point, far_point, hit);
 }
 
 // //******************************************************************************
@@ -2025,6 +2175,10 @@ void Sub::update_rotation()
 void Sub::set_proj(glm::mat4 in)
 {
   proj = in;
+  dirty = true;
+  glstate.use_program(sdf_shader);
+  glUniformMatrix4fv(sdf_proj_loc, 1, GL_FALSE, glm::value_ptr(proj));
+  glstate.use_program(sub_shader);
   glUniformMatrix4fv(proj_loc, 1, GL_FALSE, glm::value_ptr(proj));
   // glUniformMatrix4fv(proj_loc, 1, GL_TRUE, glm::value_ptr(proj));
 }
@@ -2034,6 +2188,10 @@ void Sub::set_proj(glm::mat4 in)
 void Sub::set_view(glm::mat4 in)
 {
   view = in;
+  dirty = true;
+  glstate.use_program(sdf_shader);
+  glUniformMatrix4fv(sdf_view_loc, 1, GL_FALSE, glm::value_ptr(view));
+  glstate.use_program(sub_shader);
   glUniformMatrix4fv(view_loc, 1, GL_FALSE, glm::value_ptr(view));
 }
 
@@ -2043,6 +2201,8 @@ void Sub::set_view(glm::mat4 in)
 void Sub::set_scale(float in)
 {
   scale = in;
+  dirty = true;
+  glstate.use_program(sub_shader);
   glUniform1fv(scale_loc, 1, &scale);
 }
 
@@ -0,0 +1,431 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include "common.hpp"
+#include "gl_state.hpp"
+#include "profiler.hpp"
+#include "tiled_heightmap.hpp"
+
+#include <algorithm>
+#include <string>
+
+
+//******************************************************************************
+//  Class: terrain
+//
+//  Purpose:  Seafloor, from one of the height maps, drawn with CDLOD
+//        (Strugar, "Continuous Distance-Dependent Level of Detail"). The
+//        height map is covered by a quadtree - each node knows the lowest
+//        and highest point under it, so it has a bounding box. Every frame
+//        the tree is walked from the root, and a node is drawn as one patch
+//        as soon as it's far enough from the eye for its level, or broken up
+//        into its children if it isn't. Nodes outside the view frustum are
+//        dropped along the way.
+//
+//        Every patch is the same grid mesh, instanced, and placed/scaled by
+//        the vertex shader, which reads the height from a texture. Heights
+//        come from a tiled height map (see tiled_heightmap.hpp) - only the
+//        tiles under patches in the frustum are paged into the texture
+//        array, and node bounds come from the tile index, so the map is
+//        never read in as a whole. Between
+//        levels the grid morphs smoothly into the next coarser one, so there
+//        are no cracks and no popping. The number of patches depends on the
+//        ranges, not how big the terrain is, so the triangle count stays
+//        about the same however much seabed there is.
+//
+//  Functions:
+//
+//    Constructor:
+//        Height map file, world size of the map, and where it goes.
+//
+//    load(filename):
+//        Swaps in another height map - a png is converted to the tiled
+//        format next to it the first time, or when the png is newer.
+//
+//    display(proj, view):
+//        Selects the patches for this camera, and draws them.
+//
+//    report():
+//        Patches and triangles from the last display().
+//******************************************************************************
+
+class terrain
+{
+public:
+  terrain(const std::string& heightmap = TERRAIN_PUGET_SOUND, float world_size = 64.0f, float floor = -0.9f, float relief = 0.6f);
+
+  bool load(const std::string& filename);
+
+  void display(glm::mat4 proj, glm::mat4 view);
+
+  void toggle_lod_view()    {show_lod = !show_lod;}
+  void set_lod_view(bool on) {show_lod = on;}
+  void report() const;
+  void report_tiles() const {cache.report();}
+
+private:
+  static const int grid_cells = 16;      //quads along the side of one patch
+  static const int num_levels = 9;       //leaves are extent / 256 across
+  static const int max_patches = 4096;   //hard cap on what one frame can draw
+
+  float extent, base, height_scale;
+  glm::vec2 origin;
+  float ranges[num_levels];       //level n is used out to ranges[n] from the eye
+
+  //the height map, the tiles of it that are on the gpu, and the lowest/highest
+  //height under each node - by level, 0 being the leaves, row major within a level
+  tiled_heightmap map;
+  tile_cache cache;
+  std::vector<glm::vec2> min_max[num_levels];
+
+  //per patch instance data - x, z, size, level
+  std::vector<glm::vec4> whole_patches, quarter_patches;
+
+  //state for the walk through the tree
+  glm::vec3 eye;
+  glm::vec4 planes[6];
+
+  GLuint shader;
+  GLuint vao, grid_buffer, instance_buffer;
+  GLint proj_loc, view_loc, eye_loc, grid_cells_loc, show_lod_loc;
+  GLint tiles_loc, tile_size_loc, map_size_loc;
+  int full_grid_verts, half_grid_verts;   //the half grid starts right after the full one
+
+  bool show_lod;
+
+  void build_min_max();
+
+  //samples of the map under a rectangle of world x,z - inclusive, clamped to the map
+  void sample_rect(float x0, float z0, float x1, float z1, int& sx0, int& sz0, int& sx1, int& sz1) const;
+
+  //pages in the tiles under a patch, that are also in the frustum
+  void request_tiles(const glm::vec4& patch);
+  int nodes_across(int level) const    {return 1 << (num_levels - 1 - level);}
+  float node_size(int level) const     {return extent / nodes_across(level);}
+
+  //true if the node got drawn or culled, false if it's out of range and its parent has to cover it
+  bool select(int level, int x, int z);
+
+  bool in_frustum(glm::vec3 lo, glm::vec3 hi) const;
+  bool in_range(glm::vec3 lo, glm::vec3 hi, float range) const;
+};
+
+
+terrain::terrain(const std::string& heightmap, float world_size, float floor, float relief)
+  : extent(world_size), base(floor), height_scale(relief), show_lod(false)
+{
+  origin = glm::vec2(-0.5f * extent);
+
+  //ranges double per level, like node sizes, starting far enough out that
+  //a leaf is never more than a couple levels away from its neighbours
+  ranges[0] = 4.0f * node_size(0);
+  for(int i = 1; i < num_levels; i++)
+    ranges[i] = 2.0f * ranges[i - 1];
+
+  cout << " compiling terrain shaders" << endl;
+  {
+    PROFILE_ZONE("Shader compile");
+    Shader s("resources/shaders/terrain_vert.glsl", "resources/shaders/terrain_frag.glsl");
+    shader = s.Program;
+  }
+
+  //the full grid, then one with half as many quads on a side for the quarters
+  //of a node that get drawn at the node's level while the rest of it is split
+  std::vector<glm::vec2> points;
+  for(int cells : {grid_cells, grid_cells / 2})
+    for(int z = 0; z < cells; z++)
+      for(int x = 0; x < cells; x++)
+      {
+        glm::vec2 a = glm::vec2(x, z) / float(cells);
+        glm::vec2 b = glm::vec2(x + 1, z) / float(cells);
+        glm::vec2 c = glm::vec2(x + 1, z + 1) / float(cells);
+        glm::vec2 d = glm::vec2(x, z + 1) / float(cells);
+
+        //counter clockwise from above, once it's on the xz plane
+        points.push_back(a); points.push_back(d); points.push_back(c);
+        points.push_back(a); points.push_back(c); points.push_back(b);
+      }
+  full_grid_verts = 6 * grid_cells * grid_cells;
+  half_grid_verts = 6 * (grid_cells / 2) * (grid_cells / 2);
+
+  glGenVertexArrays(1, &vao);
+  glstate.bind_vertex_array(vao);
+
+  glGenBuffers(1, &grid_buffer);
+  glstate.bind_buffer(GL_ARRAY_BUFFER, grid_buffer);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * points.size(), &points[0], GL_STATIC_DRAW);
+
+  GLint position_attrib = glGetAttribLocation(shader, "vPosition");
+  glEnableVertexAttribArray(position_attrib);
+  glVertexAttribPointer(position_attrib, 2, GL_FLOAT, false, 0, (static_cast<const char*>(0) + (0)));
+
+  glGenBuffers(1, &instance_buffer);
+  glstate.bind_buffer(GL_ARRAY_BUFFER, instance_buffer);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4) * max_patches, NULL, GL_STREAM_DRAW);
+
+  GLint patch_attrib = glGetAttribLocation(shader, "vPatch");
+  glEnableVertexAttribArray(patch_attrib);
+  glVertexAttribPointer(patch_attrib, 4, GL_FLOAT, false, 0, (static_cast<const char*>(0) + (0)));
+  glVertexAttribDivisor(patch_attrib, 1);
+
+  glstate.use_program(shader);
+
+  //morph over the last third of each level's range
+  GLfloat morph[2 * 16] = {0};
+  for(int i = 0; i < num_levels; i++)
+  {
+    float previous = i ? ranges[i - 1] : 0.0f;
+    morph[2*i + 0] = previous + 0.66f * (ranges[i] - previous);
+    morph[2*i + 1] = ranges[i];
+  }
+  glUniform2fv(glGetUniformLocation(shader, "morph_range"), 16, morph);
+
+  glUniform1i(glGetUniformLocation(shader, "height_tiles"), 4);
+  glUniform1i(glGetUniformLocation(shader, "page_table"), 5);
+  glUniform2fv(glGetUniformLocation(shader, "origin"), 1, glm::value_ptr(origin));
+  glUniform1f(glGetUniformLocation(shader, "extent"), extent);
+  glUniform1f(glGetUniformLocation(shader, "base"), base);
+  glUniform1f(glGetUniformLocation(shader, "height_scale"), height_scale);
+  glUniform3f(glGetUniformLocation(shader, "fog_color"), 0.068f, 0.168f, 0.268f);   //same as the clear color
+  glUniform1f(glGetUniformLocation(shader, "fog_distance"), 6.0f);
+
+  proj_loc = glGetUniformLocation(shader, "proj");
+  view_loc = glGetUniformLocation(shader, "view");
+  eye_loc = glGetUniformLocation(shader, "eye_position");
+  grid_cells_loc = glGetUniformLocation(shader, "grid_cells");
+  show_lod_loc = glGetUniformLocation(shader, "show_lod");
+  tiles_loc = glGetUniformLocation(shader, "tiles");
+  tile_size_loc = glGetUniformLocation(shader, "tile_size");
+  map_size_loc = glGetUniformLocation(shader, "map_size");
+
+  load(heightmap);
+}
+
+bool terrain::load(const std::string& filename)
+{
+  PROFILE_ZONE("terrain::load");
+
+  std::string tiled = filename;
+  size_t dot = filename.rfind(".png");
+  if(dot != std::string::npos && dot == filename.size() - 4)
+  {
+    tiled = filename.substr(0, dot) + ".tiles";
+
+    struct stat png_info, tiled_info;
+    bool stale = stat(tiled.c_str(), &tiled_info) != 0
+              || (stat(filename.c_str(), &png_info) == 0 && png_info.st_mtime > tiled_info.st_mtime);
+
+    if(stale && !convert_heightmap(filename, tiled))
+      return false;
+  }
+
+  if(!map.open(tiled))
+  {
+    cout << "couldn't open " << tiled << endl;
+    return false;
+  }
+
+  cache.attach(&map);
+
+  glstate.use_program(shader);
+  glUniform2f(tiles_loc, map.tiles_x(), map.tiles_y());
+  glUniform1f(tile_size_loc, map.tile_size());
+  glUniform2f(map_size_loc, map.width(), map.height());
+
+  build_min_max();
+  return true;
+}
+
+void terrain::sample_rect(float x0, float z0, float x1, float z1, int& sx0, int& sz0, int& sx1, int& sz1) const
+{
+  //the shader puts sample 0 on the near edge and the last one on the far edge
+  float sx = (map.width() - 1) / extent, sz = (map.height() - 1) / extent;
+
+  sx0 = glm::clamp(int(std::floor((x0 - origin.x) * sx)), 0, map.width() - 1);
+  sx1 = glm::clamp(int(std::ceil((x1 - origin.x) * sx)), 0, map.width() - 1);
+  sz0 = glm::clamp(int(std::floor((z0 - origin.y) * sz)), 0, map.height() - 1);
+  sz1 = glm::clamp(int(std::ceil((z1 - origin.y) * sz)), 0, map.height() - 1);
+}
+
+void terrain::build_min_max()
+{
+  //leaves from the tiles they touch - only as tight as a tile, but it doesn't need any of the height data
+  int across = nodes_across(0);
+  float size = node_size(0);
+  int t = map.tile_size();
+  min_max[0].assign(across * across, glm::vec2(0.0f));
+
+  for(int z = 0; z < across; z++)
+    for(int x = 0; x < across; x++)
+    {
+      int sx0, sz0, sx1, sz1;
+      sample_rect(origin.x + x * size, origin.y + z * size, origin.x + (x + 1) * size, origin.y + (z + 1) * size, sx0, sz0, sx1, sz1);
+
+      glm::vec2 range = glm::vec2(1.0f, 0.0f);
+      for(int tz = sz0 / t; tz <= std::min(sz1 / t, map.tiles_y() - 1); tz++)
+        for(int tx = sx0 / t; tx <= std::min(sx1 / t, map.tiles_x() - 1); tx++)
+        {
+          glm::vec2 r = map.tile_range(tx, tz);
+          range = glm::vec2(std::min(range.x, r.x), std::max(range.y, r.y));
+        }
+
+      min_max[0][z * across + x] = base + height_scale * range;
+    }
+
+  //then each level from the four below it
+  for(int level = 1; level < num_levels; level++)
+  {
+    int n = nodes_across(level);
+    const std::vector<glm::vec2>& below = min_max[level - 1];
+    min_max[level].assign(n * n, glm::vec2(0.0f));
+
+    for(int z = 0; z < n; z++)
+      for(int x = 0; x < n; x++)
+      {
+        glm::vec2 a = below[(2*z) * 2*n + 2*x], b = below[(2*z) * 2*n + 2*x + 1];
+        glm::vec2 c = below[(2*z + 1) * 2*n + 2*x], d = below[(2*z + 1) * 2*n + 2*x + 1];
+
+        min_max[level][z * n + x] = glm::vec2(std::min(std::min(a.x, b.x), std::min(c.x, d.x)),
+                                              std::max(std::max(a.y, b.y), std::max(c.y, d.y)));
+      }
+  }
+}
+
+void terrain::request_tiles(const glm::vec4& patch)
+{
+  int sx0, sz0, sx1, sz1;
+  sample_rect(patch.x, patch.y, patch.x + patch.z, patch.y + patch.z, sx0, sz0, sx1, sz1);
+
+  int t = map.tile_size();
+  float world_per_sample_x = extent / (map.width() - 1), world_per_sample_z = extent / (map.height() - 1);
+
+  for(int tz = sz0 / t; tz <= std::min(sz1 / t, map.tiles_y() - 1); tz++)
+    for(int tx = sx0 / t; tx <= std::min(sx1 / t, map.tiles_x() - 1); tx++)
+    {
+      glm::vec2 r = base + height_scale * map.tile_range(tx, tz);
+      glm::vec3 lo = glm::vec3(origin.x + tx * t * world_per_sample_x, r.x, origin.y + tz * t * world_per_sample_z);
+      glm::vec3 hi = glm::vec3(origin.x + (tx + 1) * t * world_per_sample_x, r.y, origin.y + (tz + 1) * t * world_per_sample_z);
+
+      if(in_frustum(lo, hi))
+        cache.request(tx, tz);
+    }
+}
+
+void terrain::display(glm::mat4 proj, glm::mat4 view)
+{
+  PROFILE_ZONE("terrain::display");
+
+  eye = glm::vec3(glm::inverse(view)[3]);
+
+  //frustum planes, straight out of the combined matrix (Gribb/Hartmann)
+  glm::mat4 m = glm::transpose(proj * view);
+  planes[0] = m[3] + m[0];  planes[1] = m[3] - m[0];
+  planes[2] = m[3] + m[1];  planes[3] = m[3] - m[1];
+  planes[4] = m[3] + m[2];  planes[5] = m[3] - m[2];
+
+  whole_patches.clear();
+  quarter_patches.clear();
+  {
+    PROFILE_ZONE("terrain select");
+    select(num_levels - 1, 0, 0);
+  }
+
+  //whole patches first, then the quarters, in the one buffer
+  int whole = std::min<int>(whole_patches.size(), max_patches);
+  int quarter = std::min<int>(quarter_patches.size(), max_patches - whole);
+  if(whole + quarter == 0)
+    return;
+
+  {
+    PROFILE_ZONE("terrain tiles");
+    cache.begin_frame();
+    for(int i = 0; i < whole; i++)
+      request_tiles(whole_patches[i]);
+    for(int i = 0; i < quarter; i++)
+      request_tiles(quarter_patches[i]);
+    cache.end_frame();
+  }
+
+  glstate.bind_buffer(GL_ARRAY_BUFFER, instance_buffer);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec4) * max_patches, NULL, GL_STREAM_DRAW);   //orphan
+  if(whole)   glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec4) * whole, &whole_patches[0]);
+  if(quarter) glBufferSubData(GL_ARRAY_BUFFER, sizeof(glm::vec4) * whole, sizeof(glm::vec4) * quarter, &quarter_patches[0]);
+
+  glstate.use_program(shader);
+  glstate.bind_vertex_array(vao);
+  glstate.bind_texture(4, GL_TEXTURE_2D_ARRAY, cache.array_texture());
+  glstate.bind_texture(5, GL_TEXTURE_2D, cache.page_texture());
+
+  glUniformMatrix4fv(proj_loc, 1, GL_FALSE, glm::value_ptr(proj));
+  glUniformMatrix4fv(view_loc, 1, GL_FALSE, glm::value_ptr(view));
+  glUniform3fv(eye_loc, 1, glm::value_ptr(eye));
+  glUniform1i(show_lod_loc, show_lod);
+
+  if(whole)
+  {
+    glUniform1f(grid_cells_loc, grid_cells);
+    glDrawArraysInstancedBaseInstance(GL_TRIANGLES, 0, full_grid_verts, whole, 0);
+  }
+
+  if(quarter)
+  {
+    glUniform1f(grid_cells_loc, grid_cells / 2);
+    glDrawArraysInstancedBaseInstance(GL_TRIANGLES, full_grid_verts, half_grid_verts, quarter, whole);
+  }
+}
+
+bool terrain::select(int level, int x, int z)
+{
+  float size = node_size(level);
+  glm::vec2 bounds = min_max[level][z * nodes_across(level) + x];
+  glm::vec3 lo = glm::vec3(origin.x + x * size, bounds.x, origin.y + z * size);
+  glm::vec3 hi = glm::vec3(lo.x + size, bounds.y, lo.z + size);
+
+  if(!in_range(lo, hi, ranges[level]))
+    return false;   //the level above covers this
+
+  if(!in_frustum(lo, hi))
+    return true;    //nothing to draw, but it's taken care of
+
+  //close enough that the next level down is needed somewhere in here
+  if(level > 0 && in_range(lo, hi, ranges[level - 1]))
+  {
+    float half = 0.5f * size;
+    for(int i = 0; i < 4; i++)
+    {
+      int cx = 2*x + (i & 1), cz = 2*z + (i >> 1);
+      if(!select(level - 1, cx, cz))
+        quarter_patches.push_back(glm::vec4(lo.x + (i & 1) * half, lo.z + (i >> 1) * half, half, level));
+    }
+    return true;
+  }
+
+  whole_patches.push_back(glm::vec4(lo.x, lo.z, size, level));
+  return true;
+}
+
+bool terrain::in_frustum(glm::vec3 lo, glm::vec3 hi) const
+{
+  for(const glm::vec4& p : planes)
+  {//the corner furthest along the plane's normal
+    glm::vec3 corner = glm::vec3(p.x > 0 ? hi.x : lo.x, p.y > 0 ? hi.y : lo.y, p.z > 0 ? hi.z : lo.z);
+    if(glm::dot(glm::vec3(p), corner) + p.w < 0.0f)
+      return false;
+  }
+  return true;
+}
+
+bool terrain::in_range(glm::vec3 lo, glm::vec3 hi, float range) const
+{
+  glm::vec3 closest = glm::clamp(eye, lo, hi);
+  return glm::dot(closest - eye, closest - eye) <= range * range;
+}
+
+void terrain::report() const
+{
+  int whole = whole_patches.size(), quarter = quarter_patches.size();
+  cout << "terrain: " << whole << " patches and " << quarter << " quarter patches, "
+       << 2 * (whole * grid_cells * grid_cells + quarter * (grid_cells / 2) * (grid_cells / 2)) << " triangles" << endl;
+}
+
+#endif
@@ -0,0 +1,470 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include "common.hpp"
+#include "gl_state.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+
+//******************************************************************************
+//  Mip chains, made on the CPU
+//
+//        glGenerateMipmap box filters whatever is in the texture, which is
+//        wrong for anything that isn't linear data - colors get darker as
+//        they shrink, since they're stored gamma encoded, and averaged normals
+//        get shorter, so distant bumps light flat. These filters know what
+//        they're averaging:
+//
+//          mip_color     RGB is sRGB - to linear, average, back to sRGB.
+//                        Alpha is linear.
+//          mip_linear    plain average, for data that's already linear
+//          mip_normal    0.5 * n + 0.5 - decode, average, renormalize. Two
+//                        channel maps get z rebuilt before averaging.
+//          mip_max       largest of the four, per channel - height maps for
+//          mip_min       bounds, e.g. culling or ray marching
+//
+//        Each level is the 2x2 average of the one above. Odd sizes lose the
+//        last row or column when they're halved, except for max and min,
+//        where the last texel takes it in, so the bounds stay conservative. With SSE2, four channel
+//        texels go through as one vector each. Levels with enough texels are
+//        split across threads by rows.
+//
+//    build_mip_chain(levels, filter, channels):
+//        levels[0] is the image, and the rest get appended.
+//******************************************************************************
+
+enum mip_filter
+{
+  mip_color,
+  mip_linear,
+  mip_normal,
+  mip_max,
+  mip_min
+};
+
+typedef struct mip_level_t
+{
+  int width, height;
+  std::vector<unsigned char> data;
+} mip_level;
+
+
+namespace mip_detail
+{
+  //sRGB <-> linear, by table - 8 bits in, 12 bits of linear back out is plenty
+  //to land on the right 8 bit sRGB value
+  struct srgb_tables
+  {
+    float to_linear[256];
+    unsigned char to_srgb[4096];
+
+    srgb_tables()
+    {
+      for(int i = 0; i < 256; i++)
+      {
+        float c = i / 255.0f;
+        to_linear[i] = (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+      }
+      for(int i = 0; i < 4096; i++)
+      {
+        float l = i / 4095.0f;
+        float c = (l <= 0.0031308f) ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+        to_srgb[i] = (unsigned char)lrintf(255.0f * c);
+      }
+    }
+  };
+
+  inline const srgb_tables& tables()   {static srgb_tables t; return t;}
+
+  inline unsigned char to_byte(float f)         {return (unsigned char)lrintf(std::min(std::max(f, 0.0f), 255.0f));}
+  inline unsigned char linear_to_srgb(float l)  {return tables().to_srgb[(int)lrintf(std::min(std::max(l, 0.0f), 1.0f) * 4095.0f)];}
+
+  //one output texel from the four source texels p[0..3], any channel count
+  inline void texel(const unsigned char* const p[4], int channels, mip_filter filter, unsigned char* out)
+  {
+    const srgb_tables& t = tables();
+
+    switch(filter)
+    {
+      case mip_max:
+      case mip_min:   //done in rows(), they can take more than four
+        break;
+
+      case mip_normal:
+      {
+        float n[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for(int i = 0; i < 4; i++)
+        {
+          float x = p[i][0] / 127.5f - 1.0f, y = p[i][1] / 127.5f - 1.0f;
+          float z = (channels >= 3) ? p[i][2] / 127.5f - 1.0f : std::sqrt(std::max(0.0f, 1.0f - x*x - y*y));
+          n[0] += x; n[1] += y; n[2] += z;
+          if(channels == 4) n[3] += p[i][3];
+        }
+
+        float length = std::sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+        float inv = (length > 0.0f) ? 1.0f / length : 0.0f;
+        for(int c = 0; c < std::min(channels, 3); c++)
+          out[c] = to_byte(127.5f * n[c] * inv + 127.5f);
+        if(channels == 4)
+          out[3] = to_byte(0.25f * n[3]);
+        break;
+      }
+
+      case mip_color:
+      case mip_linear:
+        for(int c = 0; c < channels; c++)
+        {
+          bool gamma = (filter == mip_color) && (c < 3) && (channels != 2 || c == 0);   //grey+alpha has its alpha second
+          if(gamma)
+            out[c] = linear_to_srgb(0.25f * (t.to_linear[p[0][c]] + t.to_linear[p[1][c]] + t.to_linear[p[2][c]] + t.to_linear[p[3][c]]));
+          else
+            out[c] = to_byte(0.25f * (p[0][c] + p[1][c] + p[2][c] + p[3][c]));
+        }
+        break;
+    }
+  }
+
+#ifdef __SSE2__
+  //four channel texels as one vector each, for the filters that do arithmetic
+  inline void texel4(const unsigned char* const p[4], mip_filter filter, unsigned char* out)
+  {
+    const srgb_tables& t = tables();
+    const __m128 quarter = _mm_set1_ps(0.25f);
+    float f[4];
+
+    if(filter == mip_normal)
+    {
+      const __m128 scale = _mm_set_ps(0.0f, 1.0f / 127.5f, 1.0f / 127.5f, 1.0f / 127.5f);
+      const __m128 shift = _mm_set_ps(0.0f, 1.0f, 1.0f, 1.0f);
+      const __m128 keep_alpha = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+
+      __m128 sum = _mm_setzero_ps();
+      for(int i = 0; i < 4; i++)
+      {
+        __m128 v = _mm_set_ps(p[i][3], p[i][2], p[i][1], p[i][0]);
+        sum = _mm_add_ps(sum, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(v, scale), shift), _mm_mul_ps(v, keep_alpha)));
+      }
+
+      //length of xyz - alpha is masked out of the dot product
+      __m128 sq = _mm_mul_ps(sum, _mm_sub_ps(_mm_set1_ps(1.0f), keep_alpha));
+      sq = _mm_mul_ps(sq, sq);
+      sq = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 3, 0, 1)));
+      sq = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1, 0, 3, 2)));
+      __m128 length = _mm_sqrt_ps(sq);
+      __m128 inv = _mm_and_ps(_mm_cmpgt_ps(length, _mm_setzero_ps()), _mm_div_ps(_mm_set1_ps(1.0f), length));
+
+      //xyz back to 0-255, alpha averaged
+      _mm_storeu_ps(f, _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sum, inv), _mm_set1_ps(127.5f)), _mm_set1_ps(127.5f)));
+      out[0] = to_byte(f[0]);
+      out[1] = to_byte(f[1]);
+      out[2] = to_byte(f[2]);
+
+      _mm_storeu_ps(f, _mm_mul_ps(sum, quarter));
+      out[3] = to_byte(f[3]);
+      return;
+    }
+
+    __m128 sum = _mm_setzero_ps();
+    if(filter == mip_color)
+    {
+      for(int i = 0; i < 4; i++)
+        sum = _mm_add_ps(sum, _mm_set_ps(p[i][3] / 255.0f, t.to_linear[p[i][2]], t.to_linear[p[i][1]], t.to_linear[p[i][0]]));
+      _mm_storeu_ps(f, _mm_mul_ps(sum, quarter));
+
+      out[0] = linear_to_srgb(f[0]);
+      out[1] = linear_to_srgb(f[1]);
+      out[2] = linear_to_srgb(f[2]);
+      out[3] = to_byte(255.0f * f[3]);
+    }
+    else
+    {
+      for(int i = 0; i < 4; i++)
+        sum = _mm_add_ps(sum, _mm_set_ps(p[i][3], p[i][2], p[i][1], p[i][0]));
+      _mm_storeu_ps(f, _mm_mul_ps(sum, quarter));
+
+      for(int c = 0; c < 4; c++)
+        out[c] = to_byte(f[c]);
+    }
+  }
+#endif
+
+  inline void rows(const mip_level& src, mip_level& dst, int channels, mip_filter filter, int first, int last)
+  {
+    for(int y = first; y < last; y++)
+    {
+      int y0 = std::min(2 * y, src.height - 1), y1 = std::min(2 * y + 1, src.height - 1);
+
+      for(int x = 0; x < dst.width; x++)
+      {
+        int x0 = std::min(2 * x, src.width - 1), x1 = std::min(2 * x + 1, src.width - 1);
+
+        if(filter == mip_max || filter == mip_min)
+        {//bounds have to cover everything, so the last texel takes the odd row/column too
+          int x_end = (x == dst.width - 1) ? src.width - 1 : x1;
+          int y_end = (y == dst.height - 1) ? src.height - 1 : y1;
+          unsigned char* out = &dst.data[((size_t)y * dst.width + x) * channels];
+
+          for(int c = 0; c < channels; c++)
+          {
+            unsigned char v = src.data[((size_t)y0 * src.width + x0) * channels + c];
+            for(int sy = y0; sy <= y_end; sy++)
+              for(int sx = x0; sx <= x_end; sx++)
+              {
+                unsigned char s = src.data[((size_t)sy * src.width + sx) * channels + c];
+                v = (filter == mip_max) ? std::max(v, s) : std::min(v, s);
+              }
+            out[c] = v;
+          }
+          continue;
+        }
+
+        const unsigned char* p[4] = {
+          &src.data[((size_t)y0 * src.width + x0) * channels], &src.data[((size_t)y0 * src.width + x1) * channels],
+          &src.data[((size_t)y1 * src.width + x0) * channels], &src.data[((size_t)y1 * src.width + x1) * channels]};
+        unsigned char* out = &dst.data[((size_t)y * dst.width + x) * channels];
+
+#ifdef __SSE2__
+        if(channels == 4)
+        {
+          texel4(p, filter, out);
+          continue;
+        }
+#endif
+        texel(p, channels, filter, out);
+      }
+    }
+  }
+}
+
+
+void build_mip_chain(std::vector<mip_level>& levels, mip_filter filter, int channels)
+{
+  PROFILE_ZONE("build_mip_chain");
+
+  mip_detail::tables();   //built once, before any threads want them
+
+  const int texels_per_thread = 1 << 16;
+
+  while(levels.back().width > 1 || levels.back().height > 1)
+  {
+    mip_level next;
+    next.width = std::max(1, levels.back().width / 2);
+    next.height = std::max(1, levels.back().height / 2);
+    next.data.resize((size_t)next.width * next.height * channels);
+    levels.push_back(next);
+
+    const mip_level& src = levels[levels.size() - 2];
+    mip_level& dst = levels.back();
+
+    int num_threads = std::min<int>(std::max(1u, std::thread::hardware_concurrency()),
+                                    std::max(1, dst.width * dst.height / texels_per_thread));
+    num_threads = std::min(num_threads, dst.height);
+
+    std::vector<std::thread> workers;
+    for(int w = 1; w < num_threads; w++)
+      workers.push_back(std::thread(mip_detail::rows, std::cref(src), std::ref(dst), channels, filter,
+                                    (dst.height * w) / num_threads, (dst.height * (w + 1)) / num_threads));
+
+    mip_detail::rows(src, dst, channels, filter, 0, dst.height / num_threads);
+
+    for(auto& w : workers)
+      w.join();
+  }
+}
+
+
+//******************************************************************************
+//  Class: texture_loader
+//
+//  Purpose:  Loads png textures off the main thread. load() hands back a
+//        texture name right away, holding a 1x1 placeholder, and a worker
+//        thread decodes the png and builds its mip chain. upload_finished(),
+//        once a frame on the GL thread, puts anything that's done into its
+//        texture, every level at once.
+//
+//        Decoded images are kept with their mip chains, by file, filter and
+//        channel count, so loading the same thing again skips straight to
+//        the upload.
+//
+//        There's one of these, textures, like glstate.
+//
+//  Functions:
+//
+//    load(filename, filter, channels, wrap):
+//        Starts loading, returns the texture.
+//
+//    upload(levels, channels, wrap):
+//        A texture from levels that are already built, right now.
+//
+//    decode(filename, filter, channels):
+//        The decoded image and its mip chain, from the cache or by loading
+//        it - blocks. Null if the png couldn't be read.
+//
+//    finish():
+//        Waits for everything that's loading, and uploads it.
+//******************************************************************************
+
+typedef std::vector<mip_level> mip_chain;
+
+class texture_loader
+{
+public:
+  ~texture_loader()   {for(auto& j : jobs) if(j->worker.joinable()) j->worker.join();}
+
+  GLuint load(const std::string& filename, mip_filter filter, int channels = 4, bool wrap = true);
+  GLuint upload(const mip_chain& levels, int channels, bool wrap, GLuint tex = 0);
+
+  std::shared_ptr<const mip_chain> decode(const std::string& filename, mip_filter filter, int channels);
+
+  void upload_finished();
+  void finish();
+
+  bool busy() const   {return !jobs.empty();}
+
+private:
+  typedef struct job_t
+  {
+    std::string filename;
+    GLuint tex;
+    int channels;
+    bool wrap;
+
+    std::thread worker;
+    std::atomic<bool> done;
+    std::shared_ptr<const mip_chain> result;
+  } job;
+
+  std::vector<std::unique_ptr<job>> jobs;
+
+  std::mutex cache_lock;
+  std::map<std::string, std::shared_ptr<const mip_chain>> cache;
+};
+
+texture_loader textures;
+
+
+std::shared_ptr<const mip_chain> texture_loader::decode(const std::string& filename, mip_filter filter, int channels)
+{
+  std::string key = filename + "|" + std::to_string(filter) + "|" + std::to_string(channels);
+  {
+    std::lock_guard<std::mutex> hold(cache_lock);
+    std::map<std::string, std::shared_ptr<const mip_chain>>::iterator it = cache.find(key);
+    if(it != cache.end())
+      return it->second;
+  }
+
+  PROFILE_ZONE("texture decode");
+
+  static const LodePNGColorType types[] = {LCT_GREY, LCT_GREY, LCT_GREY_ALPHA, LCT_RGB, LCT_RGBA};
+
+  std::shared_ptr<mip_chain> levels(new mip_chain(1));
+  unsigned width, height;
+  unsigned error = lodepng::decode((*levels)[0].data, width, height, filename, types[channels], 8);
+  if(error)
+  {
+    cout << "couldn't load " << filename << ": " << lodepng_error_text(error) << endl;
+    return nullptr;
+  }
+
+  (*levels)[0].width = width;
+  (*levels)[0].height = height;
+  build_mip_chain(*levels, filter, channels);
+
+  std::lock_guard<std::mutex> hold(cache_lock);
+  cache[key] = levels;
+  return levels;
+}
+
+GLuint texture_loader::load(const std::string& filename, mip_filter filter, int channels, bool wrap)
+{
+  //placeholder, until the real thing is ready
+  mip_chain placeholder(1);
+  placeholder[0].width = placeholder[0].height = 1;
+  placeholder[0].data.assign(channels, 128);
+  GLuint tex = upload(placeholder, channels, wrap);
+
+  jobs.push_back(std::unique_ptr<job>(new job));
+  job& j = *jobs.back();
+  j.filename = filename;
+  j.tex = tex;
+  j.channels = channels;
+  j.wrap = wrap;
+  j.done = false;
+  j.worker = std::thread([this, &j, filter]()
+  {
+    PROFILE_ZONE("texture load");
+    j.result = decode(j.filename, filter, j.channels);
+    j.done = true;
+  });
+
+  return tex;
+}
+
+GLuint texture_loader::upload(const mip_chain& levels, int channels, bool wrap, GLuint tex)
+{
+  PROFILE_ZONE("texture upload");
+
+  static const GLenum formats[] = {GL_RED, GL_RED, GL_RG, GL_RGB, GL_RGBA};
+  static const GLenum internal_formats[] = {GL_R8, GL_R8, GL_RG8, GL_RGB8, GL_RGBA8};
+
+  if(!tex)
+    glGenTextures(1, &tex);
+  glstate.bind_texture_for_upload(0, GL_TEXTURE_2D, tex);   //runs mid frame, with any unit active
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);    //small levels, and 1-3 channels, aren't 4 byte aligned
+  for(size_t i = 0; i < levels.size(); i++)
+    glTexImage2D(GL_TEXTURE_2D, i, internal_formats[channels], levels[i].width, levels[i].height, 0,
+                 formats[channels], GL_UNSIGNED_BYTE, &levels[i].data[0]);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  GLenum w = wrap ? GL_REPEAT : GL_CLAMP_TO_EDGE;
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, w);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, w);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels.size() - 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  return tex;
+}
+
+void texture_loader::upload_finished()
+{
+  for(size_t i = 0; i < jobs.size();)
+  {
+    job& j = *jobs[i];
+    if(!j.done)
+    {
+      i++;
+      continue;
+    }
+
+    j.worker.join();
+    if(j.result)
+      upload(*j.result, j.channels, j.wrap, j.tex);   //a failed load keeps its placeholder
+
+    jobs.erase(jobs.begin() + i);
+  }
+}
+
+void texture_loader::finish()
+{
+  for(auto& j : jobs)
+    j->worker.join();
+  upload_finished();
+}
+
+#endif
@@ -0,0 +1,433 @@
+#ifndef TILED_HEIGHTMAP_H
+#define TILED_HEIGHTMAP_H
+
+#include "common.hpp"
+#include "gl_state.hpp"
+#include "profiler.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+//******************************************************************************
+//  Tiled height map file format
+//
+//        header
+//        index         one entry per tile, row major - where its data is, and
+//                      the lowest and highest height in it
+//        tile data     (tile_size + 1) squared uint16's per tile, row major
+//
+//        Tiles overlap their neighbours by one sample on the right and bottom
+//        edges, so a tile can be filtered all the way across without needing
+//        the next one. Past the edge of the map, samples are clamped. Heights
+//        are 16 bit, whatever the source was - little endian, like the
+//        machines this runs on.
+//
+//        convert_heightmap() makes one of these from a png.
+//******************************************************************************
+
+typedef struct tiled_header_t
+{
+  char magic[4];          //"HTIL"
+  uint32_t version;
+  uint32_t width, height; //in samples
+  uint32_t tile_size;     //samples per tile side, not counting the overlap
+  uint32_t tiles_x, tiles_y;
+  uint32_t reserved;
+} tiled_header;
+
+typedef struct tile_entry_t
+{
+  uint64_t offset;        //from the start of the file
+  uint16_t min, max;
+  uint32_t reserved;
+} tile_entry;
+
+const uint32_t tiled_version = 1;
+
+
+bool convert_heightmap(const std::string& png, const std::string& out, int tile_size = 128)
+{
+  PROFILE_ZONE("convert_heightmap");
+
+  //16 bit grey, big endian - lodepng only converts to 16 bit from 16 bit
+  //sources, so 8 bit ones get scaled up here instead, keeping white white
+  std::vector<unsigned char> image;
+  unsigned width, height;
+  unsigned error = lodepng::decode(image, width, height, png, LCT_GREY, 16);
+  if(error)
+  {
+    std::vector<unsigned char> narrow;
+    error = lodepng::decode(narrow, width, height, png, LCT_GREY, 8);
+    if(error)
+    {
+      cout << "couldn't load " << png << ": " << lodepng_error_text(error) << endl;
+      return false;
+    }
+
+    image.resize(2 * narrow.size());
+    for(size_t i = 0; i < narrow.size(); i++)
+      image[2*i] = image[2*i + 1] = narrow[i];
+  }
+
+  tiled_header header;
+  std::memcpy(header.magic, "HTIL", 4);
+  header.version = tiled_version;
+  header.width = width;
+  header.height = height;
+  header.tile_size = tile_size;
+  header.tiles_x = (width + tile_size - 1) / tile_size;
+  header.tiles_y = (height + tile_size - 1) / tile_size;
+  header.reserved = 0;
+
+  int stored = tile_size + 1;
+  size_t tile_bytes = stored * stored * sizeof(uint16_t);
+  size_t num_tiles = header.tiles_x * header.tiles_y;
+
+  std::vector<tile_entry> index(num_tiles);
+  std::vector<uint16_t> data(num_tiles * stored * stored);
+
+  for(uint32_t ty = 0; ty < header.tiles_y; ty++)
+    for(uint32_t tx = 0; tx < header.tiles_x; tx++)
+    {
+      size_t t = ty * header.tiles_x + tx;
+      uint16_t* tile = &data[t * stored * stored];
+      uint16_t lo = 65535, hi = 0;
+
+      for(int y = 0; y < stored; y++)
+        for(int x = 0; x < stored; x++)
+        {
+          unsigned sx = std::min(tx * tile_size + x, width - 1);
+          unsigned sy = std::min(ty * tile_size + y, height - 1);
+          size_t i = 2 * (sy * width + sx);
+
+          uint16_t h = (image[i] << 8) | image[i + 1];   //lodepng gives big endian
+          tile[y * stored + x] = h;
+          lo = std::min(lo, h);
+          hi = std::max(hi, h);
+        }
+
+      index[t].offset = sizeof(tiled_header) + num_tiles * sizeof(tile_entry) + t * tile_bytes;
+      index[t].min = lo;
+      index[t].max = hi;
+      index[t].reserved = 0;
+    }
+
+  FILE* f = fopen(out.c_str(), "wb");
+  if(!f)
+  {
+    cout << "couldn't open " << out << " to write the tiled height map" << endl;
+    return false;
+  }
+
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+         && fwrite(&index[0], sizeof(tile_entry), num_tiles, f) == num_tiles
+         && fwrite(&data[0], tile_bytes, num_tiles, f) == num_tiles;
+  fclose(f);
+
+  if(!ok)
+  {
+    cout << "couldn't write " << out << endl;
+    std::remove(out.c_str());
+    return false;
+  }
+
+  cout << "converted " << png << " to " << out << ", " << num_tiles << " tiles of " << tile_size << endl;
+  return true;
+}
+
+
+//******************************************************************************
+//  Class: tiled_heightmap
+//
+//  Purpose:  Read only view of a tiled height map file, through mmap. Nothing
+//        is read until a tile is asked for, and then only the pages that tile
+//        is on - the OS pages them in and out, so maps bigger than memory are
+//        fine.
+//
+//  Functions:
+//
+//    open(filename):
+//        Maps the file, and checks the header and the index against its size.
+//
+//    tile(tx, ty):
+//        Pointer to the (tile_size + 1) squared samples of one tile.
+//
+//    tile_range(tx, ty):
+//        Lowest and highest sample in a tile, 0 to 1, from the index, so
+//        nothing has to be paged in.
+//******************************************************************************
+
+class tiled_heightmap
+{
+public:
+  tiled_heightmap() : mapping(nullptr), mapped_size(0), header(nullptr), index(nullptr) {}
+  ~tiled_heightmap()    {close();}
+
+  bool open(const std::string& filename);
+  void close();
+  bool is_open() const  {return mapping != nullptr;}
+
+  int width() const           {return header->width;}
+  int height() const          {return header->height;}
+  int tile_size() const       {return header->tile_size;}
+  int tiles_x() const         {return header->tiles_x;}
+  int tiles_y() const         {return header->tiles_y;}
+
+  const uint16_t* tile(int tx, int ty) const
+  {
+    return reinterpret_cast<const uint16_t*>(mapping + index[ty * header->tiles_x + tx].offset);
+  }
+
+  glm::vec2 tile_range(int tx, int ty) const
+  {
+    const tile_entry& e = index[ty * header->tiles_x + tx];
+    return glm::vec2(e.min / 65535.0f, e.max / 65535.0f);
+  }
+
+private:
+  const unsigned char* mapping;
+  size_t mapped_size;
+
+  const tiled_header* header;
+  const tile_entry* index;
+};
+
+
+bool tiled_heightmap::open(const std::string& filename)
+{
+  close();
+
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+
+  struct stat info;
+  if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(tiled_header))
+  {
+    ::close(fd);
+    return false;
+  }
+
+  void* p = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);    //the mapping keeps the file
+  if(p == MAP_FAILED)
+    return false;
+
+  mapping = static_cast<const unsigned char*>(p);
+  mapped_size = info.st_size;
+  header = reinterpret_cast<const tiled_header*>(mapping);
+  index = reinterpret_cast<const tile_entry*>(mapping + sizeof(tiled_header));
+
+  //everything the index points at has to be inside the file
+  size_t num_tiles = (size_t)header->tiles_x * header->tiles_y;
+  size_t tile_bytes = (size_t)(header->tile_size + 1) * (header->tile_size + 1) * sizeof(uint16_t);
+  bool ok = std::memcmp(header->magic, "HTIL", 4) == 0 && header->version == tiled_version && num_tiles > 0
+         && sizeof(tiled_header) + num_tiles * sizeof(tile_entry) <= mapped_size;
+
+  for(size_t t = 0; ok && t < num_tiles; t++)
+    ok = index[t].offset + tile_bytes <= mapped_size;
+
+  if(!ok)
+  {
+    cout << filename << " isn't a tiled height map this can read" << endl;
+    close();
+    return false;
+  }
+
+  //tiles get read in whatever order they come into view
+  madvise(p, mapped_size, MADV_RANDOM);
+  return true;
+}
+
+void tiled_heightmap::close()
+{
+  if(mapping)
+    munmap(const_cast<unsigned char*>(mapping), mapped_size);
+  mapping = nullptr;
+  mapped_size = 0;
+  header = nullptr;
+  index = nullptr;
+}
+
+
+//******************************************************************************
+//  Class: tile_cache
+//
+//  Purpose:  Keeps the tiles that are in use in a fixed number of layers of a
+//        GL_R16 texture array, paging them in from a tiled_heightmap on
+//        demand. When it's full, the least recently used tile that isn't
+//        needed this frame gives up its layer. A page table texture, one
+//        texel per tile, says which layer each tile is in (-1 if none) - that's
+//        how the shader finds them.
+//
+//  Functions:
+//
+//    begin_frame():
+//        Starts a frame. Tiles touched since the last one are in use.
+//
+//    request(tx, ty):
+//        Marks a tile as in use, and pages it in if it isn't resident. False
+//        if there was no layer to put it in.
+//
+//    end_frame():
+//        Uploads the page table, if anything moved.
+//******************************************************************************
+
+class tile_cache
+{
+public:
+  tile_cache(int layers = 64) : num_layers(layers), map(nullptr), array_tex(0), page_tex(0) {}
+
+  //sets up the textures for this map, and drops anything from the last one
+  void attach(const tiled_heightmap* m);
+
+  void begin_frame()    {frame++; page_table_changed = page_table_changed || misses_this_frame; misses_this_frame = 0;}
+  bool request(int tx, int ty);
+  void end_frame();
+
+  GLuint array_texture() const      {return array_tex;}
+  GLuint page_texture() const       {return page_tex;}
+
+  void report() const
+  {
+    cout << "tile cache: " << lru.size() << "/" << num_layers << " layers in use, "
+         << uploads << " uploads, " << evictions << " evictions, " << misses << " tiles with no layer" << endl;
+  }
+
+private:
+  typedef struct resident_t
+  {
+    int key;          //ty * tiles_x + tx
+    int layer;
+    long last_used;   //frame
+  } resident;
+
+  int num_layers;
+  const tiled_heightmap* map;
+  GLuint array_tex, page_tex;
+
+  std::list<resident> lru;    //most recently used at the front
+  std::unordered_map<int, std::list<resident>::iterator> lookup;
+  std::vector<int> free_layers;
+  std::vector<float> page_table;
+  bool page_table_changed;
+
+  long frame;
+  long uploads, evictions, misses;
+  int misses_this_frame;
+};
+
+
+void tile_cache::attach(const tiled_heightmap* m)
+{
+  map = m;
+  lru.clear();
+  lookup.clear();
+  free_layers.clear();
+  for(int i = num_layers - 1; i >= 0; i--)
+    free_layers.push_back(i);
+
+  page_table.assign(map->tiles_x() * map->tiles_y(), -1.0f);
+  page_table_changed = true;
+  frame = 0;
+  uploads = evictions = misses = 0;
+  misses_this_frame = 0;
+
+  int stored = map->tile_size() + 1;
+
+  glstate.delete_texture(array_tex);
+  glstate.delete_texture(page_tex);
+
+  //units 4 and 5, past the ones the water and the old single texture path use
+  glGenTextures(1, &array_tex);
+  glstate.bind_texture_for_upload(4, GL_TEXTURE_2D_ARRAY, array_tex);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R16, stored, stored, num_layers, 0, GL_RED, GL_UNSIGNED_SHORT, NULL);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  glGenTextures(1, &page_tex);
+  glstate.bind_texture_for_upload(5, GL_TEXTURE_2D, page_tex);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, map->tiles_x(), map->tiles_y(), 0, GL_RED, GL_FLOAT, &page_table[0]);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  page_table_changed = false;
+}
+
+bool tile_cache::request(int tx, int ty)
+{
+  int key = ty * map->tiles_x() + tx;
+
+  std::unordered_map<int, std::list<resident>::iterator>::iterator it = lookup.find(key);
+  if(it != lookup.end())
+  {//already resident, move it to the front
+    it->second->last_used = frame;
+    lru.splice(lru.begin(), lru, it->second);
+    return true;
+  }
+
+  int layer;
+  if(!free_layers.empty())
+  {
+    layer = free_layers.back();
+    free_layers.pop_back();
+  }
+  else
+  {
+    //the back of the list is the least recently used - if even that's in use
+    //this frame, every layer is, and this tile has to go without
+    resident& victim = lru.back();
+    if(victim.last_used == frame)
+    {
+      misses++;
+      misses_this_frame++;
+      return false;
+    }
+
+    layer = victim.layer;
+    page_table[victim.key] = -1.0f;
+    lookup.erase(victim.key);
+    lru.pop_back();
+    evictions++;
+  }
+
+  {
+    PROFILE_ZONE("tile upload");
+    int stored = map->tile_size() + 1;
+    //terrain::display() leaves unit 5 active - a cached bind to 4 wouldn't switch back to it
+    glstate.bind_texture_for_upload(4, GL_TEXTURE_2D_ARRAY, array_tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, stored, stored, 1, GL_RED, GL_UNSIGNED_SHORT, map->tile(tx, ty));
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    uploads++;
+  }
+
+  lru.push_front({key, layer, frame});
+  lookup[key] = lru.begin();
+  page_table[key] = layer;
+  page_table_changed = true;
+  return true;
+}
+
+void tile_cache::end_frame()
+{
+  if(!page_table_changed)
+    return;
+
+  glstate.bind_texture_for_upload(5, GL_TEXTURE_2D, page_tex);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, map->tiles_x(), map->tiles_y(), GL_RED, GL_FLOAT, &page_table[0]);
+  page_table_changed = false;
+}
+
+#endif
@@ -0,0 +1,598 @@
+#ifndef WATER_H
+#define WATER_H
+
+#include "common.hpp"
+#include "gl_state.hpp"
+#include "profiler.hpp"
+#include "texture_loader.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+
+//******************************************************************************
+//  Class: row_pool
+//
+//  Purpose:  One worker per hardware thread past the first, started once and
+//        kept waiting, so the ocean's passes - about eight a frame - don't
+//        each pay for starting and joining a set of threads.
+//
+//        run(count, f) calls f(first, last) on contiguous blocks of
+//        [0, count), one per thread, with the calling thread taking the first
+//        block, and returns when they're all done. One run at a time.
+//******************************************************************************
+
+class row_pool
+{
+public:
+  row_pool() : num_threads(std::max(1u, std::thread::hardware_concurrency())), generation(0), stopping(false)
+  {
+    for(int w = 1; w < num_threads; w++)
+      workers.push_back(std::thread(&row_pool::work, this, w));
+  }
+
+  ~row_pool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m);
+      stopping = true;
+    }
+    wake.notify_all();
+    for(auto& w : workers)
+      w.join();
+  }
+
+  void run(int count, const std::function<void(int, int)>& f)
+  {
+    int used = std::min(num_threads, count);
+    if(used <= 1)
+    {
+      f(0, count);
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m);
+      job = &f;
+      job_count = count;
+      job_threads = used;
+      pending = used - 1;
+      generation++;
+    }
+    wake.notify_all();
+
+    f(0, count / used);
+
+    std::unique_lock<std::mutex> lock(m);
+    done.wait(lock, [&]() {return pending == 0;});
+  }
+
+private:
+  int num_threads;
+  std::vector<std::thread> workers;
+
+  std::mutex m;
+  std::condition_variable wake, done;
+  unsigned generation;      //bumped for each run, so a worker knows there's something new
+  bool stopping;
+
+  const std::function<void(int, int)>* job;
+  int job_count, job_threads, pending;
+
+  void work(int w)
+  {
+    unsigned seen = 0;
+    std::unique_lock<std::mutex> lock(m);
+    while(true)
+    {
+      wake.wait(lock, [&]() {return stopping || generation != seen;});
+      if(stopping)
+        return;
+      seen = generation;
+
+      //fewer blocks than threads leaves the last few out
+      if(w >= job_threads)
+        continue;
+
+      const std::function<void(int, int)>& f = *job;
+      int first = (job_count * w) / job_threads, last = (job_count * (w + 1)) / job_threads;
+
+      lock.unlock();
+      f(first, last);
+      lock.lock();
+
+      if(--pending == 0)
+        done.notify_one();
+    }
+  }
+};
+
+
+//******************************************************************************
+//  Class: ocean
+//
+//  Purpose:  Tessendorf style FFT ocean, on the CPU. A Phillips spectrum is
+//        set up once with gaussian random amplitudes, and each step it's
+//        advanced to time t with the deep water dispersion relation, then
+//        brought back to a height field with an inverse 2D FFT.
+//
+//        Height and the x slope share one complex transform - both are real
+//        in the spatial domain, so one goes in the real part and one in the
+//        imaginary part. The z slope gets the other transform.
+//
+//        The FFTs are radix-2, on separate real and imaginary arrays so the
+//        butterfly loops are plain contiguous float math the compiler can
+//        vectorize. The 2D transform is a pass over the rows, a transpose,
+//        and another pass over the rows - each pass is split across the
+//        threads of one shared row_pool, a block of rows at a time.
+//
+//  Functions:
+//
+//    Constructor:
+//        Resolution (power of two), size of the patch in meters, wind.
+//
+//    step(t):
+//        Height and normals for time t, in seconds.
+//
+//    height(), normal():
+//        Results of the last step, resolution*resolution, row major.
+//******************************************************************************
+
+class ocean
+{
+public:
+  ocean(int resolution = 256, float patch_size = 64.0f, glm::vec2 wind = glm::vec2(12.0f, 4.0f));
+
+  void step(float t);
+
+  int get_resolution() const                      {return n;}
+  const std::vector<float>& height() const        {return heights;}
+  const std::vector<glm::vec3>& normal() const    {return normals;}
+
+  //ms per step at each of these resolutions
+  static void benchmark(int steps);
+
+private:
+  int n, log2n;
+  float length;
+
+  //initial spectrum h0(k) and h0(-k)*, and the angular frequency for each k
+  std::vector<std::complex<float>> h0, h0_conj_neg;
+  std::vector<float> omega, kx, kz;
+
+  //two fields being transformed, split into real and imaginary parts
+  std::vector<float> re[2], im[2];
+  std::vector<float> scratch_re, scratch_im;    //for the transpose
+
+  //fft tables - the twiddles for the stage with half size m start at index m
+  std::vector<int> bit_reverse;
+  std::vector<float> twiddle_re, twiddle_im;
+
+  std::vector<float> heights;
+  std::vector<glm::vec3> normals;
+
+  void fft_rows(std::vector<float>& r, std::vector<float>& i);
+  void fft_row(float* r, float* i);
+  void transpose(std::vector<float>& r, std::vector<float>& i);
+
+  //calls f(first, last) on contiguous blocks of [0, count), one per hardware thread
+  static void parallel_rows(int count, const std::function<void(int, int)>& f);
+  static row_pool& pool();
+};
+
+
+ocean::ocean(int resolution, float patch_size, glm::vec2 wind) : n(resolution), length(patch_size)
+{
+  log2n = 0;
+  while((1 << log2n) < n)
+    log2n++;
+
+  const float g = 9.81f;
+  const float amplitude = 0.00002f;
+  float wind_speed = glm::length(wind);
+  glm::vec2 wind_dir = wind / wind_speed;
+  float largest = wind_speed * wind_speed / g;    //largest wave the wind makes
+  float smallest = largest / 1000.0f;             //damp the ones much smaller than that
+
+  std::mt19937 gen(1337);
+  std::normal_distribution<float> gauss(0.0f, 1.0f);
+
+  std::vector<std::complex<float>> spectrum(n * n);
+  omega.resize(n * n);
+  kx.resize(n * n);
+  kz.resize(n * n);
+
+  for(int z = 0; z < n; z++)
+    for(int x = 0; x < n; x++)
+    {
+      //fft ordering, so nothing has to be shifted around after the transform
+      glm::vec2 k = JonDefault::twopi / length * glm::vec2(x < n/2 ? x : x - n, z < n/2 ? z : z - n);
+      float k_len = glm::length(k);
+
+      int index = z * n + x;
+      kx[index] = k.x;
+      kz[index] = k.y;
+      omega[index] = std::sqrt(g * k_len);
+
+      //the nyquist row and column are their own mirror image, so i*k*h there can't come out real - leave them empty
+      float phillips = 0.0f;
+      if(k_len > 0.000001f && x != n/2 && z != n/2)
+      {
+        float k_dot_w = glm::dot(k / k_len, wind_dir);
+        phillips = amplitude * std::exp(-1.0f / (k_len * largest * k_len * largest)) / (k_len * k_len * k_len * k_len)
+                 * k_dot_w * k_dot_w * std::exp(-k_len * k_len * smallest * smallest);
+      }
+
+      spectrum[index] = std::complex<float>(gauss(gen), gauss(gen)) * std::sqrt(phillips * 0.5f);
+    }
+
+  h0 = spectrum;
+  h0_conj_neg.resize(n * n);
+  for(int z = 0; z < n; z++)
+    for(int x = 0; x < n; x++)
+      h0_conj_neg[z * n + x] = std::conj(spectrum[((n - z) % n) * n + (n - x) % n]);
+
+  for(int f = 0; f < 2; f++)
+  {
+    re[f].resize(n * n);
+    im[f].resize(n * n);
+  }
+  scratch_re.resize(n * n);
+  scratch_im.resize(n * n);
+
+  bit_reverse.resize(n);
+  for(int i = 0; i < n; i++)
+  {
+    int r = 0;
+    for(int b = 0; b < log2n; b++)
+      if(i & (1 << b))
+        r |= 1 << (log2n - 1 - b);
+    bit_reverse[i] = r;
+  }
+
+  //inverse transform, so the twiddles go the positive way around
+  twiddle_re.resize(std::max(n, 2));
+  twiddle_im.resize(std::max(n, 2));
+  for(int m = 1; m < n; m *= 2)
+    for(int j = 0; j < m; j++)
+    {
+      twiddle_re[m + j] = std::cos(JonDefault::twopi * 0.5f * j / m);
+      twiddle_im[m + j] = std::sin(JonDefault::twopi * 0.5f * j / m);
+    }
+
+  heights.resize(n * n);
+  normals.resize(n * n);
+}
+
+void ocean::step(float t)
+{
+  PROFILE_ZONE("ocean::step");
+
+  //advance the spectrum - field 0 is height + i * x slope, field 1 is the z slope
+  parallel_rows(n, [&](int first, int last)
+  {
+    for(int index = first * n; index < last * n; index++)
+    {
+      float c = std::cos(omega[index] * t), s = std::sin(omega[index] * t);
+      std::complex<float> h = h0[index] * std::complex<float>(c, s) + h0_conj_neg[index] * std::complex<float>(c, -s);
+
+      //i*kx*h for the slope, then i times that to put it in the imaginary part
+      std::complex<float> packed = h - kx[index] * h;
+      std::complex<float> slope_z = std::complex<float>(0.0f, kz[index]) * h;
+
+      re[0][index] = packed.real();   im[0][index] = packed.imag();
+      re[1][index] = slope_z.real();  im[1][index] = slope_z.imag();
+    }
+  });
+
+  for(int f = 0; f < 2; f++)
+  {
+    fft_rows(re[f], im[f]);
+    transpose(re[f], im[f]);
+    fft_rows(re[f], im[f]);
+    //left transposed - indexed [x][z] from here on
+  }
+
+  parallel_rows(n, [&](int first, int last)
+  {
+    for(int z = first; z < last; z++)
+      for(int x = 0; x < n; x++)
+      {
+        int from = x * n + z;
+        int to = z * n + x;
+
+        heights[to] = re[0][from];
+
+        float sx = im[0][from], sz = re[1][from];
+        normals[to] = glm::normalize(glm::vec3(-sx, 1.0f, -sz));
+      }
+  });
+}
+
+void ocean::fft_rows(std::vector<float>& r, std::vector<float>& i)
+{
+  parallel_rows(n, [&](int first, int last)
+  {
+    for(int row = first; row < last; row++)
+      fft_row(&r[row * n], &i[row * n]);
+  });
+}
+
+void ocean::fft_row(float* r, float* i)
+{
+  for(int a = 0; a < n; a++)
+  {
+    int b = bit_reverse[a];
+    if(a < b)
+    {
+      std::swap(r[a], r[b]);
+      std::swap(i[a], i[b]);
+    }
+  }
+
+  for(int m = 1; m < n; m *= 2)
+  {
+    const float* wr = &twiddle_re[m];
+    const float* wi = &twiddle_im[m];
+
+    for(int block = 0; block < n; block += 2 * m)
+    {
+      float* __restrict ar = r + block;
+      float* __restrict ai = i + block;
+      float* __restrict br = r + block + m;
+      float* __restrict bi = i + block + m;
+
+      for(int j = 0; j < m; j++)
+      {
+        float tr = br[j] * wr[j] - bi[j] * wi[j];
+        float ti = br[j] * wi[j] + bi[j] * wr[j];
+        br[j] = ar[j] - tr;
+        bi[j] = ai[j] - ti;
+        ar[j] = ar[j] + tr;
+        ai[j] = ai[j] + ti;
+      }
+    }
+  }
+}
+
+void ocean::transpose(std::vector<float>& r, std::vector<float>& i)
+{
+  //in tiles, so both sides stay in cache
+  const int tile = 32;
+  parallel_rows(n / std::min(tile, n), [&](int first, int last)
+  {
+    int t = std::min(tile, n);
+    for(int ty = first * t; ty < last * t; ty += t)
+      for(int tx = 0; tx < n; tx += t)
+        for(int y = ty; y < ty + t; y++)
+          for(int x = tx; x < tx + t; x++)
+          {
+            scratch_re[x * n + y] = r[y * n + x];
+            scratch_im[x * n + y] = i[y * n + x];
+          }
+  });
+
+  r.swap(scratch_re);
+  i.swap(scratch_im);
+}
+
+row_pool& ocean::pool()
+{
+  //started the first time an ocean steps, shared by all of them
+  static row_pool p;
+  return p;
+}
+
+void ocean::parallel_rows(int count, const std::function<void(int, int)>& f)
+{
+  pool().run(count, f);
+}
+
+void ocean::benchmark(int steps)
+{
+  cout << "ocean benchmark, " << steps << " steps each, " << std::max(1u, std::thread::hardware_concurrency()) << " threads:" << endl;
+
+  int sizes[] = {64, 128, 256, 512};
+  for(int size : sizes)
+  {
+    ocean o(size);
+    o.step(0.0f);   //warm up
+
+    auto start = std::chrono::steady_clock::now();
+    for(int s = 0; s < steps; s++)
+      o.step(s / 60.0f);
+    double ms = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000.0 / steps;
+
+    cout << "  " << size << "x" << size << ": " << ms << " ms per step" << endl;
+  }
+}
+
+
+//******************************************************************************
+//  Class: water
+//
+//  Purpose:  Draws the ocean with water_vert.glsl and water_frag.glsl. Each
+//        frame the height and normals from the ocean go up to the GPU
+//        through a pixel unpack buffer, which is orphaned before it's
+//        mapped, so the driver never has to wait for last frame's upload to
+//        finish before we write this frame's.
+//
+//        Heights go in an R32F texture, normals in RGBA8 encoded the same
+//        way as the normal maps in resources/textures/normals.
+//******************************************************************************
+
+class water
+{
+public:
+  water(int resolution = 256, int grid_size = 128);
+
+  void update(float t);   //seconds
+  void display();
+
+  void set_proj(glm::mat4 proj);
+
+private:
+  ocean sim;
+  int frame;
+
+  GLuint shader;
+  GLuint vao, buffer;
+  GLuint upload;          //GL_PIXEL_UNPACK_BUFFER
+  GLuint height_tex, normal_tex, color_tex;
+  GLuint t_loc, proj_loc;
+
+  int num_verts;
+};
+
+
+water::water(int resolution, int grid_size) : sim(resolution), frame(0)
+{
+  cout << " compiling water shaders" << endl;
+  {
+    PROFILE_ZONE("Shader compile");
+    Shader s("resources/shaders/water_vert.glsl", "resources/shaders/water_frag.glsl");
+    shader = s.Program;
+  }
+
+  //grid over [-1,1] on x and y, which is what the shader expects
+  std::vector<glm::vec3> points;
+  for(int y = 0; y < grid_size; y++)
+    for(int x = 0; x < grid_size; x++)
+    {
+      float x0 = -1.0f + 2.0f * x / grid_size, x1 = -1.0f + 2.0f * (x + 1) / grid_size;
+      float y0 = -1.0f + 2.0f * y / grid_size, y1 = -1.0f + 2.0f * (y + 1) / grid_size;
+
+      points.push_back(glm::vec3(x0, y0, 0));
+      points.push_back(glm::vec3(x1, y0, 0));
+      points.push_back(glm::vec3(x1, y1, 0));
+
+      points.push_back(glm::vec3(x0, y0, 0));
+      points.push_back(glm::vec3(x1, y1, 0));
+      points.push_back(glm::vec3(x0, y1, 0));
+    }
+  num_verts = points.size();
+
+  glGenVertexArrays(1, &vao);
+  glstate.bind_vertex_array(vao);
+
+  glGenBuffers(1, &buffer);
+  glstate.bind_buffer(GL_ARRAY_BUFFER, buffer);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * points.size(), &points[0], GL_STATIC_DRAW);
+
+  glstate.use_program(shader);
+
+  GLint position_attrib = glGetAttribLocation(shader, "vPosition");
+  glEnableVertexAttribArray(position_attrib);
+  glVertexAttribPointer(position_attrib, 3, GL_FLOAT, false, 0, (static_cast<const char*>(0) + (0)));
+
+  //the rest are declared but unused, constant values are fine
+  GLint normal_attrib = glGetAttribLocation(shader, "vNormal");
+  if(normal_attrib >= 0) glVertexAttrib3f(normal_attrib, 0.0f, 0.0f, 1.0f);
+
+
+  //textures - height and normal get replaced every frame, color is loaded once, in the background
+  int res = sim.get_resolution();
+
+  auto make_texture = [&](GLuint unit, GLuint& tex, GLenum internal, GLenum format, GLenum type, const void* data, int w, int h)
+  {
+    glGenTextures(1, &tex);
+    glstate.bind_texture_for_upload(unit, GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, internal, w, h, 0, format, type, data);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  };
+
+  make_texture(0, height_tex, GL_R32F, GL_RED, GL_FLOAT, NULL, res, res);
+  make_texture(1, normal_tex, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, NULL, res, res);
+
+  //decoded, with its mips, on a worker thread - it's grey until that's done
+  color_tex = textures.load(WATER_COLOR_TEXTURE, mip_color);
+
+  glUniform1i(glGetUniformLocation(shader, "height_tex"), 0);
+  glUniform1i(glGetUniformLocation(shader, "normal_tex"), 1);
+  glUniform1i(glGetUniformLocation(shader, "color_tex"), 2);
+  glUniform1i(glGetUniformLocation(shader, "ground_tex"), 2);
+  glUniform1i(glGetUniformLocation(shader, "scroll"), 0);
+  glUniform1f(glGetUniformLocation(shader, "scale"), 1.0f);
+
+  t_loc = glGetUniformLocation(shader, "t");
+  proj_loc = glGetUniformLocation(shader, "proj");
+
+  glGenBuffers(1, &upload);
+}
+
+void water::update(float t)
+{
+  PROFILE_ZONE("water::update");
+
+  sim.step(t);
+  frame++;
+
+  int res = sim.get_resolution();
+  size_t height_bytes = res * res * sizeof(float);
+  size_t normal_bytes = res * res * 4;
+
+  //orphan, then write straight into the new storage
+  glstate.bind_buffer(GL_PIXEL_UNPACK_BUFFER, upload);
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, height_bytes + normal_bytes, NULL, GL_STREAM_DRAW);
+  unsigned char* mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, height_bytes + normal_bytes,
+                                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  if(mapped)
+  {
+    //heights centered on 0.5, a couple meters either way, so the shader sees about what a height map png would give it
+    float* h = (float*)mapped;
+    for(int i = 0; i < res * res; i++)
+      h[i] = 0.5f + 0.2f * sim.height()[i];
+
+    unsigned char* n = mapped + height_bytes;
+    for(int i = 0; i < res * res; i++)
+    {//z up for the texture, since the grid is in the xy plane
+      glm::vec3 v = sim.normal()[i];
+      n[4*i + 0] = (unsigned char)(255.0f * (0.5f + 0.5f * v.x));
+      n[4*i + 1] = (unsigned char)(255.0f * (0.5f + 0.5f * v.z));
+      n[4*i + 2] = (unsigned char)(255.0f * (0.5f + 0.5f * v.y));
+      n[4*i + 3] = 255;
+    }
+
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    //display() leaves unit 2 active, so these have to select their units, not just check the binding
+    glstate.bind_texture_for_upload(0, GL_TEXTURE_2D, height_tex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, res, res, GL_RED, GL_FLOAT, (static_cast<const char*>(0) + (0)));
+    glstate.bind_texture_for_upload(1, GL_TEXTURE_2D, normal_tex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, res, res, GL_RGBA, GL_UNSIGNED_BYTE, (static_cast<const char*>(0) + (height_bytes)));
+  }
+
+  //anything else uploading textures expects client memory
+  glstate.bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void water::display()
+{
+  PROFILE_ZONE("water::display");
+
+  glstate.use_program(shader);
+  glstate.bind_vertex_array(vao);
+  glstate.bind_texture(0, GL_TEXTURE_2D, height_tex);
+  glstate.bind_texture(1, GL_TEXTURE_2D, normal_tex);
+  glstate.bind_texture(2, GL_TEXTURE_2D, color_tex);
+
+  glUniform1i(t_loc, frame);
+  glDrawArrays(GL_TRIANGLES, 0, num_verts);
+}
+
+void water::set_proj(glm::mat4 proj)
+{
+  glstate.use_program(shader);
+  glUniformMatrix4fv(proj_loc, 1, GL_FALSE, glm::value_ptr(proj));
+}
+
+#endif